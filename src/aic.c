@@ -27,23 +27,102 @@ typedef struct density_s
   long species_count;
 } density_t;
 
-static rtree_t ** crnodes;
-static rtree_t ** snodes;
-
-static long crnodes_count = 0;
-static long snodes_count = 0;
-
-static long accept_count = 0;
-static FILE * fp_log = NULL;
-
-static long species_count = 0;
+/* A node of the tree as seen by the sampler. The nodes of a run are kept in
+   an array in preorder and refer to each other by index, and the record
+   holds everything a proposal on the node reads, i.e. the events of its
+   relatives aside, a proposal touches a single cache line of the node */
+typedef struct mcmc_node_s
+{
+  int parent;
+  int left;
+  int right;
+  int sibling;
+  int event;
+  int slot;
+  int edge_count;
+
+  /* the edges to the two children longer than minbr, which move between the
+     coalescent and speciation distributions */
+  int spec_edge_delta;
+  double spec_edgelen_delta;
+
+  double coal_logl;
+  double left_coal_logl;
+  double right_coal_logl;
+} mcmc_node_t;
+
+/* The state of one MCMC run. Runs share nothing but the read-only DP table
+   of the ML tree, hence several runs can be sampled concurrently */
+struct mcmc_s
+{
+  rtree_t * tree;
+  long method;
+  long seed;
+  unsigned short * rstate;
+
+  /* power the AIC weights are raised to. Only the cold chain (heat 1) of a
+     run collects support values and statistics, the heated chains of
+     --mcmc_chains are silent */
+  double heat;
+  int cold;
+  int verbose;
+
+  /* nodes of the tree in preorder, and their compact records */
+  rtree_t ** tree_nodes;
+  mcmc_node_t * nodes;
+  long node_count;
+
+  /* indices of the inner nodes, in the same order for all chains of a run */
+  int * inner;
+  long inner_count;
+
+  /* support bookkeeping of each node, written back to the tree once the
+     run is finished */
+  long * speciation_start;
+  long * speciation_count;
+  double * aic_weight_start;
+  double * aic_support;
+
+  /* progress messages, stdout or a buffer when runs are concurrent */
+  FILE * out;
+  FILE * fp_log;
+
+  /* the coalescent roots and the speciation nodes whose two children are
+     coalescent roots, i.e. the nodes the proposals are drawn from */
+  int * crnodes;
+  int * snodes;
+  long crnodes_count;
+  long snodes_count;
+
+  long accept_count;
+  long species_count;
+  density_t * densities;
 
-static density_t * densities = NULL;
+  /* log-likelihoods of the chain at the sampled steps after the burnin,
+     kept by the cold chain for the convergence diagnostics of --mcmc_diag */
+  double * trace;
+  long trace_count;
+  long trace_alloc;
 
-static void mcmc_log(double logl, long sc)
+  /* state of the chain at the current step, and the step it ends at */
+  long step;
+  long steps;
+  double logl;
+  double max_aic;
+  double aic_weight_prefix_sum;
+  long coal_edge_count;
+  long spec_edge_count;
+  double spec_edgelen_sum;
+  double coal_edgelen_sum;
+  double coal_score;
+  double min_logl_seen;
+  double max_logl_seen;
+};
+
+static void mcmc_log(mcmc_t * mcmc, double logl, long sc)
 {
-  if (opt_mcmc_log)
-    fprintf(fp_log, "%f,%ld\n", logl, sc);
+  if (opt_mcmc_log && mcmc->cold)
+    fprintf(mcmc->fp_log, "%f,%ld\n", logl, sc);
 }
 
 static int cb_desc(const void * va, const void * vb)
@@ -59,25 +138,153 @@ static int cb_desc(const void * va, const void * vb)
   return 0;
 }
 
-static void mcmc_init(rtree_t * root, long seed)
+/* Build the compact records of the nodes of the tree, together with the
+   indices of its inner nodes and the support bookkeeping arrays. The index
+   of each node is kept in its mark while linking the records */
+static void mcmc_index_nodes(mcmc_t * mcmc)
 {
   long i;
+  rtree_t * root = mcmc->tree;
 
-  crnodes = (rtree_t **)xmalloc((size_t)(root->leaves)*sizeof(rtree_t *));
-  snodes = (rtree_t **)xmalloc((size_t)(root->leaves)*sizeof(rtree_t *));
+  mcmc->tree_nodes = (rtree_t **)xmalloc((size_t)(2*root->leaves - 1) *
+                                         sizeof(rtree_t *));
+  long count = rtree_preorder(root, mcmc->tree_nodes);
+  mcmc->node_count = count;
 
-  crnodes_count = 0;
-  snodes_count = 0;
-  accept_count = 0;
+  rtree_t ** tree_nodes = mcmc->tree_nodes;
+  int * mark = (int *)xmalloc((size_t)count * sizeof(int));
+  for (i = 0; i < count; ++i)
+  {
+    mark[i] = tree_nodes[i]->mark;
+    tree_nodes[i]->mark = (int)i;
+  }
 
-  densities = (density_t *)xmalloc((size_t)(root->leaves+1)*sizeof(density_t));
-  memset(densities, 0, (size_t)(root->leaves+1) * sizeof(density_t));
+  mcmc->nodes = (mcmc_node_t *)xcalloc((size_t)count, sizeof(mcmc_node_t));
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = tree_nodes[i];
+    mcmc_node_t * node = mcmc->nodes + i;
+
+    node->parent = node->sibling = -1;
+    node->left = node->right = -1;
+    node->event = x->event;
+    node->slot = -1;
+    node->edge_count = x->edge_count;
+    node->coal_logl = x->coal_logl;
+
+    if (x->parent)
+    {
+      node->parent = x->parent->mark;
+      node->sibling = (x->parent->left == x) ?
+                        x->parent->right->mark : x->parent->left->mark;
+    }
+
+    if (x->left)
+    {
+      node->left = x->left->mark;
+      node->right = x->right->mark;
+      node->left_coal_logl = x->left->coal_logl;
+      node->right_coal_logl = x->right->coal_logl;
+
+      if (x->left->length > opt_minbr)
+      {
+        ++node->spec_edge_delta;
+        node->spec_edgelen_delta += x->left->length;
+      }
+      if (x->right->length > opt_minbr)
+      {
+        ++node->spec_edge_delta;
+        node->spec_edgelen_delta += x->right->length;
+      }
+    }
+  }
+
+  rtree_t ** inner_node_list = (rtree_t **)xmalloc((size_t)(root->leaves-1) *
+                                                   sizeof(rtree_t *));
+  mcmc->inner_count = rtree_query_innernodes(root, inner_node_list);
+  mcmc->inner = (int *)xmalloc((size_t)mcmc->inner_count * sizeof(int));
+  for (i = 0; i < mcmc->inner_count; ++i)
+    mcmc->inner[i] = inner_node_list[i]->mark;
+  free(inner_node_list);
+
+  mcmc->speciation_start = (long *)xcalloc((size_t)count, sizeof(long));
+  mcmc->speciation_count = (long *)xcalloc((size_t)count, sizeof(long));
+  mcmc->aic_weight_start = (double *)xcalloc((size_t)count, sizeof(double));
+  mcmc->aic_support = (double *)xmalloc((size_t)count * sizeof(double));
+
+  for (i = 0; i < count; ++i)
+  {
+    mcmc->aic_support[i] = tree_nodes[i]->aic_support;
+    tree_nodes[i]->mark = mark[i];
+  }
+  free(mark);
+}
+
+static void mcmc_init(mcmc_t * mcmc)
+{
+  long i;
+  rtree_t * root = mcmc->tree;
+
+  mcmc->crnodes = (int *)xmalloc((size_t)(root->leaves) * sizeof(int));
+  mcmc->snodes = (int *)xmalloc((size_t)(root->leaves) * sizeof(int));
+
+  mcmc->crnodes_count = 0;
+  mcmc->snodes_count = 0;
+  mcmc->accept_count = 0;
+
+  mcmc->densities = (density_t *)xmalloc((size_t)(root->leaves+1) *
+                                         sizeof(density_t));
+  memset(mcmc->densities, 0, (size_t)(root->leaves+1) * sizeof(density_t));
   for (i = 0; i < root->leaves+1; ++i)
-    densities[i].species_count = i;
+    mcmc->densities[i].species_count = i;
 
-  /* open log file */
-  if (opt_mcmc_log)
-    fp_log = open_file_ext("log", seed);
+  mcmc_index_nodes(mcmc);
+
+  if (opt_mcmc_diag && mcmc->cold)
+  {
+    mcmc->trace_alloc = 1024;
+    mcmc->trace = (double *)xmalloc((size_t)mcmc->trace_alloc *
+                                    sizeof(double));
+  }
+
+  /* open log file. A resumed run continues the log of the checkpoint */
+  if (opt_mcmc_log && mcmc->cold)
+    mcmc->fp_log = open_file_ext_mode("log",
+                                      mcmc->seed,
+                                      opt_resume ? "r+" : "w");
+}
+
+/* Free the compact state of a run */
+static void mcmc_free_nodes(mcmc_t * mcmc)
+{
+  free(mcmc->crnodes);
+  free(mcmc->snodes);
+  free(mcmc->speciation_start);
+  free(mcmc->speciation_count);
+  free(mcmc->aic_weight_start);
+  free(mcmc->aic_support);
+  free(mcmc->inner);
+  free(mcmc->nodes);
+  free(mcmc->tree_nodes);
+}
+
+/* Write the events and the support bookkeeping of the run back to the nodes
+   of the tree */
+static void mcmc_writeback(mcmc_t * mcmc)
+{
+  long i;
+
+  for (i = 0; i < mcmc->node_count; ++i)
+  {
+    rtree_t * x = mcmc->tree_nodes[i];
+
+    x->event = mcmc->nodes[i].event;
+    x->mcmc_slot = mcmc->nodes[i].slot;
+    x->speciation_start = mcmc->speciation_start[i];
+    x->speciation_count = mcmc->speciation_count[i];
+    x->aic_weight_start = mcmc->aic_weight_start[i];
+    x->aic_support = mcmc->aic_support[i];
+  }
 }
 
 static void init_null(rtree_t * root)
@@ -94,34 +301,30 @@ static void init_null(rtree_t * root)
   free(inner_node_list);
 }
 
-static void mcmc_stats_init(rtree_t * root)
+static void mcmc_stats_init(mcmc_t * mcmc)
 {
-  int i;
-
-  rtree_t ** inner_node_list = (rtree_t **)xmalloc((size_t)(root->leaves-1) *
-                                                   sizeof(rtree_t *));
-  rtree_query_innernodes(root, inner_node_list);
+  long j;
 
-  for (i = 0; i < root->leaves - 1; ++i)
+  for (j = 0; j < mcmc->inner_count; ++j)
   {
-    if (inner_node_list[i]->event == EVENT_COALESCENT)
+    int i = mcmc->inner[j];
+
+    if (mcmc->nodes[i].event == EVENT_COALESCENT)
     {
-      inner_node_list[i]->speciation_start = -1;
-      inner_node_list[i]->aic_weight_start = 0; // Just to initialize - it's not used
+      mcmc->speciation_start[i] = -1;
+      mcmc->aic_weight_start[i] = 0; // Just to initialize - it's not used
     }
     else
     {
-      inner_node_list[i]->speciation_start = opt_mcmc_burnin-1;
-      inner_node_list[i]->aic_weight_start = 0; // This one should be used
+      mcmc->speciation_start[i] = opt_mcmc_burnin-1;
+      mcmc->aic_weight_start[i] = 0; // This one should be used
     }
 
-    inner_node_list[i]->speciation_count = 0;
+    mcmc->speciation_count[i] = 0;
   }
-
-  free(inner_node_list);
 }
 
-static void hpd(long n, FILE * fp)
+static void hpd(mcmc_t * mcmc, long n, FILE * fp)
 {
   long i;
   long min, max;
@@ -133,333 +336,284 @@ static void hpd(long n, FILE * fp)
   memset(indices, 0, (size_t)(n+2) * sizeof(long));
 
   for (i = 1; i <= n; ++i)
-    densities_sum += densities[i].logl;
+    densities_sum += mcmc->densities[i].logl;
 
   max = 0; min = n+1;
   for (i = 1; i <= n; ++i)
   {
-    acc_sum += densities[i].logl;
-    indices[densities[i].species_count] = 1;
+    acc_sum += mcmc->densities[i].logl;
+    indices[mcmc->densities[i].species_count] = 1;
 
-    if (densities[i].species_count < min)
-      min = densities[i].species_count;
+    if (mcmc->densities[i].species_count < min)
+      min = mcmc->densities[i].species_count;
 
-    if (densities[i].species_count > max)
-      max = densities[i].species_count;
+    if (mcmc->densities[i].species_count > max)
+      max = mcmc->densities[i].species_count;
 
     if (acc_sum / densities_sum >= opt_mcmc_credible)
       break;
   }
 
   fprintf(fp, "CCI (%ld,%ld)\n", min, max);
-  if (!opt_quiet)
-    fprintf(stdout, "CCI (%ld,%ld)\n", min, max);
+  if (mcmc->verbose)
+    fprintf(mcmc->out, "CCI (%ld,%ld)\n", min, max);
 
 
   fprintf(fp, "HPD ");
-  if (!opt_quiet)
-    printf("HPD ");
+  if (mcmc->verbose)
+    fprintf(mcmc->out, "HPD ");
   for (i = 1; i <= n+1; ++i)
   {
     if (indices[i] == 1 && indices[i-1] == 0)
     {
       fprintf(fp, "(%ld,", i);
-      if (!opt_quiet)
-        printf("(%ld,", i);
+      if (mcmc->verbose)
+        fprintf(mcmc->out, "(%ld,", i);
     }
     if (indices[i] == 0 && indices[i-1] == 1)
     {
       fprintf(fp, "%ld) ", i-1);
-      if (!opt_quiet)
-        printf("%ld) ", i-1);
+      if (mcmc->verbose)
+        fprintf(mcmc->out, "%ld) ", i-1);
     }
   }
   fprintf(fp,"\n");
-  if (!opt_quiet)
-    printf("\n");
+  if (mcmc->verbose)
+    fprintf(mcmc->out, "\n");
   free(indices);
 
 }
 
-static void mcmc_finalize(rtree_t * root,
-                          double mcmc_min_logl,
-                          double mcmc_max_logl,
-                          long seed,
-                          double aic_weight_prefix_sum)
+static void mcmc_finalize(mcmc_t * mcmc)
 {
-  long i;
+  long i,j;
+  rtree_t * root = mcmc->tree;
+  long seed = mcmc->seed;
+  double aic_weight_prefix_sum = mcmc->aic_weight_prefix_sum;
 
-  if (!opt_quiet)
+  if (mcmc->verbose)
   {
-    printf ("Minimum log-likelihood observed in mcmc run: %f\n", mcmc_min_logl);
-    printf ("Maximum log-likelihood observed in mcmc run: %f\n", mcmc_max_logl);
+    fprintf(mcmc->out,
+            "Minimum log-likelihood observed in mcmc run: %f\n",
+            mcmc->min_logl_seen);
+    fprintf(mcmc->out,
+            "Maximum log-likelihood observed in mcmc run: %f\n",
+            mcmc->max_logl_seen);
   }
 
-  /* write support values to all nodes */
-  rtree_t ** inner_node_list = (rtree_t **)xmalloc((size_t)(root->leaves-1) *
-                                                   sizeof(rtree_t *));
-  rtree_query_innernodes(root, inner_node_list);
-
-  for (i = 0; i < root->leaves - 1; ++i)
+  /* compute the support values of the inner nodes and write them, together
+     with the delimitation, back to the tree */
+  for (j = 0; j < mcmc->inner_count; ++j)
   {
-    if (inner_node_list[i]->speciation_start != -1)
+    i = mcmc->inner[j];
+
+    if (mcmc->speciation_start[i] != -1)
     {
-      inner_node_list[i]->speciation_count = inner_node_list[i]->speciation_count +
-                                             opt_mcmc_steps -
-                                             inner_node_list[i]->speciation_start;
-      inner_node_list[i]->aic_support += aic_weight_prefix_sum - inner_node_list[i]->aic_weight_start;
+      mcmc->speciation_count[i] = mcmc->speciation_count[i] +
+                                  mcmc->steps -
+                                  mcmc->speciation_start[i];
+      mcmc->aic_support[i] += aic_weight_prefix_sum - mcmc->aic_weight_start[i];
     }
 
-    inner_node_list[i]->aic_support /= aic_weight_prefix_sum;
+    mcmc->aic_support[i] /= aic_weight_prefix_sum;
 
-    inner_node_list[i]->support = inner_node_list[i]->aic_support;
-
-    /*inner_node_list[i]->support = inner_node_list[i]->speciation_count /
-                                  (double)(opt_mcmc_steps-opt_mcmc_burnin+1);*/
+    /*support = speciation_count / (double)(opt_mcmc_steps-opt_mcmc_burnin+1);*/
   }
 
-  free(inner_node_list);
-  free(crnodes);
-  free(snodes);
+  mcmc_writeback(mcmc);
+  for (j = 0; j < mcmc->inner_count; ++j)
+    mcmc->tree_nodes[mcmc->inner[j]]->support =
+      mcmc->aic_support[mcmc->inner[j]];
 
   if (opt_mcmc_log)
   {
-    if (!opt_quiet)
-      fprintf(stdout, "Log written in %s.%ld.log ...\n", opt_outfile, seed);
+    if (mcmc->verbose)
+      fprintf(mcmc->out, "Log written in %s.%ld.log ...\n", opt_outfile, seed);
 
-    fclose(fp_log);
+    fclose(mcmc->fp_log);
   }
 
   FILE * fp_stats = open_file_ext("stats", seed);
 
   double densities_sum = 0;
   for (i = 1; i <= root->leaves; ++i)
-    densities_sum += densities[i].logl;
+    densities_sum += mcmc->densities[i].logl;
 
   for (i = 1; i <= root->leaves; ++i)
   {
     fprintf(fp_stats,
             "%ld,%f\n",
             i,
-            (densities[i].logl/densities_sum)*100);
+            (mcmc->densities[i].logl/densities_sum)*100);
   }
 
   /* compute a HPD */
-  qsort(densities+1, (size_t)(root->leaves), sizeof(density_t), cb_desc);
-  hpd(root->leaves, fp_stats);
+  qsort(mcmc->densities+1, (size_t)(root->leaves), sizeof(density_t), cb_desc);
+  hpd(mcmc, root->leaves, fp_stats);
 
-  if (!opt_quiet)
-    fprintf(stdout,
+  if (mcmc->verbose)
+    fprintf(mcmc->out,
             "Statistics written in %s.%ld.stats ...\n",
             opt_outfile,
             seed);
 
   fclose(fp_stats);
-  free(densities);
+  free(mcmc->densities);
 }
 
-static void dp_recurse(rtree_t * node, long method)
+/* Add node to the list of speciation nodes in case its two direct
+   descendents are coalescent roots and also the subtree at node has at least
+   one branch length greater than minbr */
+static void add_snode(mcmc_t * mcmc, int i)
 {
-  int k,j;
+  mcmc_node_t * node = mcmc->nodes + i;
 
-  /* bottom-up recursion */
-
-  if (node->left)  dp_recurse(node->left,  method);
-  if (node->right) dp_recurse(node->right, method);
-
-  /*                u_vec
-                *
-               / \
-              /   \
-     v_vec   *     *  w_vec    */
-
-  dp_vector_t * u_vec = node->vector;
-
-  double spec_logl = loglikelihood(node->spec_edge_count,
-                                   node->spec_edgelen_sum);
-
-  u_vec[0].spec_edgelen_sum = 0;
-  u_vec[0].score_multi = node->coal_logl + spec_logl;
-  u_vec[0].score_single = node->coal_logl + spec_logl;
-  u_vec[0].coal_multi_logl = node->coal_logl;
-  u_vec[0].species_count = 1;
-  u_vec[0].filled = 1;
-
-  if (!node->left) return;
-
-  dp_vector_t * v_vec = node->left->vector;
-  dp_vector_t * w_vec = node->right->vector;
+  if ((mcmc->nodes[node->left].event == EVENT_COALESCENT) &&
+      (mcmc->nodes[node->right].event == EVENT_COALESCENT) &&
+      (node->edge_count))
+  {
+    node->slot = mcmc->snodes_count;
+    mcmc->snodes[mcmc->snodes_count++] = i;
+  }
+}
 
-  assert(node->spec_edge_count >= 0);
+/* Add node to the list of coalescent roots in case it is not a tip AND if
+   the subtree rooted at node has at least one edge longer than minbr */
+static void add_crnode(mcmc_t * mcmc, int i)
+{
+  mcmc_node_t * node = mcmc->nodes + i;
 
-  int u_edge_count = 0;
-  double u_edgelen_sum = 0;
+  node->event = EVENT_COALESCENT;
 
-  /* check whether edges (u,v) and (u,w) are > min branch length */
-  if (node->left->length > opt_minbr)
-  {
-    u_edge_count++;
-    u_edgelen_sum += node->left->length;
-  }
-  if (node->right->length > opt_minbr)
+  if (node->edge_count)
   {
-    u_edge_count++;
-    u_edgelen_sum += node->right->length;
+    node->slot = mcmc->crnodes_count;
+    mcmc->crnodes[mcmc->crnodes_count++] = i;
   }
+}
 
-  for (j = 0; j <= node->left->edge_count; ++j)
+/* Build the lists of coalescent roots and speciation nodes of the
+   delimitation given by the events of the nodes */
+static void mcmc_relist(mcmc_t * mcmc, bool * warning_minbr)
+{
+  long top = 0;
+  mcmc_node_t * nodes = mcmc->nodes;
+
+  mcmc->crnodes_count = 0;
+  mcmc->snodes_count = 0;
+
+  /* nodes are pushed twice, once for entering (state 0) and once for
+     leaving (state 1) their subtree, such that coalescent roots are listed
+     in preorder and speciation nodes in postorder */
+  int * stack = (int *)xmalloc((size_t)(2*mcmc->tree->leaves + 1) *
+                               sizeof(int));
+  int * state = (int *)xmalloc((size_t)(2*mcmc->tree->leaves + 1) *
+                               sizeof(int));
+
+  stack[top] = 0; state[top++] = 0;
+  while (top)
   {
-    for (k = 0; k <= node->right->edge_count; ++k)
-    {
-      /* if at least one of the two entries is not valid/filled, skip */
-      if (!v_vec[j].filled || !w_vec[k].filled) continue;
-
-      int i = j + k + u_edge_count;
-
-      /* set the number of species */
-      unsigned int u_species_count = v_vec[j].species_count +
-                                     w_vec[k].species_count;
-
-      /* compute multi-rate coalescent log-likelihood */
-      double coal_multi_logl = v_vec[j].coal_multi_logl +
-                               w_vec[k].coal_multi_logl;
-
-      /* compute coalescent edge count and length sum of subtree u */
-      double u_spec_edgelen_sum = v_vec[j].spec_edgelen_sum +
-                                  w_vec[k].spec_edgelen_sum +
-                                  u_edgelen_sum;
-      int coal_edge_count = node->edge_count - i;            /* change to int */
-      double coal_edgelen_sum = node->edgelen_sum - u_spec_edgelen_sum;
+    int x = stack[--top];
 
+    if (state[top])
+    {
+      add_snode(mcmc, x);
+      continue;
+    }
 
-      /* compute single-rate coalescent log-likelihood */
-      double coal_single_logl = loglikelihood(coal_edge_count,coal_edgelen_sum);
-
-      /* compute total speciation log-likelihood */
-      double spec_edgelen_sum = node->spec_edgelen_sum +
-                                u_edgelen_sum +
-                                v_vec[j].spec_edgelen_sum +
-                                w_vec[k].spec_edgelen_sum;
-
-      int spec_edge_count  = node->spec_edge_count + i;
-      assert(u_species_count > 0);
-      spec_logl = loglikelihood(spec_edge_count,spec_edgelen_sum);
-
-
-      /* compute single- and multi-rate scores */
-      double score_multi = coal_multi_logl + spec_logl;
-      double score_single = coal_single_logl + spec_logl;
-      double score = score_multi;
-      double best_score = u_vec[i].score_multi;
-
-      if (method == PTP_METHOD_SINGLE)
-      {
-        score = score_single;
-        best_score = u_vec[i].score_single;
-      }
+    nodes[x].slot = -1;
 
-      if (!u_vec[i].filled || score > best_score)
-      {
-        u_vec[i].score_multi = score_multi;
-        u_vec[i].score_single = score_single;
-        u_vec[i].spec_edgelen_sum = u_spec_edgelen_sum;
-        u_vec[i].coal_multi_logl = coal_multi_logl;
-        u_vec[i].vec_left = j;
-        u_vec[i].vec_right = k;
-        u_vec[i].species_count = u_species_count;
-        u_vec[i].filled = 1;
-      }
+    if (nodes[x].event == EVENT_SPECIATION)
+    {
+      if (mcmc->tree_nodes[x]->length <= opt_minbr && nodes[x].parent != -1)
+        *warning_minbr = true;
 
+      stack[top] = x;              state[top++] = 1;
+      stack[top] = nodes[x].right; state[top++] = 0;
+      stack[top] = nodes[x].left;  state[top++] = 0;
     }
+    else
+      add_crnode(mcmc, x);
   }
+
+  free(state);
+  free(stack);
 }
 
-static void backtrack_random(rtree_t * node,
-                             bool *warning_minbr)
+/* Back-track the shared DP table of mltree from entry 'index' and set the
+   events of the corresponding nodes of tree, which has the same topology */
+static void backtrack(rtree_t * mltree,
+                      rtree_t * node,
+                      long index,
+                      long method)
 
 {
-
-  node->mcmc_slot = -1;
-
-  if (node->event == EVENT_SPECIATION)
+  long top = 0;
+
+  /* nodes are pushed together with their counterpart in mltree and the DP
+     entry to back-track from */
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(2*node->leaves + 1) *
+                                         sizeof(rtree_t *));
+  rtree_t ** mlstack = (rtree_t **)xmalloc((size_t)(2*node->leaves + 1) *
+                                           sizeof(rtree_t *));
+  long * indices = (long *)xmalloc((size_t)(2*node->leaves + 1) *
+                                   sizeof(long));
+
+  stack[top] = node; mlstack[top] = mltree; indices[top++] = index;
+  while (top)
   {
-    if (node->length <= opt_minbr && node->parent) *warning_minbr = true;
+    rtree_t * x = stack[--top];
+    rtree_t * mlx = mlstack[top];
+    long i = indices[top];
 
-    backtrack_random(node->left,  warning_minbr);
-    backtrack_random(node->right, warning_minbr);
+    dp_vector_restore(mlx, method);
 
-    /* add to list of speciation nodes only if its two direct descendents
-       are coalescent roots and also the subtree at node has at least one
-       branch length greater than minbr */
-    if ((node->left->event == EVENT_COALESCENT) &&
-        (node->right->event == EVENT_COALESCENT) &&
-        (node->edge_count))
+    if (dp_vec_left(mlx, (int)i, method) != -1)
     {
-      node->mcmc_slot = snodes_count;
-      snodes[snodes_count++] = node;
-    }
-
-  }
-  else
-  {
+      x->event = EVENT_SPECIATION;
 
-    node->event = EVENT_COALESCENT;
+      stack[top] = x->right;
+      mlstack[top] = mlx->right;
+      indices[top++] = dp_vec_right(mlx,(int)i,method);
 
-    /* add to list of coalescent roots in case it is not a tip AND if
-       the subtree rooted at node has at least one edge longer than minbr */
-    if (node->edge_count)
-    {
-      node->mcmc_slot = crnodes_count;
-      crnodes[crnodes_count++] = node;
+      stack[top] = x->left;
+      mlstack[top] = mlx->left;
+      indices[top++] = dp_vec_left(mlx, (int)i, method);
     }
+    else
+      x->event = EVENT_COALESCENT;
+
+    dp_vector_release(mlx);
   }
-}
 
-static void backtrack(rtree_t * node,
-                      long index,
-                      bool *warning_minbr)
+  free(indices);
+  free(mlstack);
+  free(stack);
+}
 
+/* Copy the per-node coalescent log-likelihoods computed by dp_init() on
+   mltree to the nodes of tree */
+static void share_coal_logl(rtree_t * mltree, rtree_t * tree)
 {
-  dp_vector_t * vec = node->vector;
-
-  node->mcmc_slot = -1;
-
-  if ((vec[index].vec_left != -1) && (vec[index].vec_right != -1))
-  {
-    node->event = EVENT_SPECIATION;
+  int i;
+  int count;
 
-    if (node->length <= opt_minbr && node->parent) *warning_minbr = true;
+  rtree_t ** mlnodes = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                           sizeof(rtree_t *));
+  rtree_t ** nodes = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                         sizeof(rtree_t *));
 
-    backtrack(node->left, vec[index].vec_left, warning_minbr);
-    backtrack(node->right,vec[index].vec_right,warning_minbr);
+  count = rtree_preorder(mltree, mlnodes);
+  rtree_preorder(tree, nodes);
 
-    /* add to list of speciation nodes only if its two direct descendents
-       are coalescent roots and also the subtree at node has at least one
-       branch length greater than minbr */
-    if ((node->left->event == EVENT_COALESCENT) &&
-        (node->right->event == EVENT_COALESCENT) &&
-        (node->edge_count))
-    {
-      node->mcmc_slot = snodes_count;
-      snodes[snodes_count++] = node;
-    }
+  for (i = 0; i < count; ++i)
+    nodes[i]->coal_logl = mlnodes[i]->coal_logl;
 
-  }
-  else
-  {
-    node->event = EVENT_COALESCENT;
-
-    /* add to list of coalescent roots in case it is not a tip AND if
-       the subtree rooted at node has at least one edge longer than minbr */
-    if (node->edge_count)
-    {
-      node->mcmc_slot = crnodes_count;
-      crnodes[crnodes_count++] = node;
-    }
-  }
+  free(nodes);
+  free(mlnodes);
 }
 
-static void speciate(long r)
+static void speciate(mcmc_t * mcmc, long r)
 {
   /*            CR                         S
                 *                          *
@@ -471,16 +625,18 @@ static void speciate(long r)
   /* select the coalescent root at position r and split it into
      two coalescent root nodes */
 
-  rtree_t * node = crnodes[r];
+  mcmc_node_t * nodes = mcmc->nodes;
+  int i = mcmc->crnodes[r];
+  mcmc_node_t * node = nodes + i;
 
   /* move the last node of the list to the position of the node
      we just used */
-  if (r != (crnodes_count-1))
+  if (r != (mcmc->crnodes_count-1))
   {
-    crnodes[r] = crnodes[crnodes_count-1];
-    crnodes[r]->mcmc_slot = r;
+    mcmc->crnodes[r] = mcmc->crnodes[mcmc->crnodes_count-1];
+    nodes[mcmc->crnodes[r]].slot = r;
   }
-  --crnodes_count;
+  --mcmc->crnodes_count;
 
   /* eliminate parent from snodes if both its children were coalescent
      roots, i.e. we had the case below:
@@ -495,52 +651,54 @@ static void speciate(long r)
            C  *     *  C                  CR  *     *  CR
 
   */
-  if (node->parent &&
-      node->parent->left->event == EVENT_COALESCENT &&
-      node->parent->right->event == EVENT_COALESCENT)
+  if (node->parent != -1 &&
+      node->event == EVENT_COALESCENT &&
+      nodes[node->sibling].event == EVENT_COALESCENT)
   {
-    assert(node->parent->mcmc_slot != -1);
+    mcmc_node_t * parent = nodes + node->parent;
+
+    assert(parent->slot != -1);
     assert(node->edge_count);
 
     /* perform the following only if the parent is not the last node
        in the list */
-    if (node->parent->mcmc_slot != snodes_count-1)
+    if (parent->slot != mcmc->snodes_count-1)
     {
       /* set slot of last node in snodes to the slot we will place it */
-      snodes[snodes_count-1]->mcmc_slot = node->parent->mcmc_slot;
+      nodes[mcmc->snodes[mcmc->snodes_count-1]].slot = parent->slot;
 
       /* move this last node to its new slot */
-      snodes[node->parent->mcmc_slot] = snodes[snodes_count-1];
+      mcmc->snodes[parent->slot] = mcmc->snodes[mcmc->snodes_count-1];
     }
 
     /* reset slot of the removed node and decrease count */
-    node->parent->mcmc_slot = -1;
-    --snodes_count;
+    parent->slot = -1;
+    --mcmc->snodes_count;
   }
 
   /* add select node to the list of speciation nodes */
-  node->mcmc_slot = snodes_count;
-  snodes[snodes_count++] = node;
+  node->slot = mcmc->snodes_count;
+  mcmc->snodes[mcmc->snodes_count++] = i;
   node->event = EVENT_SPECIATION;
 
   /* add left child to coalescent roots unless it is a leaf OR the
      tree rooted at node->left has all branch lengths smaller than minbr */
-  if (node->left->edge_count)
+  if (nodes[node->left].edge_count)
   {
-    crnodes[crnodes_count] = node->left;
-    node->left->mcmc_slot = crnodes_count++;
+    mcmc->crnodes[mcmc->crnodes_count] = node->left;
+    nodes[node->left].slot = mcmc->crnodes_count++;
   }
 
   /* add right child to coalescent roots unless it is a leaf OR the
      tree rooted at node->right has all branch lengths smaller than minbr */
-  if (node->right->edge_count)
+  if (nodes[node->right].edge_count)
   {
-    crnodes[crnodes_count] = node->right;
-    node->right->mcmc_slot = crnodes_count++;
+    mcmc->crnodes[mcmc->crnodes_count] = node->right;
+    nodes[node->right].slot = mcmc->crnodes_count++;
   }
 }
 
-static void coalesce(long r)
+static void coalesce(mcmc_t * mcmc, long r)
 {
   /*            S                          CR
                 *                          *
@@ -548,63 +706,67 @@ static void coalesce(long r)
               /   \                      /   \
          CR  *     *  CR             C  *     *  C             */
 
-  rtree_t * node = snodes[r];
+  mcmc_node_t * nodes = mcmc->nodes;
+  int i = mcmc->snodes[r];
+  mcmc_node_t * node = nodes + i;
+  mcmc_node_t * left = nodes + node->left;
+  mcmc_node_t * right = nodes + node->right;
 
   /* move the last node of the list to the position of the node
      we just used */
-  if (r != (snodes_count-1))
+  if (r != (mcmc->snodes_count-1))
   {
-    snodes[r] = snodes[snodes_count-1];
-    snodes[r]->mcmc_slot = r;
+    mcmc->snodes[r] = mcmc->snodes[mcmc->snodes_count-1];
+    nodes[mcmc->snodes[r]].slot = r;
   }
-  --snodes_count;
+  --mcmc->snodes_count;
 
   /* add the current node to the list of coalescent roots */
-  node->mcmc_slot = crnodes_count;
-  crnodes[crnodes_count++] = node;
+  node->slot = mcmc->crnodes_count;
+  mcmc->crnodes[mcmc->crnodes_count++] = i;
   node->event = EVENT_COALESCENT;
 
   /* remove left child from coalescent roots unless it is a leaf OR the
      tree rooted at node->left has all branch lengths smaller than minbr */
-  if (node->left->edge_count)
+  if (left->edge_count)
   {
     /* perform the following only if it is not the last node
        in the list */
-    if (node->left->mcmc_slot != crnodes_count-1)
+    if (left->slot != mcmc->crnodes_count-1)
     {
       /* set slot of last node in crnodes to the slot we will place it */
-      crnodes[crnodes_count-1]->mcmc_slot = node->left->mcmc_slot;
+      nodes[mcmc->crnodes[mcmc->crnodes_count-1]].slot = left->slot;
 
       /* move this last node to its new slot */
-      crnodes[node->left->mcmc_slot] = crnodes[crnodes_count-1];
+      mcmc->crnodes[left->slot] = mcmc->crnodes[mcmc->crnodes_count-1];
     }
 
     /* reset slot of the removed node and decrease count */
-    node->left->mcmc_slot = -1;
-    crnodes_count--;
+    left->slot = -1;
+    mcmc->crnodes_count--;
   }
 
   /* now do the same for the right child */
-  if (node->right->edge_count)
+  if (right->edge_count)
   {
     /* perform the following only if the parent is not the last node
        in the list */
-    if (node->right->mcmc_slot != crnodes_count-1)
+    if (right->slot != mcmc->crnodes_count-1)
     {
       /* set slot of last node in crnodes to the slot we will place it */
-      crnodes[crnodes_count-1]->mcmc_slot = node->right->mcmc_slot;
+      nodes[mcmc->crnodes[mcmc->crnodes_count-1]].slot = right->slot;
 
       /* move this last node to its new slot */
-      crnodes[node->right->mcmc_slot] = crnodes[crnodes_count-1];
+      mcmc->crnodes[right->slot] = mcmc->crnodes[mcmc->crnodes_count-1];
     }
 
     /* reset slot of removed node and decrease count */
-    node->right->mcmc_slot = -1;
-    crnodes_count--;
+    right->slot = -1;
+    mcmc->crnodes_count--;
   }
 
   /* if the parent of the node has two coalescent roots as children
-     now, then add it to snodes, i.e. the following case:
+     now, then add it to mcmc->snodes, i.e. the following case:
 
               S                               S
               *                               *
@@ -615,17 +777,16 @@ static void coalesce(long r)
                /   \                           /   \
           CR  *     *  CR                  C  *     *  C
   */
-  if (node->parent &&
-      node->parent->left->event == EVENT_COALESCENT &&
-      node->parent->right->event == EVENT_COALESCENT)
+  if (node->parent != -1 &&
+      nodes[node->sibling].event == EVENT_COALESCENT)
   {
-    assert(node->parent->mcmc_slot == -1);
+    assert(nodes[node->parent].slot == -1);
 
     /* set slot of parent */
-    node->parent->mcmc_slot = snodes_count;
+    nodes[node->parent].slot = mcmc->snodes_count;
 
     /* place parent to the last slot in snodes and increase count */
-    snodes[snodes_count++] = node->parent;
+    mcmc->snodes[mcmc->snodes_count++] = node->parent;
   }
 }
 
@@ -634,85 +795,100 @@ static double aic_weight_nominator(double aic_score)
   return exp(-0.5 * aic_score);
 }
 
-void aic_mcmc(rtree_t * tree,
-              long method,
-              unsigned short * rstate,
-              long seed,
-              double * mcmc_min_logl,
-              double * mcmc_max_logl)
+/* Set up a run on tree and compute its starting delimitation, from the
+   shared DP table of mltree for the ML start. Progress messages of the run
+   are written to out. Sets up shared state, hence runs must be started one
+   at a time, but can then be sampled concurrently with aic_mcmc_run() */
+mcmc_t * aic_mcmc_start(rtree_t * tree,
+                        rtree_t * mltree,
+                        long method,
+                        unsigned short * rstate,
+                        long seed,
+                        double heat,
+                        FILE * out)
 {
-  long i;
+  long i,j;
   long best_index = 0;
-  long rand_long = 0;
-  double rand_double = 0;
   double max = 0;
-  double logl = 0;
-
-  double aic_weight_prefix_sum = 0.0;
 
-  *mcmc_max_logl = 0;
-  *mcmc_min_logl = 0;
-
-  if (!opt_quiet)
-    fprintf(stdout,"Computing initial delimitation...\n");
+  mcmc_t * mcmc = (mcmc_t *)xcalloc(1, sizeof(mcmc_t));
+  mcmc->tree = tree;
+  mcmc->method = method;
+  mcmc->seed = seed;
+  mcmc->rstate = rstate;
+  mcmc->heat = heat;
+  mcmc->cold = (heat >= 1);
+  mcmc->verbose = mcmc->cold && !opt_quiet;
+  mcmc->out = out;
+  mcmc->step = 1;
+  mcmc->steps = opt_mcmc_steps;
+
+  if (mcmc->verbose)
+    fprintf(out,"Computing initial delimitation...\n");
 
   /* check whether all edges are smaller or equal than minbr */
   if (!tree->edge_count)
   {
-    fprintf(stderr,"WARNING: All branch lengths are smaller or equal to the "
-                   "threshold specified by --minbr. Delimitation equals to "
-                   "the null model\n");
+    if (mcmc->cold)
+      fprintf(stderr,"WARNING: All branch lengths are smaller or equal to the "
+                     "threshold specified by --minbr. Delimitation equals to "
+                     "the null model\n");
     tree->support = 1;
     tree->aic_support = 1;
     tree->event = EVENT_COALESCENT;
 
-    return;
+    return mcmc;
   }
 
-  mcmc_init(tree, seed);
+  /* the DP table is filled once on mltree and shared by all runs */
+  share_coal_logl(mltree, tree);
+
+  mcmc_init(mcmc);
+  loglikelihood_table_init(2*tree->leaves - 2);
 
-  /* fill DP table */
-  dp_recurse(tree, method);
+  /* obtain best entry in the root DP table. Only filled entries are
+     considered, as the species bounds may rule out entry 0 */
+  dp_vector_t * vec = &mltree->vector;
+  dp_species_check(mltree->filled_count);
 
-  /* obtain best entry in the root DP table */
-  dp_vector_t * vec = tree->vector;
+  best_index = mltree->filled_list[0];
   if (method == PTP_METHOD_MULTI)
   {
-    max = vec[0].score_multi;
-    for (i = 1; i < tree->edge_count; i++)
+    max = vec->score_multi[best_index];
+    for (j = 1; j < mltree->filled_count; j++)
     {
-      if (max < vec[i].score_multi && vec[i].filled)
+      i = mltree->filled_list[j];
+      if (i >= tree->edge_count) break;
+
+      if (max < vec->score_multi[i])
       {
-        max = vec[i].score_multi;
+        max = vec->score_multi[i];
         best_index = i;
       }
     }
   }
   else
   {
-    max = vec[0].score_single;
-    for (i = 1; i < tree->edge_count; i++)
+    max = vec->score_single[best_index];
+    for (j = 1; j < mltree->filled_count; j++)
     {
-      //printf("vec[%d].score_single: %.6f\n", i, vec[i].score_single);
-      if (max < vec[i].score_single && vec[i].filled)
+      i = mltree->filled_list[j];
+      if (i >= tree->edge_count) break;
+
+      //printf("vec[%d].score_single: %.6f\n", i, vec->score_single[i]);
+      if (max < vec->score_single[i])
       {
-        max = vec[i].score_single;
+        max = vec->score_single[i];
         best_index = i;
       }
     }
   }
-  species_count = vec[best_index].species_count;
+  mcmc->species_count = dp_vec_species(mltree, best_index, method);
 
   double max_logl_aic = (method == PTP_METHOD_MULTI) ?
-              vec[best_index].score_multi : vec[best_index].score_single;
-  double max_aic = aic(max_logl_aic, species_count, tree->leaves+2);
-
+              vec->score_multi[best_index] : vec->score_single[best_index];
+  mcmc->max_aic = aic(max_logl_aic, mcmc->species_count, tree->leaves+2);
 
-  long coal_edge_count = 0;
-  long spec_edge_count = 0;
-  double spec_edgelen_sum = 0;
-  double coal_edgelen_sum = 0;
-  double coal_score = 0;
 
   if (opt_mcmc_startnull && opt_mcmc_startrandom)
   {
@@ -722,407 +898,764 @@ void aic_mcmc(rtree_t * tree,
   {
     tree->event = EVENT_COALESCENT;
 
-    crnodes[crnodes_count++] = tree;
-    logl = tree->coal_logl;
+    mcmc->logl = tree->coal_logl;
     best_index = 0;
-    species_count = 1;
+    mcmc->species_count = 1;
 
     /* set parameters */
-    coal_edge_count = tree->edge_count;
-    spec_edge_count = 0;
-    spec_edgelen_sum = 0;
-    coal_edgelen_sum = tree->edgelen_sum;
-    coal_score = tree->coal_logl;
+    mcmc->coal_edge_count = tree->edge_count;
+    mcmc->spec_edge_count = 0;
+    mcmc->spec_edgelen_sum = 0;
+    mcmc->coal_edgelen_sum = tree->edgelen_sum;
+    mcmc->coal_score = tree->coal_logl;
 
     /* set all nodes to coalescent */
     init_null(tree);
 
     /* log log-likelihood at step 0 */
     if (opt_mcmc_burnin == 1)
-      mcmc_log(logl,species_count);
+      mcmc_log(mcmc, mcmc->logl,mcmc->species_count);
 
 
   }
   else if (opt_mcmc_startrandom)
   {
-    bool warning_minbr = false;
-    logl = random_delimitation(tree,
-                               &species_count,
-                               &coal_edge_count,
-                               &coal_edgelen_sum,
-                               &spec_edge_count,
-                               &spec_edgelen_sum,
-                               &coal_score,
-                               rstate);
-    backtrack_random(tree, &warning_minbr);
-    if (warning_minbr)
-      fprintf(stderr,"WARNING: A speciation edge is smaller than the specified "
-                     "minimum branch length.\n");
+    mcmc->logl = random_delimitation(tree,
+                                     &mcmc->species_count,
+                                     &mcmc->coal_edge_count,
+                                     &mcmc->coal_edgelen_sum,
+                                     &mcmc->spec_edge_count,
+                                     &mcmc->spec_edgelen_sum,
+                                     &mcmc->coal_score,
+                                     rstate);
 
     /* log log-likelihood at step 0 */
     if (opt_mcmc_burnin == 1)
-      mcmc_log(logl,species_count);
+      mcmc_log(mcmc, mcmc->logl,mcmc->species_count);
   }
   else
   {
     /* ML starting delimitation */
-    bool warning_minbr = false;
-    backtrack(tree, best_index, &warning_minbr);
-    if (warning_minbr)
-      fprintf(stderr,"WARNING: A speciation edge is smaller than the specified "
-                     "minimum branch length.\n");
+    backtrack(mltree, tree, best_index, method);
 
-    logl = (method == PTP_METHOD_MULTI) ?
-                vec[best_index].score_multi : vec[best_index].score_single;
+    mcmc->logl = (method == PTP_METHOD_MULTI) ?
+                vec->score_multi[best_index] : vec->score_single[best_index];
 
     /* log log-likelihood at step 0 */
     if (opt_mcmc_burnin == 1)
-      mcmc_log(logl,species_count);
+      mcmc_log(mcmc, mcmc->logl,mcmc->species_count);
   }
 
+  /* take over the starting delimitation and list the nodes the proposals
+     are drawn from */
+  bool warning_minbr = false;
+  for (i = 0; i < mcmc->node_count; ++i)
+    mcmc->nodes[i].event = mcmc->tree_nodes[i]->event;
+  mcmc_relist(mcmc, &warning_minbr);
+  if (warning_minbr && mcmc->cold)
+    fprintf(stderr,"WARNING: A speciation edge is smaller than the specified "
+                   "minimum branch length.\n");
+
   if (!opt_mcmc_startnull && !opt_mcmc_startrandom)
   {
     if (method == PTP_METHOD_SINGLE)
     {
-      coal_edge_count = tree->edge_count - best_index;
-      spec_edge_count = best_index;
-      spec_edgelen_sum = tree->vector[best_index].spec_edgelen_sum;
-      coal_edgelen_sum = tree->edgelen_sum - spec_edgelen_sum;
+      mcmc->coal_edge_count = tree->edge_count - best_index;
+      mcmc->spec_edge_count = best_index;
+      mcmc->spec_edgelen_sum = vec->spec_edgelen_sum[best_index];
+      mcmc->coal_edgelen_sum = tree->edgelen_sum - mcmc->spec_edgelen_sum;
     }
     else
     {
-      spec_edge_count = best_index;
-      spec_edgelen_sum = tree->vector[best_index].spec_edgelen_sum;
-      coal_score = tree->vector[best_index].score_multi -
-                        loglikelihood(spec_edge_count, spec_edgelen_sum);
+      mcmc->spec_edge_count = best_index;
+      mcmc->spec_edgelen_sum = vec->spec_edgelen_sum[best_index];
+      mcmc->coal_score = vec->score_multi[best_index] -
+                         loglikelihood(mcmc->spec_edge_count,
+                                       mcmc->spec_edgelen_sum);
     }
   }
 
-  *mcmc_max_logl = logl;
-  *mcmc_min_logl = logl;
+  mcmc->max_logl_seen = mcmc->logl;
+  mcmc->min_logl_seen = mcmc->logl;
 
-  if (!opt_quiet)
+  if (mcmc->verbose)
   {
     if (opt_mcmc_startnull)
-      fprintf(stdout, "Null model log-likelihood: %f\n", logl);
+      fprintf(out, "Null model log-likelihood: %f\n", mcmc->logl);
     else if (opt_mcmc_startrandom)
-      fprintf(stdout, "Random delimitation log-likelihood: %f\n", logl);
+      fprintf(out, "Random delimitation log-likelihood: %f\n", mcmc->logl);
     else
-      fprintf(stdout, "ML delimitation log-likelihood: %f\n", logl);
+      fprintf(out, "ML delimitation log-likelihood: %f\n", mcmc->logl);
   }
 
   if (opt_mcmc_burnin == 1)
   {
-    //densities[species_count].logl += logl;
-    densities[species_count].logl += -aic(logl, species_count, tree->leaves+2);
+    //mcmc->densities[mcmc->species_count].logl += mcmc->logl;
+    mcmc->densities[mcmc->species_count].logl += -aic(mcmc->logl, mcmc->species_count, tree->leaves+2);
   }
 
   if (opt_mcmc_sample == 1)
   {
-    if (!opt_quiet)
-      printf("1 Log-L: %f\n", logl);
+    if (mcmc->verbose)
+      fprintf(out, "1 Log-L: %f\n", mcmc->logl);
   }
 
-  mcmc_stats_init(tree);
+  mcmc_stats_init(mcmc);
+
+  return mcmc;
+}
+
+/* Perform the proposal of the current step of the chain, i.e. speciate a
+   coalescent root or merge the two coalescent roots below a speciation node,
+   and accept it with the Metropolis-Hastings ratio of the AIC weights */
+static void mcmc_step(mcmc_t * mcmc)
+{
+  long i = mcmc->step;
+  long rand_long = 0;
+  double rand_double = 0;
+  rtree_t * tree = mcmc->tree;
+  long method = mcmc->method;
+  unsigned short * rstate = mcmc->rstate;
 
-  for (i = 1; i < opt_mcmc_steps; ++i)
+
+  /* throw a coin to decide whether to convert a coalescent root to a
+     speciation or the other way round */
+  rand_double = mptp_erand48(rstate);
+  int speciation = (rand_double >= 0.5) ? 1 : 0;
+
+  if ((speciation && mcmc->crnodes_count) || (mcmc->snodes_count == 0))
   {
 
-    /* throw a coin to decide whether to convert a coalescent root to a
-       speciation or the other way round */
-    rand_double = mptp_erand48(rstate);
-    int speciation = (rand_double >= 0.5) ? 1 : 0;
+    /*            CR                         S
+                  *                          *
+                 / \            ->          / \
+                /   \                      /   \
+            C  *     *  C             CR  *     *  CR            */
+
+
+    /* select a coalescent root, split it into two coalescent nodes */
+    rand_long = mptp_nrand48(rstate);
+    long r = rand_long % mcmc->crnodes_count;
+    int n = mcmc->crnodes[r];
+    mcmc_node_t * node = mcmc->nodes + n;
 
-    if ((speciation && crnodes_count) || (snodes_count == 0))
+    /* store the count of crnodes for the Hasting ratio */
+    double old_crnodes_count = mcmc->crnodes_count;
+
+    /* speciate */
+    speciate(mcmc, r);
+
+    /* store the new count of snodes for the Hasting ratio */
+    double new_snodes_count = mcmc->snodes_count;
+
+    /* TODO: distinguish between single- and multi-rate methods */
+
+    /* subtract the two edges (left and right) from the coalescent
+       distribution and add them to the speciation distribution */
+    unsigned int edge_count_diff = (unsigned int)node->spec_edge_delta;
+    double edgelen_sum_diff = node->spec_edgelen_delta;
+
+    if (method == PTP_METHOD_SINGLE)
     {
+      mcmc->coal_edgelen_sum -= edgelen_sum_diff;
+      mcmc->coal_edge_count -= edge_count_diff;
+    }
+    mcmc->spec_edgelen_sum += edgelen_sum_diff;
+    mcmc->spec_edge_count += edge_count_diff;
 
-      /*            CR                         S
-                    *                          *
-                   / \            ->          / \
-                  /   \                      /   \
-              C  *     *  C             CR  *     *  CR            */
+    /* compute new log-likelihood */
+    double new_logl;
+    if (mcmc->spec_edge_count == 0 || (method == PTP_METHOD_SINGLE && mcmc->coal_edge_count == 0))
+      new_logl = tree->coal_logl;
+    else
+    {
+      assert((method == PTP_METHOD_MULTI) || (mcmc->coal_edge_count > 0));
+      assert(mcmc->spec_edge_count > 0);
+      if (method == PTP_METHOD_SINGLE)
+        new_logl = loglikelihood(mcmc->coal_edge_count, mcmc->coal_edgelen_sum) +
+                   loglikelihood(mcmc->spec_edge_count, mcmc->spec_edgelen_sum);
+      else
+        new_logl = mcmc->coal_score - node->coal_logl +
+                   node->left_coal_logl + node->right_coal_logl +
+                   loglikelihood(mcmc->spec_edge_count, mcmc->spec_edgelen_sum);
 
+    }
 
-      /* select a coalescent root, split it into two coalescent nodes */
-      rand_long = mptp_nrand48(rstate);
-      long r = rand_long % crnodes_count;
-      rtree_t * node = crnodes[r];
+    if (new_logl > mcmc->max_logl_seen)
+      mcmc->max_logl_seen = new_logl;
+    if (i+1 < opt_mcmc_burnin)
+      mcmc->min_logl_seen = mcmc->max_logl_seen;
+    else if (new_logl < mcmc->min_logl_seen)
+      mcmc->min_logl_seen = new_logl;
 
-      /* store the count of crnodes for the Hasting ratio */
-      double old_crnodes_count = crnodes_count;
 
-      /* speciate */
-      speciate(r);
+    double aic_new_logl = -aic(new_logl, mcmc->species_count+1, tree->leaves+2);
+    double aic_logl = -aic(mcmc->logl, mcmc->species_count, tree->leaves+2);
 
-      /* store the new count of snodes for the Hasting ratio */
-      double new_snodes_count = snodes_count;
+    /* Hastings ratio */
+    double a = exp(mcmc->heat * (aic_new_logl - aic_logl)) *
+               (old_crnodes_count / new_snodes_count);
 
-      /* TODO: distinguish between single- and multi-rate methods */
+    /* update densities */
+    if (i+1 >= opt_mcmc_burnin)
+    {
+      //mcmc->densities[mcmc->species_count+1].logl += new_logl;
+      mcmc->densities[mcmc->species_count+1].logl += aic_new_logl;
+    }
 
-      /* subtract the two edges (left and right) from the coalescent
-         distribution and add them to the speciation distribution */
-      unsigned int edge_count_diff = 0;
-      double edgelen_sum_diff = 0;
-      if (node->left->length > opt_minbr)
+    /* decide whether to accept or reject proposal */
+    rand_double = mptp_erand48(rstate);
+    if (rand_double <= a)
+    {
+      /* accept */
+      if ((i+1) % opt_mcmc_sample == 0)
       {
-        ++edge_count_diff;
-        edgelen_sum_diff += node->left->length;
+        if (mcmc->verbose)
+          fprintf(mcmc->out, "%ld Log-L: %f\n", i+1, new_logl);
+        if (i+1 >= opt_mcmc_burnin)
+          mcmc_log(mcmc, new_logl,mcmc->species_count+1);
       }
 
-      if (node->right->length > opt_minbr)
+      /* update support values information */
+      if (i+1 >= opt_mcmc_burnin) {
+        mcmc->speciation_start[n] = i;
+        mcmc->aic_weight_prefix_sum += aic_weight_nominator(-aic_new_logl/mcmc->max_aic);
+        mcmc->aic_weight_start[n] = mcmc->aic_weight_prefix_sum;
+      }
+      else
       {
-        ++edge_count_diff;
-        edgelen_sum_diff += node->right->length;
+        mcmc->speciation_start[n] = opt_mcmc_burnin;
       }
 
-      if (method == PTP_METHOD_SINGLE)
+      mcmc->accept_count++;
+      mcmc->species_count++;
+      mcmc->logl = new_logl;
+      if (method == PTP_METHOD_MULTI)
+        mcmc->coal_score = mcmc->coal_score - node->coal_logl +
+                           node->left_coal_logl + node->right_coal_logl;
+      return;
+    }
+    else
+    {
+      /* reject */
+      if ((i+1) % opt_mcmc_sample == 0)
       {
-        coal_edgelen_sum -= edgelen_sum_diff;
-        coal_edge_count -= edge_count_diff;
+        if (mcmc->verbose)
+          fprintf(mcmc->out, "%ld Log-L: %f\n", i+1, new_logl);
+        if (i+1 >= opt_mcmc_burnin)
+          mcmc_log(mcmc, new_logl,mcmc->species_count+1);
       }
-      spec_edgelen_sum += edgelen_sum_diff;
-      spec_edge_count += edge_count_diff;
 
-      /* compute new log-likelihood */
-      double new_logl;
-      if (spec_edge_count == 0 || (method == PTP_METHOD_SINGLE && coal_edge_count == 0))
-        new_logl = tree->coal_logl;
-      else
-      {
-        assert((method == PTP_METHOD_MULTI) || (coal_edge_count > 0));
-        assert(spec_edge_count > 0);
-        if (method == PTP_METHOD_SINGLE)
-          new_logl = loglikelihood(coal_edge_count, coal_edgelen_sum) +
-                     loglikelihood(spec_edge_count, spec_edgelen_sum);
-        else
-          new_logl = coal_score - node->coal_logl +
-                     node->left->coal_logl + node->right->coal_logl +
-                     loglikelihood(spec_edge_count, spec_edgelen_sum);
+      if (i+1 >= opt_mcmc_burnin)
+        mcmc->speciation_count[n]++;
 
+      if (method == PTP_METHOD_SINGLE)
+      {
+        mcmc->coal_edgelen_sum += edgelen_sum_diff;
+        mcmc->coal_edge_count += edge_count_diff;
       }
+      mcmc->spec_edgelen_sum -= edgelen_sum_diff;
+      mcmc->spec_edge_count -= edge_count_diff;
+      coalesce(mcmc, node->slot);
+    }
+  }
+  else
+  {
 
-      if (new_logl > *mcmc_max_logl)
-        *mcmc_max_logl = new_logl;
-      if (i+1 < opt_mcmc_burnin)
-        *mcmc_min_logl = *mcmc_max_logl;
-      else if (new_logl < *mcmc_min_logl)
-        *mcmc_min_logl = new_logl;
+    /*            S                          CR
+                  *                          *
+                 / \            ->          / \
+                /   \                      /   \
+           CR  *     *  CR             C  *     *  C         */
 
+    rand_long = mptp_nrand48(rstate);
+    long r = rand_long % mcmc->snodes_count;
+    int n = mcmc->snodes[r];
+    mcmc_node_t * node = mcmc->nodes + n;
 
-      double aic_new_logl = -aic(new_logl, species_count+1, tree->leaves+2);
-      double aic_logl = -aic(logl, species_count, tree->leaves+2);
+    /* store the count of snodes for the Hastings ratio */
+    double old_snodes_count = mcmc->snodes_count;
 
-      /* Hastings ratio */
-      double a = exp(aic_new_logl - aic_logl) * (old_crnodes_count / new_snodes_count);
+    /* coalesce */
+    coalesce(mcmc, r);
 
-      /* update densities */
-      if (i+1 >= opt_mcmc_burnin)
-      {
-        //densities[species_count+1].logl += new_logl;
-        densities[species_count+1].logl += aic_new_logl;
-      }
+    double new_crnodes_count = mcmc->crnodes_count;
 
-      /* decide whether to accept or reject proposal */
-      rand_double = mptp_erand48(rstate);
-      if (rand_double <= a)
-      {
-        /* accept */
-        if ((i+1) % opt_mcmc_sample == 0)
-        {
-          if (!opt_quiet)
-            printf("%ld Log-L: %f\n", i+1, new_logl);
-          if (i+1 >= opt_mcmc_burnin)
-            mcmc_log(new_logl,species_count+1);
-        }
-
-        /* update support values information */
-        if (i+1 >= opt_mcmc_burnin) {
-          node->speciation_start = i;
-          aic_weight_prefix_sum += aic_weight_nominator(-aic_new_logl/max_aic);
-          node->aic_weight_start = aic_weight_prefix_sum;
-        }
-        else
-        {
-          node->speciation_start = opt_mcmc_burnin;
-        }
-
-        accept_count++;
-        species_count++;
-        logl = new_logl;
-        if (method == PTP_METHOD_MULTI)
-          coal_score = coal_score - node->coal_logl +
-                       node->left->coal_logl + node->right->coal_logl;
-        continue;
-      }
-      else
-      {
-        /* reject */
-        if ((i+1) % opt_mcmc_sample == 0)
-        {
-          if (!opt_quiet)
-            printf("%ld Log-L: %f\n", i+1, new_logl);
-          if (i+1 >= opt_mcmc_burnin)
-            mcmc_log(new_logl,species_count+1);
-        }
+    /* TODO: distinguish between single- and multi-rate methods */
 
-        if (i+1 >= opt_mcmc_burnin)
-          node->speciation_count++;
-
-        if (method == PTP_METHOD_SINGLE)
-        {
-          coal_edgelen_sum += edgelen_sum_diff;
-          coal_edge_count += edge_count_diff;
-        }
-        spec_edgelen_sum -= edgelen_sum_diff;
-        spec_edge_count -= edge_count_diff;
-        coalesce(node->mcmc_slot);
-      }
+    /* subtract the two edges (left and right) from the speciation
+       distribution and add them to the coalescent distribution */
+    int edge_count_diff = node->spec_edge_delta;
+    double edgelen_sum_diff = node->spec_edgelen_delta;
+    if (method == PTP_METHOD_SINGLE)
+    {
+      mcmc->coal_edgelen_sum += edgelen_sum_diff;
+      mcmc->coal_edge_count += edge_count_diff;
     }
+    mcmc->spec_edgelen_sum -= edgelen_sum_diff;
+    mcmc->spec_edge_count -= edge_count_diff;
+
+    /* compute new log-likelihood */
+    double new_logl;
+    if (mcmc->spec_edge_count == 0 || (method == PTP_METHOD_SINGLE && mcmc->coal_edge_count == 0))
+      new_logl = tree->coal_logl;
     else
     {
+      assert((method == PTP_METHOD_MULTI) || (mcmc->coal_edge_count > 0));
+      assert(mcmc->spec_edge_count > 0);
+      if (method == PTP_METHOD_SINGLE)
+        new_logl = loglikelihood(mcmc->coal_edge_count, mcmc->coal_edgelen_sum) +
+                   loglikelihood(mcmc->spec_edge_count, mcmc->spec_edgelen_sum);
+      else
+        new_logl = mcmc->coal_score - node->left_coal_logl - node->right_coal_logl +
+                   node->coal_logl +
+                   loglikelihood(mcmc->spec_edge_count, mcmc->spec_edgelen_sum);
 
-      /*            S                          CR
-                    *                          *
-                   / \            ->          / \
-                  /   \                      /   \
-             CR  *     *  CR             C  *     *  C         */
+    }
 
-      rand_long = mptp_nrand48(rstate);
-      long r = rand_long % snodes_count;
-      rtree_t * node = snodes[r];
+    if (new_logl > mcmc->max_logl_seen)
+      mcmc->max_logl_seen = new_logl;
+    if (i+1 < opt_mcmc_burnin)
+      mcmc->min_logl_seen = mcmc->max_logl_seen;
+    else if (new_logl < mcmc->min_logl_seen)
+      mcmc->min_logl_seen = new_logl;
 
-      /* store the count of snodes for the Hastings ratio */
-      double old_snodes_count = snodes_count;
+    double aic_new_logl = -aic(new_logl, mcmc->species_count-1, tree->leaves+2);
+    double aic_logl = -aic(mcmc->logl, mcmc->species_count, tree->leaves+2);
 
-      /* coalesce */
-      coalesce(r);
+    /* Hastings ratio */
+    double a = exp(mcmc->heat * (aic_new_logl - aic_logl)) *
+               (old_snodes_count / new_crnodes_count);
 
-      double new_crnodes_count = crnodes_count;
+    /* update densities */
+    if (i+1 >= opt_mcmc_burnin)
+    {
+      //mcmc->densities[mcmc->species_count-1].logl += new_logl;
+      mcmc->densities[mcmc->species_count-1].logl += aic_new_logl;
+    }
 
-      /* TODO: distinguish between single- and multi-rate methods */
+    /* decide whether to accept or reject proposal */
+    rand_double = mptp_erand48(rstate);
+    if (rand_double <= a)
+    {
+      /* accept */
+      if ((i+1) % opt_mcmc_sample == 0)
+      {
+        if (mcmc->verbose)
+          fprintf(mcmc->out, "%ld Log-L: %f\n", i+1, new_logl);
+        if (i+1 >= opt_mcmc_burnin)
+          mcmc_log(mcmc, new_logl,mcmc->species_count-1);
+      }
 
-      /* subtract the two edges (left and right) from the speciation
-         distribution and add them to the coalescent distribution */
-      int edge_count_diff = 0;
-      double edgelen_sum_diff = 0;
-      if (node->left->length > opt_minbr)
+      /* update support values information */
+      if (i+1 >= opt_mcmc_burnin)
       {
-        ++edge_count_diff;
-        edgelen_sum_diff += node->left->length;
+        mcmc->speciation_count[n] = mcmc->speciation_count[n] +
+                                    i - mcmc->speciation_start[n];
+        mcmc->aic_weight_prefix_sum += aic_weight_nominator(-aic_new_logl/mcmc->max_aic);
+        mcmc->aic_support[n] += mcmc->aic_weight_prefix_sum -
+                                mcmc->aic_weight_start[n];
       }
+      mcmc->speciation_start[n] = -1;
+
+      mcmc->accept_count++;
+      mcmc->species_count--;
+      mcmc->logl = new_logl;
+      if (method == PTP_METHOD_MULTI)
+        mcmc->coal_score = mcmc->coal_score -
+                           node->left_coal_logl - node->right_coal_logl +
+                           node->coal_logl;
 
-      if (node->right->length > opt_minbr)
+      return;
+    }
+    else
+    {
+      /* reject */
+      if ((i+1) % opt_mcmc_sample == 0)
       {
-        ++edge_count_diff;
-        edgelen_sum_diff += node->right->length;
+        if (mcmc->verbose)
+          fprintf(mcmc->out, "%ld Log-L: %f\n", i+1, new_logl);
+        if (i+1 >= opt_mcmc_burnin)
+          mcmc_log(mcmc, new_logl,mcmc->species_count-1);
       }
       if (method == PTP_METHOD_SINGLE)
       {
-        coal_edgelen_sum += edgelen_sum_diff;
-        coal_edge_count += edge_count_diff;
+        mcmc->coal_edgelen_sum -= edgelen_sum_diff;
+        mcmc->coal_edge_count -= edge_count_diff;
       }
-      spec_edgelen_sum -= edgelen_sum_diff;
-      spec_edge_count -= edge_count_diff;
-
-      /* compute new log-likelihood */
-      double new_logl;
-      if (spec_edge_count == 0 || (method == PTP_METHOD_SINGLE && coal_edge_count == 0))
-        new_logl = tree->coal_logl;
-      else
+      mcmc->spec_edgelen_sum += edgelen_sum_diff;
+      mcmc->spec_edge_count += edge_count_diff;
+      speciate(mcmc, node->slot);
+      if (i+1 >= opt_mcmc_burnin)
       {
-        assert((method == PTP_METHOD_MULTI) || (coal_edge_count > 0));
-        assert(spec_edge_count > 0);
-        if (method == PTP_METHOD_SINGLE)
-          new_logl = loglikelihood(coal_edge_count, coal_edgelen_sum) +
-                     loglikelihood(spec_edge_count, spec_edgelen_sum);
-        else
-          new_logl = coal_score - node->left->coal_logl - node->right->coal_logl +
-                     node->coal_logl +
-                     loglikelihood(spec_edge_count, spec_edgelen_sum);
-
+        mcmc->speciation_count[n]--;
       }
+    }
+  }
+}
 
-      if (new_logl > *mcmc_max_logl)
-        *mcmc_max_logl = new_logl;
-      if (i+1 < opt_mcmc_burnin)
-        *mcmc_min_logl = *mcmc_max_logl;
-      else if (new_logl < *mcmc_min_logl)
-        *mcmc_min_logl = new_logl;
+/* Advance the chain of a started run by up to 'steps' steps, without going
+   past the total number of steps */
+void aic_mcmc_run_steps(mcmc_t * mcmc, long steps)
+{
+  if (!mcmc->tree->edge_count) return;
 
-      double aic_new_logl = -aic(new_logl, species_count-1, tree->leaves+2);
-      double aic_logl = -aic(logl, species_count, tree->leaves+2);
+  long end = MIN(mcmc->step + steps, mcmc->steps);
 
-      /* Hastings ratio */
-      double a = exp(aic_new_logl - aic_logl) * (old_snodes_count / new_crnodes_count);
+  for (; mcmc->step < end; ++mcmc->step)
+  {
+    mcmc_step(mcmc);
 
-      /* update densities */
-      if (i+1 >= opt_mcmc_burnin)
+    if (mcmc->trace && (mcmc->step+1) % opt_mcmc_sample == 0 &&
+        mcmc->step+1 >= opt_mcmc_burnin)
+    {
+      if (mcmc->trace_count == mcmc->trace_alloc)
       {
-        //densities[species_count-1].logl += new_logl;
-        densities[species_count-1].logl += aic_new_logl;
+        mcmc->trace_alloc <<= 1;
+        mcmc->trace = (double *)xrealloc(mcmc->trace,
+                                         (size_t)mcmc->trace_alloc *
+                                         sizeof(double));
       }
+      mcmc->trace[mcmc->trace_count++] = mcmc->logl;
+    }
+  }
+}
+
+/* Sample the chain of a started run */
+void aic_mcmc_run(mcmc_t * mcmc)
+{
+  aic_mcmc_run_steps(mcmc, opt_mcmc_steps);
+}
+
+/* Account the delimitation the cold chain received from a swap for its
+   support values, as an accepted move whose proposal changed the events
+   of several nodes at once. 'old_events' are the previous events of the
+   inner nodes */
+static void mcmc_swap_support(mcmc_t * mcmc, const int * old_events)
+{
+  long j;
+  long i = mcmc->step - 1;
+  rtree_t * tree = mcmc->tree;
+
+  double aic_new_logl = -aic(mcmc->logl, mcmc->species_count, tree->leaves+2);
+
+  if (mcmc->logl > mcmc->max_logl_seen)
+    mcmc->max_logl_seen = mcmc->logl;
+  if (i+1 >= opt_mcmc_burnin && mcmc->logl < mcmc->min_logl_seen)
+    mcmc->min_logl_seen = mcmc->logl;
 
-      /* decide whether to accept or reject proposal */
-      rand_double = mptp_erand48(rstate);
-      if (rand_double <= a)
+  if (i+1 >= opt_mcmc_burnin)
+    mcmc->aic_weight_prefix_sum += aic_weight_nominator(-aic_new_logl /
+                                                        mcmc->max_aic);
+
+  for (j = 0; j < mcmc->inner_count; ++j)
+  {
+    int n = mcmc->inner[j];
+
+    if (mcmc->nodes[n].event == old_events[j]) continue;
+
+    if (mcmc->nodes[n].event == EVENT_SPECIATION)
+    {
+      if (i+1 >= opt_mcmc_burnin)
       {
-        /* accept */
-        if ((i+1) % opt_mcmc_sample == 0)
-        {
-          if (!opt_quiet)
-            printf("%ld Log-L: %f\n", i+1, new_logl);
-          if (i+1 >= opt_mcmc_burnin)
-            mcmc_log(new_logl,species_count-1);
-        }
-
-        /* update support values information */
-        if (i+1 >= opt_mcmc_burnin)
-        {
-          node->speciation_count = node->speciation_count +
-                                   i - node->speciation_start;
-          aic_weight_prefix_sum += aic_weight_nominator(-aic_new_logl/max_aic);
-          node->aic_support += aic_weight_prefix_sum - node->aic_weight_start;
-        }
-        node->speciation_start = -1;
-
-        accept_count++;
-        species_count--;
-        logl = new_logl;
-        if (method == PTP_METHOD_MULTI)
-          coal_score = coal_score - node->left->coal_logl - node->right->coal_logl +
-                       node->coal_logl;
-
-        continue;
+        mcmc->speciation_start[n] = i;
+        mcmc->aic_weight_start[n] = mcmc->aic_weight_prefix_sum;
       }
       else
+        mcmc->speciation_start[n] = opt_mcmc_burnin;
+    }
+    else
+    {
+      if (i+1 >= opt_mcmc_burnin)
       {
-        /* reject */
-        if ((i+1) % opt_mcmc_sample == 0)
-        {
-          if (!opt_quiet)
-            printf("%ld Log-L: %f\n", i+1, new_logl);
-          if (i+1 >= opt_mcmc_burnin)
-            mcmc_log(new_logl,species_count-1);
-        }
-        if (method == PTP_METHOD_SINGLE)
-        {
-          coal_edgelen_sum -= edgelen_sum_diff;
-          coal_edge_count -= edge_count_diff;
-        }
-        spec_edgelen_sum += edgelen_sum_diff;
-        spec_edge_count += edge_count_diff;
-        speciate(node->mcmc_slot);
-        if (i+1 >= opt_mcmc_burnin)
-        {
-          node->speciation_count--;
-        }
+        mcmc->speciation_count[n] = mcmc->speciation_count[n] +
+                                    i - mcmc->speciation_start[n];
+        mcmc->aic_support[n] += mcmc->aic_weight_prefix_sum -
+                                mcmc->aic_weight_start[n];
       }
+      mcmc->speciation_start[n] = -1;
     }
   }
+}
+
+/* Propose to exchange the delimitations of two chains of the same run, i.e.
+   of the same tree, where a is the colder one. The exchange is accepted
+   with the Metropolis ratio of the heated AIC weights of both chains.
+   Returns whether the delimitations were exchanged */
+int aic_mcmc_swap(mcmc_t * a, mcmc_t * b, unsigned short * rstate)
+{
+  long j;
+  long n = a->tree->leaves + 2;
+
+  if (!a->tree->edge_count) return 0;
+
+  double aic_a = -aic(a->logl, a->species_count, n);
+  double aic_b = -aic(b->logl, b->species_count, n);
+
+  double r = exp((a->heat - b->heat) * (aic_b - aic_a));
+  if (mptp_erand48(rstate) > r)
+    return 0;
+
+  int * old_events = (int *)xmalloc((size_t)a->inner_count * sizeof(int));
+
+  for (j = 0; j < a->inner_count; ++j)
+  {
+    int node = a->inner[j];
+    int event = a->nodes[node].event;
+
+    old_events[j] = event;
+    a->nodes[node].event = b->nodes[node].event;
+    b->nodes[node].event = event;
+  }
+
+  mcmc_t tmp = *a;
+
+  a->logl = b->logl;
+  a->species_count = b->species_count;
+  a->coal_edge_count = b->coal_edge_count;
+  a->spec_edge_count = b->spec_edge_count;
+  a->spec_edgelen_sum = b->spec_edgelen_sum;
+  a->coal_edgelen_sum = b->coal_edgelen_sum;
+  a->coal_score = b->coal_score;
+
+  b->logl = tmp.logl;
+  b->species_count = tmp.species_count;
+  b->coal_edge_count = tmp.coal_edge_count;
+  b->spec_edge_count = tmp.spec_edge_count;
+  b->spec_edgelen_sum = tmp.spec_edgelen_sum;
+  b->coal_edgelen_sum = tmp.coal_edgelen_sum;
+  b->coal_score = tmp.coal_score;
+
+  bool warning_minbr = false;
+  mcmc_relist(a, &warning_minbr);
+  mcmc_relist(b, &warning_minbr);
+
+  if (a->cold)
+    mcmc_swap_support(a, old_events);
+
+  free(old_events);
+  return 1;
+}
+
+/* Write the current support of the inner nodes with at least one edge
+   longer than minbr into 'support', in the order of the inner node list.
+   Returns the number of values, or 0 while no step after the burnin has
+   been accepted */
+long aic_mcmc_support(mcmc_t * mcmc, double * support)
+{
+  long j;
+  long count = 0;
+
+  if (!mcmc->tree->edge_count || mcmc->aic_weight_prefix_sum == 0)
+    return 0;
+
+  for (j = 0; j < mcmc->inner_count; ++j)
+  {
+    int n = mcmc->inner[j];
+    double weight = mcmc->aic_support[n];
+
+    if (!mcmc->nodes[n].edge_count) continue;
+
+    if (mcmc->speciation_start[n] != -1)
+      weight += mcmc->aic_weight_prefix_sum - mcmc->aic_weight_start[n];
+
+    support[count++] = weight / mcmc->aic_weight_prefix_sum;
+  }
+
+  return count;
+}
+
+/* Return the log-likelihoods sampled by the chain so far */
+double * aic_mcmc_trace(mcmc_t * mcmc, long * count)
+{
+  *count = mcmc->trace_count;
+  return mcmc->trace;
+}
+
+/* End the chain at its current step instead of the step given by --mcmc */
+void aic_mcmc_stop(mcmc_t * mcmc)
+{
+  mcmc->steps = mcmc->step;
+}
+
+/* Write the state of the chain in binary form, for resuming it with
+   aic_mcmc_load on the same tree. Nodes are referred to by their index in
+   the preorder traversal of the tree */
+void aic_mcmc_save(mcmc_t * mcmc, FILE * fp)
+{
+  long i;
+  rtree_t * tree = mcmc->tree;
+  size_t count = (size_t)mcmc->node_count;
+
+  if (!tree->edge_count) return;
+
+  for (i = 0; i < mcmc->node_count; ++i)
+  {
+    xfwrite(&mcmc->nodes[i].event, sizeof(int), 1, fp);
+    xfwrite(&mcmc->nodes[i].slot, sizeof(int), 1, fp);
+  }
+  xfwrite(mcmc->speciation_start, sizeof(long), count, fp);
+  xfwrite(mcmc->speciation_count, sizeof(long), count, fp);
+  xfwrite(mcmc->aic_weight_start, sizeof(double), count, fp);
+  xfwrite(mcmc->aic_support, sizeof(double), count, fp);
+
+  xfwrite(&mcmc->crnodes_count, sizeof(long), 1, fp);
+  xfwrite(mcmc->crnodes, sizeof(int), (size_t)mcmc->crnodes_count, fp);
+  xfwrite(&mcmc->snodes_count, sizeof(long), 1, fp);
+  xfwrite(mcmc->snodes, sizeof(int), (size_t)mcmc->snodes_count, fp);
+
+  for (i = 0; i <= tree->leaves; ++i)
+    xfwrite(&mcmc->densities[i].logl, sizeof(double), 1, fp);
+
+  xfwrite(mcmc->rstate, sizeof(unsigned short), 3, fp);
+  xfwrite(&mcmc->step, sizeof(long), 1, fp);
+  xfwrite(&mcmc->accept_count, sizeof(long), 1, fp);
+  xfwrite(&mcmc->species_count, sizeof(long), 1, fp);
+  xfwrite(&mcmc->logl, sizeof(double), 1, fp);
+  xfwrite(&mcmc->max_aic, sizeof(double), 1, fp);
+  xfwrite(&mcmc->aic_weight_prefix_sum, sizeof(double), 1, fp);
+  xfwrite(&mcmc->coal_edge_count, sizeof(long), 1, fp);
+  xfwrite(&mcmc->spec_edge_count, sizeof(long), 1, fp);
+  xfwrite(&mcmc->spec_edgelen_sum, sizeof(double), 1, fp);
+  xfwrite(&mcmc->coal_edgelen_sum, sizeof(double), 1, fp);
+  xfwrite(&mcmc->coal_score, sizeof(double), 1, fp);
+  xfwrite(&mcmc->min_logl_seen, sizeof(double), 1, fp);
+  xfwrite(&mcmc->max_logl_seen, sizeof(double), 1, fp);
+
+  xfwrite(&mcmc->trace_count, sizeof(long), 1, fp);
+  if (mcmc->trace_count)
+    xfwrite(mcmc->trace, sizeof(double), (size_t)mcmc->trace_count, fp);
+
+  /* the log is flushed to disk such that it is at least as long as recorded
+     in the checkpoint */
+  long log_size = 0;
+  if (mcmc->fp_log)
+  {
+    if (fflush(mcmc->fp_log) || fsync(fileno(mcmc->fp_log)))
+      fatal("Unable to write to file %s.%ld.log", opt_outfile, mcmc->seed);
+    log_size = ftell(mcmc->fp_log);
+  }
+  xfwrite(&log_size, sizeof(long), 1, fp);
+}
+
+/* Read the state of the chain written by aic_mcmc_save, replacing the state
+   of the freshly started chain */
+void aic_mcmc_load(mcmc_t * mcmc, FILE * fp)
+{
+  long i;
+  rtree_t * tree = mcmc->tree;
+  size_t count = (size_t)mcmc->node_count;
+
+  if (!tree->edge_count) return;
+
+  for (i = 0; i < mcmc->node_count; ++i)
+  {
+    xfread(&mcmc->nodes[i].event, sizeof(int), 1, fp);
+    xfread(&mcmc->nodes[i].slot, sizeof(int), 1, fp);
+  }
+  xfread(mcmc->speciation_start, sizeof(long), count, fp);
+  xfread(mcmc->speciation_count, sizeof(long), count, fp);
+  xfread(mcmc->aic_weight_start, sizeof(double), count, fp);
+  xfread(mcmc->aic_support, sizeof(double), count, fp);
+
+  xfread(&mcmc->crnodes_count, sizeof(long), 1, fp);
+  if (mcmc->crnodes_count < 0 || mcmc->crnodes_count > tree->leaves)
+    fatal("Corrupted checkpoint");
+  xfread(mcmc->crnodes, sizeof(int), (size_t)mcmc->crnodes_count, fp);
+
+  xfread(&mcmc->snodes_count, sizeof(long), 1, fp);
+  if (mcmc->snodes_count < 0 || mcmc->snodes_count > tree->leaves)
+    fatal("Corrupted checkpoint");
+  xfread(mcmc->snodes, sizeof(int), (size_t)mcmc->snodes_count, fp);
+
+  for (i = 0; i < mcmc->crnodes_count; ++i)
+    if (mcmc->crnodes[i] < 0 || mcmc->crnodes[i] >= mcmc->node_count)
+      fatal("Corrupted checkpoint");
+  for (i = 0; i < mcmc->snodes_count; ++i)
+    if (mcmc->snodes[i] < 0 || mcmc->snodes[i] >= mcmc->node_count)
+      fatal("Corrupted checkpoint");
+
+  for (i = 0; i <= tree->leaves; ++i)
+    xfread(&mcmc->densities[i].logl, sizeof(double), 1, fp);
+
+  xfread(mcmc->rstate, sizeof(unsigned short), 3, fp);
+  xfread(&mcmc->step, sizeof(long), 1, fp);
+  xfread(&mcmc->accept_count, sizeof(long), 1, fp);
+  xfread(&mcmc->species_count, sizeof(long), 1, fp);
+  xfread(&mcmc->logl, sizeof(double), 1, fp);
+  xfread(&mcmc->max_aic, sizeof(double), 1, fp);
+  xfread(&mcmc->aic_weight_prefix_sum, sizeof(double), 1, fp);
+  xfread(&mcmc->coal_edge_count, sizeof(long), 1, fp);
+  xfread(&mcmc->spec_edge_count, sizeof(long), 1, fp);
+  xfread(&mcmc->spec_edgelen_sum, sizeof(double), 1, fp);
+  xfread(&mcmc->coal_edgelen_sum, sizeof(double), 1, fp);
+  xfread(&mcmc->coal_score, sizeof(double), 1, fp);
+  xfread(&mcmc->min_logl_seen, sizeof(double), 1, fp);
+  xfread(&mcmc->max_logl_seen, sizeof(double), 1, fp);
+
+  long trace_count;
+  xfread(&trace_count, sizeof(long), 1, fp);
+  if (trace_count < 0 || (trace_count && !mcmc->trace))
+    fatal("Corrupted checkpoint");
+  if (trace_count > mcmc->trace_alloc)
+  {
+    mcmc->trace_alloc = trace_count;
+    mcmc->trace = (double *)xrealloc(mcmc->trace,
+                                     (size_t)trace_count * sizeof(double));
+  }
+  if (trace_count)
+    xfread(mcmc->trace, sizeof(double), (size_t)trace_count, fp);
+  mcmc->trace_count = trace_count;
+
+  /* drop the samples logged after the checkpoint was written */
+  long log_size;
+  xfread(&log_size, sizeof(long), 1, fp);
+  if (mcmc->fp_log)
+  {
+    struct stat st;
 
-  //printf("Acceptance: %ld\n", accept_count);
-  /* TODO: DEBUG variables for checking the max likelihood mcmc runs give.
-     Must be removed */
-  mcmc_finalize(tree, *mcmc_min_logl, *mcmc_max_logl, seed, aic_weight_prefix_sum);
+    if (fstat(fileno(mcmc->fp_log), &st) || st.st_size < log_size ||
+        ftruncate(fileno(mcmc->fp_log), (off_t)log_size) ||
+        fseek(mcmc->fp_log, 0, SEEK_END))
+      fatal("Log file %s.%ld.log does not match the checkpoint",
+            opt_outfile,
+            mcmc->seed);
+  }
+}
+
+/* Compute the support values of the run, write its statistics, store the
+   extreme log-likelihoods observed and free the run */
+void aic_mcmc_finish(mcmc_t * mcmc,
+                     double * mcmc_min_logl,
+                     double * mcmc_max_logl)
+{
+  if (mcmc->tree->edge_count)
+  {
+    if (mcmc->cold)
+      mcmc_finalize(mcmc);
+    else
+      free(mcmc->densities);
+
+    mcmc_free_nodes(mcmc);
+  }
+
+  *mcmc_min_logl = mcmc->min_logl_seen;
+  *mcmc_max_logl = mcmc->max_logl_seen;
+
+  free(mcmc->trace);
+  free(mcmc);
+}
+
+void aic_mcmc(rtree_t * tree,
+              rtree_t * mltree,
+              long method,
+              unsigned short * rstate,
+              long seed,
+              double * mcmc_min_logl,
+              double * mcmc_max_logl)
+{
+  mcmc_t * mcmc = aic_mcmc_start(tree, mltree, method, rstate, seed, 1, stdout);
 
+  aic_mcmc_run(mcmc);
+  aic_mcmc_finish(mcmc, mcmc_min_logl, mcmc_max_logl);
 }
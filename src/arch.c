@@ -155,3 +155,71 @@ long arch_random()
   return random();
 #endif
 }
+
+long mmx_present = 0;
+long sse_present = 0;
+long sse2_present = 0;
+long sse3_present = 0;
+long ssse3_present = 0;
+long sse41_present = 0;
+long sse42_present = 0;
+long popcnt_present = 0;
+long avx_present = 0;
+long avx2_present = 0;
+
+#if !defined(__PPC__) && (defined(__x86_64__) || defined(__i386__))
+
+#define cpuid(f1, f2, a, b, c, d)                                \
+  __asm__ __volatile__ ("cpuid"                                  \
+                        : "=a" (a), "=b" (b), "=c" (c), "=d" (d) \
+                        : "a" (f1), "c" (f2));
+
+void cpu_features_detect()
+{
+  unsigned int a, b, c, d;
+
+  cpuid(0, 0, a, b, c, d);
+  unsigned int maxlevel = a & 0xff;
+
+  if (maxlevel >= 1)
+  {
+    cpuid(1, 0, a, b, c, d);
+    mmx_present    = (d >> 23) & 1;
+    sse_present    = (d >> 25) & 1;
+    sse2_present   = (d >> 26) & 1;
+    sse3_present   = (c >>  0) & 1;
+    ssse3_present  = (c >>  9) & 1;
+    sse41_present  = (c >> 19) & 1;
+    sse42_present  = (c >> 20) & 1;
+    popcnt_present = (c >> 23) & 1;
+    avx_present    = (c >> 28) & 1;
+
+    /* AVX registers are usable only if the OS saves the YMM state, which is
+       indicated by the OSXSAVE bit and bits 1 and 2 of XCR0 */
+    if (avx_present && ((c >> 27) & 1))
+    {
+      unsigned int xcr0_lo, xcr0_hi;
+      __asm__ __volatile__ ("xgetbv"
+                            : "=a" (xcr0_lo), "=d" (xcr0_hi)
+                            : "c" (0));
+      if ((xcr0_lo & 6) != 6)
+        avx_present = 0;
+    }
+    else
+      avx_present = 0;
+
+    if (maxlevel >= 7)
+    {
+      cpuid(7, 0, a, b, c, d);
+      avx2_present = avx_present && ((b >> 5) & 1);
+    }
+  }
+}
+
+#else
+
+void cpu_features_detect()
+{
+}
+
+#endif
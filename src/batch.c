@@ -0,0 +1,187 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+
+#include "mptp.h"
+
+typedef struct batch_tree_s
+{
+  rtree_t * tree;
+  long method;
+  long species;
+  int lrt_pass;
+  double logl;
+  double aic;
+  double pvalue;
+  rtree_t ** croots;
+} batch_tree_t;
+
+/* Compute the ML delimitation of one tree with its own arena. The DP table
+   is filled serially, as the trees themselves are processed in parallel */
+static void cb_batch_tree(void * data, long worker)
+{
+  batch_tree_t * bt = (batch_tree_t *)data;
+  rtree_t * tree = bt->tree;
+
+  dp_arena_t * arena = dp_arena_create();
+
+  dp_init(tree, arena);
+  dp_set_pernode_spec_edges(tree);
+  dp_fill_threads(tree, bt->method, 1);
+
+  /* a tree without a delimitation within the species bounds is reported
+     as NA instead of stopping the batch */
+  if (tree->filled_count)
+  {
+    bt->croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                     sizeof(rtree_t *));
+    bt->species = dp_ptp_croots(tree,
+                                bt->method,
+                                &bt->logl,
+                                &bt->pvalue,
+                                &bt->lrt_pass,
+                                bt->croots);
+    bt->aic = dp_ml_aic(tree, bt->method);
+  }
+
+  dp_free(tree);
+  dp_arena_destroy(arena);
+}
+
+static int cb_batch_cmp(const void * va, const void * vb)
+{
+  const batch_tree_t * a = *(batch_tree_t * const *)va;
+  const batch_tree_t * b = *(batch_tree_t * const *)vb;
+
+  /* larger trees first */
+  if (a->tree->leaves > b->tree->leaves) return -1;
+  if (a->tree->leaves < b->tree->leaves) return 1;
+  return (a < b) ? -1 : (a > b);
+}
+
+static void batch_write(FILE * out, long index, batch_tree_t * bt)
+{
+  long i;
+  rtree_t * tree = bt->tree;
+
+  fprintf(out, "%ld\t%d\t%d\t%.6f\t", index, tree->leaves, tree->edge_count,
+          tree->coal_logl);
+
+  if (!bt->croots)
+  {
+    fprintf(out, "NA\tNA\tNA\tNA\tNA\tNA\n");
+    return;
+  }
+
+  fprintf(out,
+          "%.6f\t%.6f\t%.6f\t%s\t%ld\t",
+          bt->logl,
+          bt->aic,
+          bt->pvalue,
+          bt->lrt_pass ? "passed" : "failed",
+          bt->species);
+
+  for (i = 0; i < bt->species; ++i)
+  {
+    char * taxa = rtree_tip_labels(bt->croots[i]);
+    fprintf(out, "%s%s", i ? "|" : "", taxa);
+    free(taxa);
+  }
+  fprintf(out, "\n");
+}
+
+/* Compute the ML delimitation of each of the trees, processing the trees in
+   parallel with --threads threads, and write one table with a row per tree
+   to the output file. Each tree gets its own arena, and the trees are
+   scheduled from the largest to the smallest to balance the threads. The
+   delimitation column lists the species separated by '|', each as the
+   comma-separated labels of its tips, and holds the null model when the
+   LRT fails */
+void ml_batch(rtree_t ** trees, long count, long method)
+{
+  long i;
+  long max_edges = 0;
+
+  batch_tree_t * batch = (batch_tree_t *)xcalloc((size_t)count,
+                                                 sizeof(batch_tree_t));
+  batch_tree_t ** order = (batch_tree_t **)xmalloc((size_t)count *
+                                                   sizeof(batch_tree_t *));
+
+  for (i = 0; i < count; ++i)
+  {
+    batch[i].tree = trees[i];
+    batch[i].method = method;
+    order[i] = batch + i;
+
+    max_edges = MAX(max_edges, 2*trees[i]->leaves - 2);
+  }
+
+  /* the shared table must not grow while the workers read it */
+  loglikelihood_table_init(max_edges);
+
+  qsort(order, (size_t)count, sizeof(batch_tree_t *), cb_batch_cmp);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Computing ML delimitations of %ld trees ...\n", count);
+
+  if (opt_threads > 1 && count > 1)
+  {
+    threadpool_t * pool = threadpool_create(MIN(opt_threads, count));
+    for (i = 0; i < count; ++i)
+      threadpool_submit(pool, -1, cb_batch_tree, order[i]);
+    threadpool_destroy(pool);
+  }
+  else
+  {
+    for (i = 0; i < count; ++i)
+      cb_batch_tree(order[i], 0);
+  }
+
+  FILE * out = open_file_ext("txt", opt_seed);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Writing delimitations of %ld trees to %s.txt ...\n",
+            count, opt_outfile);
+
+  fprintf(out, "Command: %s\n", cmdline);
+  fprintf(out, "tree\ttips\tedges\tnull_logl\tml_logl\taic\tpvalue\tlrt\t"
+               "species\tdelimitation\n");
+
+  long failed = 0;
+  for (i = 0; i < count; ++i)
+  {
+    batch_write(out, i+1, batch + i);
+
+    if (!batch[i].croots)
+      failed++;
+
+    free(batch[i].croots);
+  }
+
+  if (failed)
+    fprintf(stderr,
+            "WARNING: %ld trees have no delimitation within the species "
+            "bounds given by --min_species and --max_species\n", failed);
+
+  fclose(out);
+  free(order);
+  free(batch);
+}
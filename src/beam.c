@@ -0,0 +1,634 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+
+/* Beam mode (--beam). Instead of the optimal candidate of every entry of the
+   DP vector, each node keeps only the B best candidates over all its entries.
+   The candidates of a node are the best ones of each entry obtained from the
+   kept candidates of its children, computed as in dp_topk_merge(). The
+   first fill ranks them by the criterion dp_ptp() uses to select the ML
+   delimitation, i.e. the score for the single-rate method and the AIC score
+   for the multi-rate one. As these scores fit the rates to the edges of the
+   subtree only, they compare candidates of different entries poorly, hence
+   the fill is repeated ranking the candidates by the log-likelihood of their
+   edges under the rates of the delimitation found so far, which adds up over
+   subtrees, for as long as the delimitation improves. Each fill takes
+   O(n B^2) time and O(n B) memory, independently of the number of edges of
+   each subtree, but the ML delimitation may be missed */
+
+typedef struct dp_beam_s
+{
+  long method;
+  long width;
+
+  /* candidate of each entry of the node being merged, -1 if none */
+  int * slot;
+
+  /* candidates of the node being merged and their selection keys */
+  dp_cand_t * cands;
+  dp_cand_key_t * keys;
+
+  /* log-likelihood computations for one candidate of the left child */
+  dp_block_t block;
+
+  /* number of tips of the tree */
+  long leaves;
+
+  /* number of nodes at which candidates were discarded */
+  long pruned;
+
+  /* whether candidates are ranked under fixed speciation and coalescent
+     rates (the latter for the single-rate method only), and the increase
+     of the AIC score per species (multi-rate method only) */
+  int fixed;
+  double spec_rate;
+  double coal_rate;
+  double species_penalty;
+} dp_beam_t;
+
+/* Key by which the candidates of node are ranked, lower is better */
+static double dp_beam_key(rtree_t * node, dp_cand_t * c, dp_beam_t * ctx)
+{
+  if (!ctx->fixed)
+  {
+    if (ctx->method == PTP_METHOD_MULTI)
+      return aic(c->score, c->species_count, ctx->leaves+2);
+
+    return -c->score;
+  }
+
+  double logl = c->entry * log(ctx->spec_rate) -
+                ctx->spec_rate * c->spec_edgelen_sum;
+
+  if (ctx->method == PTP_METHOD_MULTI)
+    return -(logl + c->coal_multi_logl) +
+           ctx->species_penalty * c->species_count;
+
+  return -(logl + (node->edge_count - c->entry) * log(ctx->coal_rate) -
+           ctx->coal_rate * (node->edgelen_sum - c->spec_edgelen_sum));
+}
+
+/* Whether root candidate a is a better delimitation than b */
+static int dp_beam_better(dp_cand_t * a, dp_cand_t * b, dp_beam_t * ctx)
+{
+  if (ctx->method == PTP_METHOD_MULTI)
+    return aic(a->score, a->species_count, ctx->leaves+2) <
+           aic(b->score, b->species_count, ctx->leaves+2);
+
+  return a->score > b->score;
+}
+
+/* Keep only the ranks of the child candidates of each candidate of node */
+static void dp_beam_compact(rtree_t * node)
+{
+  int i;
+
+  node->beam_ranks = (int *)xmalloc((size_t)(2*node->beam_count + 2) *
+                                    sizeof(int));
+  for (i = 0; i < node->beam_count; ++i)
+  {
+    dp_cand_t * c = node->beam + i;
+
+    node->beam_ranks[2*i]   = (c->left == -1) ? -1 : c->left_rank;
+    node->beam_ranks[2*i+1] = c->right_rank;
+  }
+
+  free(node->beam);
+  node->beam = NULL;
+}
+
+static void dp_beam_merge(rtree_t * node, dp_beam_t * ctx)
+{
+  long i,j,x;
+  long count = 0;
+  dp_cand_t c;
+
+  long n = dp_width(node);
+
+  node->coal_logl = loglikelihood(node->edge_count, node->edgelen_sum);
+
+  double spec_logl = loglikelihood(node->spec_edge_count,
+                                   node->spec_edgelen_sum);
+
+  /* entry 0 starts with the whole subtree being one coalescent */
+  c.score = node->coal_logl + spec_logl;
+  c.spec_edgelen_sum = 0;
+  c.coal_multi_logl = node->coal_logl;
+  c.species_count = 1;
+  c.left = -1;
+  c.left_rank = c.right_rank = 0;
+  c.entry = 0;
+  if (dp_species_feasible(node, 1))
+  {
+    ctx->slot[0] = 0;
+    ctx->cands[count++] = c;
+  }
+
+  if (node->left)
+  {
+    rtree_t * v = node->left;
+    rtree_t * w = node->right;
+
+    double u_edgelen_sum;
+    int u_edge_count = dp_child_edges(node, &u_edgelen_sum);
+
+    for (j = 0; j < v->beam_count; ++j)
+    {
+      dp_cand_t * vc = v->beam + j;
+
+      /* the candidates of the right child are not ordered by entry */
+      ctx->block.count = 0;
+      for (i = 0; i < w->beam_count; ++i)
+      {
+        dp_cand_t * wc = w->beam + i;
+        long entry = vc->entry + wc->entry + u_edge_count;
+
+        if (entry >= n) continue;
+        if (!dp_species_feasible(node, vc->species_count + wc->species_count))
+          continue;
+
+        dp_block_add(&ctx->block,
+                     node,
+                     (int)entry,
+                     u_edgelen_sum,
+                     vc->spec_edgelen_sum,
+                     wc->spec_edgelen_sum,
+                     (int)j,
+                     (int)i);
+      }
+
+      dp_block_logl(&ctx->block, ctx->method == PTP_METHOD_SINGLE);
+
+      for (x = 0; x < ctx->block.count; ++x)
+      {
+        dp_cand_t * wc = w->beam + ctx->block.right[x];
+
+        c.coal_multi_logl = vc->coal_multi_logl + wc->coal_multi_logl;
+        c.score = dp_block_score(&ctx->block,
+                                 x,
+                                 ctx->method,
+                                 c.coal_multi_logl);
+        c.spec_edgelen_sum = ctx->block.u_spec_edgelen_sum[x];
+        c.species_count = vc->species_count + wc->species_count;
+        c.left = vc->entry;
+        c.left_rank = (int)j;
+        c.right_rank = ctx->block.right[x];
+        c.entry = vc->entry + wc->entry + u_edge_count;
+
+        /* keep the best candidate of each entry, as dp_merge() does */
+        if (ctx->slot[c.entry] == -1)
+        {
+          ctx->slot[c.entry] = (int)count;
+          ctx->cands[count++] = c;
+        }
+        else if (ctx->cands[ctx->slot[c.entry]].score < c.score)
+          ctx->cands[ctx->slot[c.entry]] = c;
+      }
+    }
+  }
+
+  /* rank the candidates and keep the best ones. With species bounds, the
+     candidates of the lowest and highest entries, i.e. with the fewest and
+     most species, are kept as well such that the bounds remain reachable */
+  int min_entry = count ? ctx->cands[0].entry : 0;
+  int max_entry = min_entry;
+  for (x = 0; x < count; ++x)
+  {
+    ctx->slot[ctx->cands[x].entry] = -1;
+
+    if (ctx->cands[x].entry < min_entry) min_entry = ctx->cands[x].entry;
+    if (ctx->cands[x].entry > max_entry) max_entry = ctx->cands[x].entry;
+
+    ctx->keys[x].cand = ctx->cands + x;
+    ctx->keys[x].index = ctx->cands[x].entry;
+    ctx->keys[x].rank = (int)x;
+    ctx->keys[x].key = dp_beam_key(node, ctx->cands + x, ctx);
+  }
+  qsort(ctx->keys, (size_t)count, sizeof(dp_cand_key_t), dp_cand_key_cmp);
+
+  int bounded = opt_min_species > 1 || opt_max_species;
+  long kept = (count < ctx->width + 2) ? count : ctx->width + 2;
+
+  node->beam = (dp_cand_t *)xmalloc((size_t)(kept + 1) * sizeof(dp_cand_t));
+  node->beam_count = 0;
+  for (x = 0; x < count; ++x)
+  {
+    int entry = ctx->keys[x].index;
+
+    if (x < ctx->width ||
+        (bounded && (entry == min_entry || entry == max_entry)))
+      node->beam[node->beam_count++] = *(ctx->keys[x].cand);
+  }
+
+  if (node->beam_count < count)
+    ctx->pruned++;
+
+  /* the children candidates are only back-tracked from now on */
+  if (node->left)
+  {
+    dp_beam_compact(node->left);
+    dp_beam_compact(node->right);
+  }
+}
+
+/* Back-track candidate 'rank' of node, mark the events of the visited nodes
+   and collect the coalescent roots in preorder */
+static void dp_beam_backtrack(rtree_t * node,
+                              int rank,
+                              bool * warning_minbr,
+                              rtree_t ** croots,
+                              long * croots_count)
+{
+  long top = 0;
+
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(node->leaves + 1) *
+                                         sizeof(rtree_t *));
+  int * ranks = (int *)xmalloc((size_t)(node->leaves + 1) * sizeof(int));
+
+  stack[top] = node; ranks[top++] = rank;
+  while (top)
+  {
+    --top;
+    rtree_t * x = stack[top];
+    int * r = x->beam_ranks + 2*ranks[top];
+
+    if (r[0] == -1)
+    {
+      x->event = EVENT_COALESCENT;
+      croots[*croots_count] = x;
+      *croots_count = *croots_count + 1;
+      continue;
+    }
+
+    x->event = EVENT_SPECIATION;
+
+    if (x->length <= opt_minbr && x->parent) *warning_minbr = true;
+
+    stack[top] = x->right; ranks[top++] = r[1];
+    stack[top] = x->left;  ranks[top++] = r[0];
+  }
+
+  free(ranks);
+  free(stack);
+}
+
+static int cb_croot_cmp(const void * va, const void * vb)
+{
+  const rtree_t * a = *(rtree_t * const *)va;
+  const rtree_t * b = *(rtree_t * const *)vb;
+
+  if (a < b) return -1;
+  if (a > b) return 1;
+  return 0;
+}
+
+/* Number of species of one delimitation that are also species of the other,
+   i.e. the common coalescent roots. Both lists are sorted in place */
+static long dp_beam_common(rtree_t ** a, long a_count,
+                           rtree_t ** b, long b_count)
+{
+  long i = 0;
+  long j = 0;
+  long common = 0;
+
+  qsort(a, (size_t)a_count, sizeof(rtree_t *), cb_croot_cmp);
+  qsort(b, (size_t)b_count, sizeof(rtree_t *), cb_croot_cmp);
+
+  while (i < a_count && j < b_count)
+  {
+    if (a[i] == b[j])
+    {
+      common++;
+      i++; j++;
+    }
+    else if (a[i] < b[j])
+      i++;
+    else
+      j++;
+  }
+
+  return common;
+}
+
+/* Accuracy report of the beam approximation (--beam_check). The exact DP is
+   filled for the same tree and its ML delimitation is compared with the one
+   of the beam, which is given by its score, species count and coalescent
+   roots. The coalescent roots marked by the exact back-tracking are reset to
+   the default event */
+static void dp_beam_report(rtree_t * tree,
+                           long method,
+                           long width,
+                           long pruned,
+                           double beam_logl,
+                           unsigned int beam_species,
+                           rtree_t ** beam_croots,
+                           long beam_croots_count,
+                           long beam_usec)
+{
+  long i;
+  bool warning_minbr = false;
+  double logl;
+
+  long start = getusec();
+
+  dp_arena_t * arena = dp_arena_create();
+  dp_init(tree, arena);
+  dp_fill(tree, method);
+
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                          sizeof(rtree_t *));
+  long croots_count = dp_ml_croots(tree, method, &logl, &warning_minbr, croots);
+
+  dp_free(tree);
+  dp_arena_destroy(arena);
+
+  long exact_usec = getusec() - start;
+
+  /* the back-tracking only marks coalescent roots on top of the defaults */
+  for (i = 0; i < croots_count; ++i)
+    croots[i]->event = EVENT_SPECIATION;
+
+  long common = dp_beam_common(croots,
+                               croots_count,
+                               beam_croots,
+                               beam_croots_count);
+
+  double exact_aic = aic(logl, croots_count, tree->leaves+2);
+  double beam_aic = aic(beam_logl, beam_species, tree->leaves+2);
+  const char * name = (method == PTP_METHOD_SINGLE) ? "single" : "multi";
+
+  FILE * out = open_file_ext("beam.txt", opt_seed);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Writing beam accuracy report %s.beam.txt ...\n",
+            opt_outfile);
+
+  fprintf(out, "Command: %s\n", cmdline);
+  fprintf(out, "Beam width: %ld\n", width);
+  fprintf(out,
+          "Nodes with discarded candidates: %ld / %d\n",
+          pruned,
+          2 * tree->leaves - 1);
+  fprintf(out, "Exact score for %s coalescent rate: %.6f\n", name, logl);
+  fprintf(out, "Beam score for %s coalescent rate: %.6f\n", name, beam_logl);
+  fprintf(out, "Score loss: %.6f\n", logl - beam_logl);
+  fprintf(out, "Exact AIC score: %.6f\n", exact_aic);
+  fprintf(out, "Beam AIC score: %.6f\n", beam_aic);
+  fprintf(out, "AIC loss: %.6f\n", beam_aic - exact_aic);
+  fprintf(out, "Exact number of species: %ld\n", croots_count);
+  fprintf(out, "Beam number of species: %ld\n", beam_croots_count);
+  fprintf(out,
+          "Species identical in both delimitations: %ld (%.2f%% of exact)\n",
+          common,
+          croots_count ? 100.0 * common / croots_count : 100.0);
+  fprintf(out, "Exact DP time: %.3f s\n", exact_usec / 1e6);
+  fprintf(out, "Beam DP time: %.3f s\n", beam_usec / 1e6);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Beam accuracy: %s loss %.6f, %ld / %ld species identical "
+            "(exact DP %.3f s, beam %.3f s)\n",
+            method == PTP_METHOD_SINGLE ? "score" : "AIC",
+            method == PTP_METHOD_SINGLE ? logl - beam_logl :
+                                          beam_aic - exact_aic,
+            common,
+            croots_count,
+            exact_usec / 1e6,
+            beam_usec / 1e6);
+
+  free(croots);
+  fclose(out);
+}
+
+/* Fill the candidates of all nodes and return the rank of the root candidate
+   selected as in dp_best_entry(): the candidate of the lowest entry is the
+   default and the remaining ones are considered below edge_count */
+static int dp_beam_fill(rtree_t ** postorder, int count, dp_beam_t * ctx)
+{
+  int i;
+  int best = 0;
+  rtree_t * tree = postorder[count-1];
+
+  ctx->pruned = 0;
+  for (i = 0; i < count; ++i)
+  {
+    free(postorder[i]->beam);
+    free(postorder[i]->beam_ranks);
+    postorder[i]->beam = NULL;
+    postorder[i]->beam_ranks = NULL;
+  }
+
+  for (i = 0; i < count; ++i)
+    dp_beam_merge(postorder[i], ctx);
+
+  dp_species_check(tree->beam_count);
+
+  for (i = 1; i < tree->beam_count; ++i)
+    if (tree->beam[i].entry < tree->beam[best].entry)
+      best = i;
+
+  /* ties go to the lower entry */
+  int first = best;
+  for (i = 0; i < tree->beam_count; ++i)
+  {
+    dp_cand_t * c = tree->beam + i;
+
+    if (i != first && c->entry >= tree->edge_count) continue;
+
+    if (dp_beam_better(c, tree->beam + best, ctx) ||
+        (!dp_beam_better(tree->beam + best, c, ctx) &&
+         c->entry < tree->beam[best].entry))
+      best = i;
+  }
+
+  return best;
+}
+
+/* Approximate the ML delimitation keeping the 'width' best candidates of
+   each node (beam mode), and report and write it as dp_ptp() does. With
+   --beam_check the result is compared with the exact DP */
+void dp_beam(rtree_t * tree, long method, long width)
+{
+  long i;
+  int count;
+  int round;
+  dp_beam_t ctx;
+
+  long start = getusec();
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(tree, postorder);
+
+  dp_bounds_init(tree);
+
+  loglikelihood_table_init(2*tree->leaves - 2);
+
+  /* the candidates of a node are at most one per entry, and each child
+     keeps at most width + 2 candidates (see dp_beam_merge()) */
+  long kept = (width + 2 < dp_width(tree)) ? width + 2 : dp_width(tree);
+  long size = (kept*kept + 1 < dp_width(tree)) ?
+              kept*kept + 1 : dp_width(tree);
+
+  ctx.method = method;
+  ctx.width = width;
+  ctx.leaves = tree->leaves;
+  ctx.slot = (int *)xmalloc((size_t)dp_width(tree) * sizeof(int));
+  for (i = 0; i < dp_width(tree); ++i)
+    ctx.slot[i] = -1;
+  ctx.cands = (dp_cand_t *)xmalloc((size_t)size * sizeof(dp_cand_t));
+  ctx.keys = (dp_cand_key_t *)xmalloc((size_t)size * sizeof(dp_cand_key_t));
+
+  /* one block holds at most the candidates of one child */
+  dp_block_alloc(&ctx.block, kept);
+
+  for (i = 0; i < count; ++i)
+  {
+    postorder[i]->beam = NULL;
+    postorder[i]->beam_ranks = NULL;
+  }
+
+  ctx.fixed = 0;
+  int best = dp_beam_fill(postorder, count, &ctx);
+  int fills = 1;
+  int refill = 0;
+  dp_cand_t c = tree->beam[best];
+  dp_beam_t last = ctx;
+
+  /* refill under the rates of the current delimitation while it improves */
+  for (round = 0; round < DP_BEAM_ROUNDS; ++round)
+  {
+    int coal_edge_count = tree->edge_count - c.entry;
+    double coal_edgelen_sum = tree->edgelen_sum - c.spec_edgelen_sum;
+
+    if (!c.entry || c.spec_edgelen_sum <= 0) break;
+    if (method == PTP_METHOD_SINGLE &&
+        (!coal_edge_count || coal_edgelen_sum <= 0)) break;
+
+    ctx.fixed = 1;
+    ctx.spec_rate = c.entry / c.spec_edgelen_sum;
+    ctx.coal_rate = coal_edge_count ? coal_edge_count / coal_edgelen_sum : 1;
+
+    /* the AIC score linearized at the current number of species, in units of
+       log-likelihood */
+    ctx.species_penalty = (aic(0, c.species_count+1, tree->leaves+2) -
+                           aic(0, c.species_count, tree->leaves+2)) / 2;
+
+    int r = dp_beam_fill(postorder, count, &ctx);
+    fills++;
+    if (!dp_beam_better(tree->beam + r, &c, &ctx))
+    {
+      refill = 1;
+      break;
+    }
+
+    best = r;
+    c = tree->beam[r];
+    last = ctx;
+  }
+
+  /* the last fill did not improve, repeat the best one */
+  if (refill)
+  {
+    ctx = last;
+    best = dp_beam_fill(postorder, count, &ctx);
+    fills++;
+  }
+
+  double max = tree->beam[best].score;
+  unsigned int species_count = tree->beam[best].species_count;
+
+  dp_beam_compact(tree);
+
+  long beam_usec = getusec() - start;
+
+  if (!opt_quiet)
+  {
+    fprintf(stdout,
+           "Number of edges greater than minimum branch length: %d / %d\n",
+           tree->edge_count,
+           2 * tree->leaves - 2);
+    fprintf(stdout,
+            "Nodes with discarded candidates (beam width %ld): %ld / %d\n",
+            width,
+            ctx.pruned,
+            count);
+    fprintf(stdout, "Beam DP fills: %d\n", fills);
+    printf("Score Null Model: %.6f\n", tree->coal_logl);
+    fprintf(stdout,
+            "Best score for %s coalescent rate: %.6f\n",
+            (method == PTP_METHOD_SINGLE) ? "single" : "multi",
+            max);
+  }
+
+  bool warning_minbr = false;
+  long croots_count = 0;
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                          sizeof(rtree_t *));
+
+  /* the exact back-tracking of the report overwrites events, hence the beam
+     delimitation is back-tracked once more afterwards */
+  if (opt_beam_check)
+  {
+    rtree_t ** beam_croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                                 sizeof(rtree_t *));
+    bool beam_warning = false;
+
+    dp_beam_backtrack(tree, best, &beam_warning, beam_croots, &croots_count);
+    dp_beam_report(tree,
+                   method,
+                   width,
+                   ctx.pruned,
+                   max,
+                   species_count,
+                   beam_croots,
+                   croots_count,
+                   beam_usec);
+    free(beam_croots);
+    croots_count = 0;
+  }
+
+  dp_beam_backtrack(tree, best, &warning_minbr, croots, &croots_count);
+
+  dp_ptp_write(tree,
+               method,
+               max,
+               species_count,
+               croots,
+               croots_count,
+               warning_minbr);
+
+  for (i = 0; i < count; ++i)
+  {
+    free(postorder[i]->beam_ranks);
+    postorder[i]->beam_ranks = NULL;
+    postorder[i]->beam_count = 0;
+  }
+
+  free(ctx.slot);
+  free(ctx.cands);
+  free(ctx.keys);
+  dp_block_free(&ctx.block);
+  free(croots);
+  free(postorder);
+}
@@ -0,0 +1,179 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+
+/* Clade constraints (--constraints). Each line of the constraint file holds
+   a keyword and a comma-separated list of taxa, and constrains the lowest
+   common ancestor (LCA) of the taxa:
+
+     species TAXA   the LCA is the root of a species
+     join TAXA      the taxa belong to one species, i.e. the LCA is the root
+                    of a species or lies within one
+     split TAXA     the taxa belong to more than one species, i.e. the LCA
+                    is a speciation event
+
+   Empty lines and lines starting with # are ignored. Every ancestor of the
+   root of a species or of a speciation event must be a speciation event, and
+   the nodes below the LCA of a species or a join constraint are marked as
+   being within a species, such that the DP skips their subtrees */
+
+static const char * constraint_keywords[] = { "species", "join", "split" };
+
+static const int constraint_flags[] = { CONSTRAINT_COALESCENT,
+                                        CONSTRAINT_JOIN,
+                                        CONSTRAINT_SPLIT };
+
+static rtree_t * constraint_lca(rtree_t * root, char * taxa)
+{
+  unsigned int count;
+  rtree_t * lca;
+
+  rtree_t ** tips = rtree_tipstring_nodes(root, taxa, &count);
+
+  if (count > 1)
+    lca = rtree_lca(root, tips, count);
+  else
+    lca = tips[0];
+
+  free(tips);
+
+  return lca;
+}
+
+static void constraints_propagate(rtree_t * root)
+{
+  int i;
+  int count;
+
+  rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2*root->leaves - 1) *
+                                            sizeof(rtree_t *));
+  count = rtree_preorder(root, preorder);
+
+  /* speciation events above roots of species and speciation events */
+  for (i = count-1; i > 0; --i)
+    if (preorder[i]->constraint & (CONSTRAINT_COALESCENT | CONSTRAINT_SPLIT))
+      preorder[i]->parent->constraint |= CONSTRAINT_SPLIT;
+
+  /* nodes within species */
+  for (i = 1; i < count; ++i)
+  {
+    rtree_t * x = preorder[i];
+
+    if (x->parent->constraint & (CONSTRAINT_COALESCENT |
+                                 CONSTRAINT_JOIN |
+                                 CONSTRAINT_INSIDE))
+      x->constraint |= CONSTRAINT_INSIDE;
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = preorder[i];
+
+    if ((x->constraint & CONSTRAINT_SPLIT) &&
+        (x->constraint & (CONSTRAINT_COALESCENT |
+                          CONSTRAINT_JOIN |
+                          CONSTRAINT_INSIDE)))
+      fatal("Conflicting constraints: the clade of %d tips is required to "
+            "be both within one species and a speciation event", x->leaves);
+  }
+
+  free(preorder);
+}
+
+void constraints_load(rtree_t * root, const char * filename)
+{
+  long i;
+  long lineno = 0;
+  long constraints_count = 0;
+  char * line = NULL;
+  size_t line_alloc = 0;
+
+  FILE * fp = xopen(filename, "r");
+
+  while (getline(&line, &line_alloc, fp) != -1)
+  {
+    ++lineno;
+
+    /* strip trailing white-space and skip empty lines and comments */
+    size_t len = strlen(line);
+    while (len && isspace((unsigned char)line[len-1]))
+      line[--len] = 0;
+
+    char * s = line;
+    while (isspace((unsigned char)*s)) ++s;
+
+    if (!*s || *s == '#') continue;
+
+    size_t keyword_len = strcspn(s, " \t");
+    char * taxa = s + keyword_len;
+    while (isspace((unsigned char)*taxa)) ++taxa;
+
+    if (!*taxa)
+      fatal("Missing taxa in line %ld of %s", lineno, filename);
+
+    for (i = 0; i < 3; ++i)
+      if (strlen(constraint_keywords[i]) == keyword_len &&
+          !strncmp(s, constraint_keywords[i], keyword_len))
+        break;
+
+    if (i == 3)
+      fatal("Unknown constraint in line %ld of %s (expected species, join "
+            "or split)", lineno, filename);
+
+    rtree_t * lca = constraint_lca(root, taxa);
+
+    if (constraint_flags[i] == CONSTRAINT_SPLIT && !lca->left)
+      fatal("Constraint in line %ld of %s splits a single taxon",
+            lineno, filename);
+
+    lca->constraint |= constraint_flags[i];
+    ++constraints_count;
+  }
+
+  free(line);
+  fclose(fp);
+
+  constraints_propagate(root);
+
+  if (!opt_quiet)
+  {
+    int count;
+    long inside = 0;
+
+    rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2*root->leaves - 1) *
+                                              sizeof(rtree_t *));
+    count = rtree_preorder(root, preorder);
+
+    for (i = 0; i < count; ++i)
+      if (preorder[i]->constraint & CONSTRAINT_INSIDE)
+        ++inside;
+
+    free(preorder);
+
+    fprintf(stdout,
+            "Loaded %ld constraints, %ld of %d nodes lie within a constrained "
+            "species\n",
+            constraints_count,
+            inside,
+            count);
+  }
+}
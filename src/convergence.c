@@ -0,0 +1,146 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+
+#include "mptp.h"
+
+/* Average standard deviation of split frequencies, i.e. the standard
+   deviation of the support of each node across the runs, averaged over all
+   nodes. 'support' holds one array of 'count' support values per run, in
+   the same node order */
+double conv_asdsf(double ** support, long runs, long count)
+{
+  long i,j;
+  double mean, var;
+  double sum = 0;
+
+  if (runs < 2 || count < 1) return 0;
+
+  for (i = 0; i < count; ++i)
+  {
+    mean = var = 0;
+    for (j = 0; j < runs; ++j)
+      mean += support[j][i];
+    mean /= runs;
+
+    for (j = 0; j < runs; ++j)
+      var += (mean - support[j][i])*(mean - support[j][i]);
+    var /= runs;
+
+    sum += sqrt(var);
+  }
+
+  return sum / count;
+}
+
+/* Potential scale reduction factor (Gelman and Rubin) of a quantity sampled
+   by several runs, given as 'runs' traces of 'n' samples each */
+double conv_psrf(double ** trace, long runs, long n)
+{
+  long i,j;
+  double grand_mean = 0;
+  double between = 0;
+  double within = 0;
+
+  if (runs < 2 || n < 2) return 0;
+
+  double * mean = (double *)xcalloc((size_t)runs, sizeof(double));
+
+  for (j = 0; j < runs; ++j)
+  {
+    for (i = 0; i < n; ++i)
+      mean[j] += trace[j][i];
+    mean[j] /= n;
+    grand_mean += mean[j];
+  }
+  grand_mean /= runs;
+
+  for (j = 0; j < runs; ++j)
+  {
+    double var = 0;
+    for (i = 0; i < n; ++i)
+      var += (trace[j][i] - mean[j])*(trace[j][i] - mean[j]);
+    within += var / (n-1);
+
+    between += (mean[j] - grand_mean)*(mean[j] - grand_mean);
+  }
+  within /= runs;
+  between /= runs - 1;
+
+  free(mean);
+
+  /* all runs stuck at the same value */
+  if (within == 0) return 1;
+
+  double pooled = (n-1) * within / n + between;
+
+  return sqrt(pooled / within);
+}
+
+/* Effective sample size of a trace of 'n' samples, estimated with
+   non-overlapping batch means of length sqrt(n) */
+double conv_ess(double * trace, long n)
+{
+  long i,j;
+  double mean = 0;
+  double var = 0;
+  double batch_var = 0;
+
+  long size = (long)sqrt((double)n);
+  long batches = size ? n / size : 0;
+
+  if (batches < 2) return 0;
+
+  for (i = 0; i < n; ++i)
+    mean += trace[i];
+  mean /= n;
+
+  for (i = 0; i < n; ++i)
+    var += (trace[i] - mean)*(trace[i] - mean);
+  var /= n-1;
+
+  if (var == 0) return n;
+
+  /* the batch means are taken around the mean of the batched samples */
+  double batched_mean = 0;
+  for (i = 0; i < batches*size; ++i)
+    batched_mean += trace[i];
+  batched_mean /= batches*size;
+
+  for (j = 0; j < batches; ++j)
+  {
+    double batch_mean = 0;
+    for (i = j*size; i < (j+1)*size; ++i)
+      batch_mean += trace[i];
+    batch_mean /= size;
+
+    batch_var += (batch_mean - batched_mean)*(batch_mean - batched_mean);
+  }
+  batch_var /= batches - 1;
+
+  /* the variance of the batch means estimates the asymptotic variance of
+     the chain divided by the batch length */
+  if (batch_var == 0) return n;
+
+  double ess = n * var / (size * batch_var);
+
+  return MIN(ess, (double)n);
+}
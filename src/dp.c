@@ -22,16 +22,596 @@
 #include "mptp.h"
 
 static unsigned int species_iter = 0;
-static unsigned int coal_param_count = 0;
 
-static void dp_recurse(rtree_t * node, long method)
+/* number of tips of the tree being filled, for the --min_species bound. It
+   is kept per thread, as --batch fills the tables of several trees at once,
+   and is passed on to the workers of a parallel fill */
+static __thread long dp_tree_leaves = 0;
+
+/* whether the root of the tree being filled is constrained to be a
+   speciation event (--constraints) */
+static __thread int dp_root_split = 0;
+
+/* Set the tree whose DP table is filled by the calling thread, for the
+   species bounds and the constraints */
+void dp_bounds_init(rtree_t * tree)
+{
+  dp_tree_leaves = tree->leaves;
+  dp_root_split = (tree->constraint & CONSTRAINT_SPLIT) != 0;
+}
+
+/* In report mode (--ml_report) the DP table is filled for both methods at
+   once: every node holds the multi-rate vector in vector and the single-rate
+   vector in vector_single */
+static int dp_dual(void)
+{
+  return opt_ml_report != NULL;
+}
+
+/* DP vector of node holding the optimal entries for method */
+static dp_vector_t * dp_state(rtree_t * node, long method)
+{
+  if (dp_dual() && method == PTP_METHOD_SINGLE)
+    return &node->vector_single;
+
+  return &node->vector;
+}
+
+/* Entries of a DP vector, which stores the speciation edge length sums and
+   the multi-rate coalescent log-likelihoods in single precision when the DP
+   is filled with --dp_float */
+static inline double dp_vec_spec(const dp_vector_t * vec, long i)
+{
+  return vec->spec_edgelen_sum ?
+         vec->spec_edgelen_sum[i] : vec->spec_edgelen_sum_f[i];
+}
+
+static inline double dp_vec_coal(const dp_vector_t * vec, long i)
+{
+  return vec->coal_multi_logl ?
+         vec->coal_multi_logl[i] : vec->coal_multi_logl_f[i];
+}
+
+static inline void dp_vec_set(dp_vector_t * vec,
+                              long i,
+                              double spec_edgelen_sum,
+                              double coal_multi_logl)
+{
+  if (vec->spec_edgelen_sum)
+  {
+    vec->spec_edgelen_sum[i] = spec_edgelen_sum;
+    vec->coal_multi_logl[i] = coal_multi_logl;
+  }
+  else
+  {
+    vec->spec_edgelen_sum_f[i] = (float)spec_edgelen_sum;
+    vec->coal_multi_logl_f[i] = (float)coal_multi_logl;
+  }
+}
+
+/* Back-tracking index and species count of an entry, which are stored in
+   16 bits for the nodes that allow it (see dp_narrow) */
+static inline int dp_vec_left_index(const dp_vector_t * vec, long i)
+{
+  return vec->vec_left ? vec->vec_left[i] : vec->vec_left_s[i];
+}
+
+static inline unsigned int dp_vec_species_count(const dp_vector_t * vec,
+                                                long i)
+{
+  return vec->species_count ? vec->species_count[i] : vec->species_count_s[i];
+}
+
+static inline void dp_vec_set_index(dp_vector_t * vec,
+                                    long i,
+                                    int left,
+                                    unsigned int species_count)
+{
+  if (vec->vec_left)
+  {
+    vec->vec_left[i] = left;
+    vec->species_count[i] = species_count;
+  }
+  else
+  {
+    vec->vec_left_s[i] = (short)left;
+    vec->species_count_s[i] = (unsigned short)species_count;
+  }
+}
+
+static inline int dp_vec_allocated(const dp_vector_t * vec)
+{
+  return vec->vec_left || vec->vec_left_s;
+}
+
+/* Number of entries of the DP vector of node. A delimitation of the subtree
+   with s species has at most 2(s-1) speciation edges, hence --max_species
+   bounds the width of all vectors */
+long dp_width(rtree_t * node)
+{
+  long n = node->edge_count + 1;
+
+  if (opt_max_species && 2*(opt_max_species-1) + 1 < n)
+    n = 2*(opt_max_species-1) + 1;
+
+  return n;
+}
+
+/* The back-tracking indices of a node are below its width and its species
+   counts at most its number of tips. If both fit, they are stored in 16
+   bits, which covers all nodes of trees with up to 16383 tips */
+static int dp_narrow(rtree_t * node)
+{
+  return dp_width(node) <= SHRT_MAX && node->leaves <= USHRT_MAX;
+}
+
+/* bytes of the vec_left and species_count arrays per entry of node */
+static long dp_index_size(rtree_t * node)
+{
+  return dp_narrow(node) ? sizeof(short) + sizeof(unsigned short) :
+                           sizeof(int) + sizeof(unsigned int);
+}
+
+/* Place the vec_left and species_count arrays of a vector of n entries at
+   the start of block, and mark all entries as not filled */
+static void dp_vec_index_init(dp_vector_t * vec,
+                              char * block,
+                              long n,
+                              int narrow)
+{
+  long i;
+
+  if (narrow)
+  {
+    vec->vec_left_s = (short *)block;
+    vec->species_count_s = (unsigned short *)(vec->vec_left_s + n);
+    for (i = 0; i < n; ++i)
+      vec->vec_left_s[i] = -1;
+  }
+  else
+  {
+    vec->vec_left = (int *)block;
+    vec->species_count = (unsigned int *)(vec->vec_left + n);
+    for (i = 0; i < n; ++i)
+      vec->vec_left[i] = -1;
+  }
+}
+
+/* Whether a partial delimitation of the subtree at node with the given number
+   of species can still be extended to one within --min_species and
+   --max_species. Each tip outside the subtree adds at most one species */
+int dp_species_feasible(rtree_t * node, unsigned int species_count)
+{
+  if (opt_max_species && species_count > opt_max_species)
+    return 0;
+
+  if (opt_min_species &&
+      species_count + (dp_tree_leaves - node->leaves) < opt_min_species)
+    return 0;
+
+  return 1;
+}
+
+/* The null-model (one species) is the fallback of a failed LRT only if it is
+   within the species bounds and the constraints */
+static int dp_null_allowed(void)
+{
+  return opt_min_species <= 1 && !dp_root_split;
+}
+
+/* Stop if the species bounds rule out every delimitation, i.e. if no entry
+   or candidate of the root is left out of 'count' */
+void dp_species_check(long count)
+{
+  if (!count)
+    fatal("No delimitation has a number of species within the bounds given "
+          "by --min_species and --max_species");
+}
+
+typedef struct dp_task_s
+{
+  rtree_t * node;
+  long pending;
+  struct dp_task_s * parent;
+} dp_task_t;
+
+typedef struct dp_parallel_s
+{
+  long method;
+  long tree_leaves;
+  int root_split;
+  long task_count;
+  long serial_count;
+  dp_task_t * tasks;
+  struct dp_serial_s * serial;
+} dp_parallel_t;
+
+typedef struct dp_serial_s
+{
+  dp_parallel_t * ctx;
+  rtree_t * node;
+  dp_task_t * parent;
+} dp_serial_t;
+
+/* Low-memory mode. The DP vectors are allocated per node, and the vector of
+   a child is released once its parent is merged, unless the child is a
+   checkpoint. Checkpoints are the tips, the heads of heavy paths (i.e. every
+   child with fewer tips than its sibling, and the root), and every
+   sqrt(length)-th node along each heavy path. Vectors that are missing when
+   back-tracking are recomputed from the nearest checkpoint below them on
+   their heavy path. */
+
+static rtree_t * dp_heavy_child(rtree_t * node)
+{
+  return (node->left->leaves >= node->right->leaves) ?
+         node->left : node->right;
+}
+
+static void dp_vector_alloc_state(dp_vector_t * vec,
+                                  long n,
+                                  int narrow,
+                                  long index_size,
+                                  int ** filled)
+{
+  char * index;
+
+  if (opt_dp_float)
+  {
+    char * block = (char *)xmalloc((size_t)n * (2*sizeof(float) +
+                                                index_size +
+                                                sizeof(int) +
+                                                sizeof(unsigned char)));
+
+    vec->spec_edgelen_sum_f = (float *)block;
+    vec->coal_multi_logl_f = vec->spec_edgelen_sum_f + n;
+    index = (char *)(vec->coal_multi_logl_f + n);
+  }
+  else
+  {
+    char * block = (char *)xmalloc((size_t)n * (2*sizeof(double) +
+                                                index_size +
+                                                sizeof(int)));
+
+    vec->spec_edgelen_sum = (double *)block;
+    vec->coal_multi_logl = vec->spec_edgelen_sum + n;
+    index = (char *)(vec->coal_multi_logl + n);
+  }
+
+  /* the index arrays take a multiple of four bytes per entry, hence the
+     filled list that follows them is aligned */
+  dp_vec_index_init(vec, index, n, narrow);
+  *filled = (int *)(index + n*index_size);
+
+  if (opt_dp_float)
+    vec->unresolved = (unsigned char *)(*filled + n);
+}
+
+static void dp_vector_alloc(rtree_t * node)
+{
+  int * filled;
+  long n = dp_width(node);
+  int narrow = dp_narrow(node);
+  long index_size = dp_index_size(node);
+
+  if (dp_dual())
+    dp_vector_alloc_state(&node->vector_single,
+                          n,
+                          narrow,
+                          index_size,
+                          &filled);
+
+  dp_vector_alloc_state(&node->vector,
+                        n,
+                        narrow,
+                        index_size,
+                        &node->filled_list);
+  node->filled_count = 0;
+}
+
+/* each state of a node is one block starting with its first array */
+static void dp_vector_free_state(dp_vector_t * vec)
+{
+  if (vec->spec_edgelen_sum)
+    free(vec->spec_edgelen_sum);
+  else if (vec->spec_edgelen_sum_f)
+    free(vec->spec_edgelen_sum_f);
+}
+
+static void dp_vector_free(rtree_t * node)
 {
-  int k,j;
+  dp_vector_free_state(&node->vector);
+  dp_vector_free_state(&node->vector_single);
 
-  /* bottom-up recursion */
+  memset(&node->vector, 0, sizeof(dp_vector_t));
+  memset(&node->vector_single, 0, sizeof(dp_vector_t));
+  node->filled_list = NULL;
+}
+
+static void dp_mark_checkpoints(rtree_t * head)
+{
+  long length = 0;
+  long pos = 0;
+  rtree_t * node;
+
+  for (node = head; node; node = node->left ? dp_heavy_child(node) : NULL)
+    ++length;
+
+  long stride = (long)ceil(sqrt((double)length));
+
+  for (node = head; node; node = node->left ? dp_heavy_child(node) : NULL)
+  {
+    node->checkpoint = (pos++ % stride == 0) || !node->left;
+
+    /* the light child starts a new heavy path */
+    if (node->left)
+    {
+      rtree_t * heavy = dp_heavy_child(node);
+      dp_mark_checkpoints(heavy == node->left ? node->right : node->left);
+    }
+  }
+}
+
+static void dp_discard_children(rtree_t * node)
+{
+  if (!node->left) return;
+
+  if (!node->left->checkpoint)  dp_vector_free(node->left);
+  if (!node->right->checkpoint) dp_vector_free(node->right);
+}
+
+static void dp_merge(rtree_t * node, long method);
+
+/* Whether merging node needs the vectors of its children, which is not the
+   case for a node constrained to be within one species */
+static int dp_merge_children(rtree_t * node)
+{
+  return node->left &&
+         !(node->constraint & (CONSTRAINT_COALESCENT | CONSTRAINT_JOIN));
+}
+
+/* Make the DP vector of node available for back-tracking. A missing vector
+   is recomputed together with the missing vectors below node on its heavy
+   path, which are needed next when back-tracking continues downwards. The
+   segment ends above the subtree of a constrained species, which is never
+   filled */
+void dp_vector_restore(rtree_t * node, long method)
+{
+  long i;
+  long count = 0;
+  rtree_t * x;
+
+  if (dp_vec_allocated(&node->vector)) return;
+
+  for (x = node; x; x = dp_merge_children(x) ? dp_heavy_child(x) : NULL)
+  {
+    if (dp_vec_allocated(&x->vector)) break;
+    ++count;
+  }
+
+  rtree_t ** segment = (rtree_t **)xmalloc((size_t)count * sizeof(rtree_t *));
+
+  for (i = 0, x = node; i < count; ++i, x = dp_heavy_child(x))
+    segment[i] = x;
+
+  /* the light children of the segment nodes are heads of heavy paths and
+     hence checkpoints, so merging bottom-up only needs the segment itself */
+  for (i = count-1; i >= 0; --i)
+    dp_merge(segment[i], method);
+
+  free(segment);
+}
+
+/* Release the recomputed vector of node once its event is decided. The
+   heavy child of a speciation node is back-tracked next and releases its own
+   vector, whereas the vectors recomputed below a coalescent root are not
+   needed anymore. Releasing as early as possible keeps at most one segment
+   per heavy path in memory, even on very deep trees */
+void dp_vector_release(rtree_t * node)
+{
+  if (!opt_lowmem || node->checkpoint) return;
+
+  dp_vector_free(node);
+
+  if (node->event != EVENT_COALESCENT) return;
+
+  for (node = dp_heavy_child(node);
+       !node->checkpoint && dp_vec_allocated(&node->vector);
+       node = dp_heavy_child(node))
+    dp_vector_free(node);
+}
+
+/* Number of edges from node to its children longer than minbr, and the sum
+   of their lengths if edgelen_sum is given */
+int dp_child_edges(rtree_t * node, double * edgelen_sum)
+{
+  int count = 0;
+  double sum = 0;
+
+  if (node->left->length > opt_minbr)
+  {
+    count++;
+    sum += node->left->length;
+  }
+  if (node->right->length > opt_minbr)
+  {
+    count++;
+    sum += node->right->length;
+  }
+
+  if (edgelen_sum)
+    *edgelen_sum = sum;
+
+  return count;
+}
 
-  if (node->left)  dp_recurse(node->left,  method);
-  if (node->right) dp_recurse(node->right, method);
+/* Log-likelihood blocks. The pairs of entries of the two children merged
+   into the entries of a node are collected in a block, and their
+   log-likelihoods are computed at once with the SIMD kernels. The exact DP,
+   the top-K enumeration (--ml_topk) and the beam (--beam) all merge through
+   a block */
+void dp_block_alloc(dp_block_t * block, long size)
+{
+  block->count = 0;
+  block->left = (int *)xmalloc((size_t)size * sizeof(int));
+  block->right = (int *)xmalloc((size_t)size * sizeof(int));
+  block->spec_edge_count = (int *)xmalloc((size_t)size * sizeof(int));
+  block->coal_edge_count = (int *)xmalloc((size_t)size * sizeof(int));
+  block->u_spec_edgelen_sum = (double *)xmalloc((size_t)size *
+                                                sizeof(double));
+  block->spec_edgelen_sum = (double *)xmalloc((size_t)size * sizeof(double));
+  block->coal_edgelen_sum = (double *)xmalloc((size_t)size * sizeof(double));
+  block->spec_logl = (double *)xmalloc((size_t)size * sizeof(double));
+  block->coal_logl = (double *)xmalloc((size_t)size * sizeof(double));
+}
+
+void dp_block_free(dp_block_t * block)
+{
+  free(block->left);
+  free(block->right);
+  free(block->spec_edge_count);
+  free(block->coal_edge_count);
+  free(block->u_spec_edgelen_sum);
+  free(block->spec_edgelen_sum);
+  free(block->coal_edgelen_sum);
+  free(block->spec_logl);
+  free(block->coal_logl);
+}
+
+/* Append the pair merging an entry of the left child with speciation edge
+   length sum v_spec_edgelen_sum and an entry of the right child with
+   w_spec_edgelen_sum into entry i of node. The caller identifies the two
+   child entries by 'left' and 'right', and u_edgelen_sum is the sum given
+   by dp_child_edges() */
+void dp_block_add(dp_block_t * block,
+                  rtree_t * node,
+                  int i,
+                  double u_edgelen_sum,
+                  double v_spec_edgelen_sum,
+                  double w_spec_edgelen_sum,
+                  int left,
+                  int right)
+{
+  long x = block->count++;
+
+  block->left[x] = left;
+  block->right[x] = right;
+
+  /* compute coalescent edge count and length sum of subtree u */
+  block->u_spec_edgelen_sum[x] = v_spec_edgelen_sum +
+                                 w_spec_edgelen_sum +
+                                 u_edgelen_sum;
+  block->coal_edge_count[x] = node->edge_count - i;
+  block->coal_edgelen_sum[x] = node->edgelen_sum -
+                               block->u_spec_edgelen_sum[x];
+
+  /* total speciation edge count and length sum */
+  block->spec_edge_count[x] = node->spec_edge_count + i;
+  block->spec_edgelen_sum[x] = node->spec_edgelen_sum +
+                               u_edgelen_sum +
+                               v_spec_edgelen_sum +
+                               w_spec_edgelen_sum;
+}
+
+/* Compute the speciation log-likelihoods of the pairs of the block, and the
+   single-rate coalescent ones if coal is set */
+void dp_block_logl(dp_block_t * block, int coal)
+{
+  loglikelihood_batch(block->spec_edge_count,
+                      block->spec_edgelen_sum,
+                      block->spec_logl,
+                      block->count);
+  if (coal)
+    loglikelihood_batch(block->coal_edge_count,
+                        block->coal_edgelen_sum,
+                        block->coal_logl,
+                        block->count);
+}
+
+/* Score of pair x of the block for method, given the multi-rate coalescent
+   log-likelihood of the merged entry. The single-rate score requires the
+   coalescent log-likelihoods of dp_block_logl() */
+double dp_block_score(dp_block_t * block,
+                      long x,
+                      long method,
+                      double coal_multi_logl)
+{
+  if (method == PTP_METHOD_SINGLE)
+    return block->coal_logl[x] + block->spec_logl[x];
+
+  return coal_multi_logl + block->spec_logl[x];
+}
+
+/* Error of the log-likelihood of edge_count edges whose length sum
+   edgelen_sum is off by error */
+static double dp_float_logl_error(long edge_count,
+                                  double edgelen_sum,
+                                  double error)
+{
+  if (!edge_count || !error) return 0;
+
+  if (edgelen_sum <= error) return __DBL_MAX__;
+
+  return edge_count * error / (edgelen_sum - error);
+}
+
+/* Rounding error of the score of a candidate for entry i of node with
+   speciation edge length sum u_spec_edgelen_sum, given the errors of the
+   length sum and of the multi-rate coalescent log-likelihood it was computed
+   from (--dp_float) */
+static double dp_float_error(rtree_t * node,
+                             long method,
+                             long i,
+                             double u_spec_edgelen_sum,
+                             double spec_error,
+                             double coal_error)
+{
+  double error = dp_float_logl_error(node->spec_edge_count + i,
+                                     node->spec_edgelen_sum +
+                                     u_spec_edgelen_sum,
+                                     spec_error);
+
+  if (method == PTP_METHOD_SINGLE)
+    return error + dp_float_logl_error(node->edge_count - i,
+                                       node->edgelen_sum - u_spec_edgelen_sum,
+                                       spec_error);
+
+  return error + coal_error;
+}
+
+/* Estimate the rounding errors of the entries of the single precision
+   vector of node from those of its children. Every entry is rounded to half
+   a unit in the last place when it is stored, on top of the errors of the
+   two child entries it sums. The roundings are independent, hence their
+   errors add in quadrature */
+static void dp_float_errors(rtree_t * node)
+{
+  node->float_spec_error = 0;
+  node->float_coal_max = fabs(node->coal_logl);
+  node->float_coal_error = 0.5 * FLT_EPSILON * node->float_coal_max;
+
+  if (!node->left ||
+      (node->constraint & (CONSTRAINT_COALESCENT | CONSTRAINT_JOIN)))
+    return;
+
+  double coal_max = node->left->float_coal_max + node->right->float_coal_max;
+  double coal_error = hypot(hypot(node->left->float_coal_error,
+                                  node->right->float_coal_error),
+                            0.5 * FLT_EPSILON * coal_max);
+
+  node->float_spec_error = hypot(hypot(node->left->float_spec_error,
+                                       node->right->float_spec_error),
+                                 0.5 * FLT_EPSILON * node->edgelen_sum);
+  if (coal_error > node->float_coal_error)
+    node->float_coal_error = coal_error;
+  if (coal_max > node->float_coal_max)
+    node->float_coal_max = coal_max;
+}
+
+/* Fill the vector of node holding the optimal entries for method from the
+   respective vectors of its children */
+static void dp_merge_state(rtree_t * node, long method)
+{
+  int i,k,j;
 
   /*                u_vec
                 *
@@ -39,250 +619,942 @@ static void dp_recurse(rtree_t * node, long method)
               /   \
      v_vec   *     *  w_vec    */
 
-  dp_vector_t * u_vec = node->vector;
+  dp_vector_t * u_vec = dp_state(node, method);
+
+  /* best score of each entry of u for the selected method. Only the root
+     keeps both scores, the other nodes use a scratch array */
+  long width = dp_width(node);
+  double * best = (double *)xmalloc((size_t)width * sizeof(double));
+
+  /* in single precision, the tolerated error of the best score of each
+     entry, i.e. DP_FLOAT_TOLERANCE times its estimated rounding error, and
+     the highest score plus tolerated error of the candidates it beat */
+  double * best_error = NULL;
+  double * rival = NULL;
+  if (u_vec->unresolved)
+  {
+    best_error = (double *)xmalloc((size_t)(2*width) * sizeof(double));
+    rival = best_error + width;
+    for (i = 0; i < width; ++i)
+      rival[i] = -__DBL_MAX__;
+  }
 
   double spec_logl = loglikelihood(node->spec_edge_count,
                                    node->spec_edgelen_sum);
 
-  u_vec[0].spec_edgelen_sum = 0;
-  u_vec[0].score_multi = node->coal_logl + spec_logl;
-  u_vec[0].score_single = node->coal_logl + spec_logl;
-  u_vec[0].coal_multi_logl = node->coal_logl;
-  u_vec[0].species_count = 1;
-  u_vec[0].filled = 1;
+  /* entry 0 starts as the whole subtree being one coalescent, unless the
+     species bounds or the constraints rule it out */
+  int coal_feasible = dp_species_feasible(node, 1) &&
+                      !(node->constraint & CONSTRAINT_SPLIT);
+
+  /* the multi-rate score is computed from the stored coalescent
+     log-likelihood, as the scores of the merged entries, such that a merged
+     entry with the same edges ties with it also in single precision */
+  dp_vec_set(u_vec, 0, 0, node->coal_logl);
+  dp_vec_set_index(u_vec, 0, -1, 1);
+  double coal_multi_score = dp_vec_coal(u_vec, 0) + spec_logl;
+  double coal_single_score = node->coal_logl + spec_logl;
+  if (!coal_feasible)
+    best[0] = -__DBL_MAX__;
+  else if (method == PTP_METHOD_SINGLE)
+    best[0] = coal_single_score;
+  else
+    best[0] = coal_multi_score;
+  if (u_vec->unresolved)
+  {
+    best_error[0] = 0;
+    if (method == PTP_METHOD_MULTI)
+      best_error[0] = DP_FLOAT_TOLERANCE * 0.5 * FLT_EPSILON *
+                      fabs(node->coal_logl);
+    u_vec->unresolved[0] = 0;
+  }
+  if (u_vec->score_multi)
+  {
+    u_vec->score_multi[0] = coal_multi_score;
+    u_vec->score_single[0] = coal_single_score;
+  }
 
-  if (!node->left) return;
+  node->filled_list[0] = 0;
+  node->filled_count = coal_feasible;
+
+  /* a node constrained to be within one species only has entry 0 */
+  if (!node->left ||
+      (node->constraint & (CONSTRAINT_COALESCENT | CONSTRAINT_JOIN)))
+  {
+    free(best_error);
+    free(best);
+    return;
+  }
 
-  dp_vector_t * v_vec = node->left->vector;
-  dp_vector_t * w_vec = node->right->vector;
+  dp_vector_t * v_vec = dp_state(node->left, method);
+  dp_vector_t * w_vec = dp_state(node->right, method);
 
   assert(node->spec_edge_count >= 0);
 
-  int u_edge_count = 0;
-  double u_edgelen_sum = 0;
-
   /* check whether edges (u,v) and (u,w) are > min branch length */
-  if (node->left->length > opt_minbr)
-  {
-    u_edge_count++;
-    u_edgelen_sum += node->left->length;
-  }
-  if (node->right->length > opt_minbr)
+  double u_edgelen_sum;
+  int u_edge_count = dp_child_edges(node, &u_edgelen_sum);
+
+  /* the single-rate coalescent log-likelihoods are needed for the root
+     scores of both methods */
+  int coal = (method == PTP_METHOD_SINGLE || u_vec->score_multi);
+
+  double spec_error = hypot(node->left->float_spec_error,
+                            node->right->float_spec_error);
+  double coal_error = hypot(node->left->float_coal_error,
+                            node->right->float_coal_error);
+
+  /* For a fixed j, the entries i = j + k + u_edge_count are distinct for
+     every k, so the log-likelihoods of all filled k can be computed as one
+     block with the SIMD kernels before the scores are compared */
+  dp_block_t block;
+  dp_block_alloc(&block, node->right->edge_count + 1);
+
+  /* visit only pairs of filled entries of the two children */
+  int jx, kx;
+  for (jx = 0; jx < node->left->filled_count; ++jx)
   {
-    u_edge_count++;
-    u_edgelen_sum += node->right->length;
-  }
+    j = node->left->filled_list[jx];
 
-  for (j = 0; j <= node->left->edge_count; ++j)
-  {
-    for (k = 0; k <= node->right->edge_count; ++k)
+    double v_spec_edgelen_sum = dp_vec_spec(v_vec, j);
+
+    block.count = 0;
+    for (kx = 0; kx < node->right->filled_count; ++kx)
     {
-      /* if at least one of the two entries is not valid/filled, skip */
-      if (!v_vec[j].filled || !w_vec[k].filled) continue;
+      k = node->right->filled_list[kx];
 
       int i = j + k + u_edge_count;
 
-      /* set the number of species */
-      unsigned int species_count = v_vec[j].species_count +
-                                   w_vec[k].species_count;
+      /* entries beyond the width exceed --max_species, and the filled lists
+         are sorted */
+      if (i >= width) break;
+
+      dp_block_add(&block,
+                   node,
+                   i,
+                   u_edgelen_sum,
+                   v_spec_edgelen_sum,
+                   dp_vec_spec(w_vec, k),
+                   j,
+                   k);
+    }
 
-      /* compute multi-rate coalescent log-likelihood */
-      double coal_multi_logl = v_vec[j].coal_multi_logl +
-                               w_vec[k].coal_multi_logl;
+    /* compute single-rate coalescent and speciation log-likelihoods */
+    dp_block_logl(&block, coal);
 
-      /* compute coalescent edge count and length sum of subtree u */
-      double u_spec_edgelen_sum = v_vec[j].spec_edgelen_sum +
-                                  w_vec[k].spec_edgelen_sum +
-                                  u_edgelen_sum;
-      int coal_edge_count = node->edge_count - i;            /* change to int */
-      double coal_edgelen_sum = node->edgelen_sum - u_spec_edgelen_sum;
+    long x;
+    for (x = 0; x < block.count; ++x)
+    {
+      k = block.right[x];
 
+      int i = j + k + u_edge_count;
 
-      /* compute single-rate coalescent log-likelihood */
-      double coal_single_logl = loglikelihood(coal_edge_count,coal_edgelen_sum);
+      /* set the number of species */
+      unsigned int species_count = dp_vec_species_count(v_vec, j) +
+                                   dp_vec_species_count(w_vec, k);
+      assert(species_count > 0);
 
-      /* compute total speciation log-likelihood */
-      double spec_edgelen_sum = node->spec_edgelen_sum +
-                                u_edgelen_sum +
-                                v_vec[j].spec_edgelen_sum +
-                                w_vec[k].spec_edgelen_sum;
+      if (!dp_species_feasible(node, species_count)) continue;
 
-      int spec_edge_count  = node->spec_edge_count + i;
-      assert(species_count > 0);
-      spec_logl = loglikelihood(spec_edge_count,spec_edgelen_sum);
+      /* compute multi-rate coalescent log-likelihood */
+      double coal_multi_logl = dp_vec_coal(v_vec, j) + dp_vec_coal(w_vec, k);
 
+      double score = dp_block_score(&block, x, method, coal_multi_logl);
 
-      /* compute single- and multi-rate scores */
-      double score_multi = coal_multi_logl + spec_logl;
-      double score_single = coal_single_logl + spec_logl;
-      double score = score_multi;
-      double best_score = u_vec[i].score_multi;
+      /* entry 0 is filled by the coalescent unless it is ruled out, any
+         other entry once it has a back-tracking index */
+      int filled = i ? dp_vec_left_index(u_vec, i) != -1 :
+                       (coal_feasible || dp_vec_left_index(u_vec, 0) != -1);
 
-      if (method == PTP_METHOD_SINGLE)
+      /* in single precision, keep the closest of the beaten candidates.
+         Equal scores stem from the same edges and keep the first candidate
+         in both precisions */
+      double error = 0;
+      if (u_vec->unresolved)
       {
-        score = score_single;
-        best_score = u_vec[i].score_single;
+        error = DP_FLOAT_TOLERANCE * dp_float_error(node,
+                                                    method,
+                                                    i,
+                                                    block.u_spec_edgelen_sum[x],
+                                                    spec_error,
+                                                    coal_error);
+        if (filled && score > best[i] && best[i] + best_error[i] > rival[i])
+          rival[i] = best[i] + best_error[i];
+        else if (filled && score < best[i] && score + error > rival[i])
+          rival[i] = score + error;
       }
 
-      if (!u_vec[i].filled || score > best_score)
+      if (!filled || score > best[i])
       {
-        u_vec[i].score_multi = score_multi;
-        u_vec[i].score_single = score_single;
-        u_vec[i].spec_edgelen_sum = u_spec_edgelen_sum;
-        u_vec[i].coal_multi_logl = coal_multi_logl;
-        u_vec[i].vec_left = j;
-        u_vec[i].vec_right = k;
-        u_vec[i].species_count = species_count;
-        u_vec[i].filled = 1;
+        best[i] = score;
+        if (u_vec->unresolved)
+          best_error[i] = error;
+        if (u_vec->score_multi)
+        {
+          u_vec->score_multi[i] = dp_block_score(&block,
+                                                 x,
+                                                 PTP_METHOD_MULTI,
+                                                 coal_multi_logl);
+          u_vec->score_single[i] = dp_block_score(&block,
+                                                  x,
+                                                  PTP_METHOD_SINGLE,
+                                                  coal_multi_logl);
+        }
+        dp_vec_set(u_vec, i, block.u_spec_edgelen_sum[x], coal_multi_logl);
+        dp_vec_set_index(u_vec, i, j, species_count);
       }
+    }
+  }
+
+  /* record the filled entries of u */
+  node->filled_count = 0;
+  for (i = 0; i < width; ++i)
+    if ((!i && coal_feasible) || dp_vec_left_index(u_vec, i) != -1)
+      node->filled_list[node->filled_count++] = i;
+
+  /* an entry is unresolved if its best candidate does not win by more than
+     the tolerated errors, or if one of the two child entries it was built
+     from is unresolved */
+  if (u_vec->unresolved)
+  {
+    for (jx = 0; jx < node->filled_count; ++jx)
+    {
+      i = node->filled_list[jx];
+      j = dp_vec_left_index(u_vec, i);
+
+      u_vec->unresolved[i] = best[i] - best_error[i] <= rival[i];
+      if (j != -1)
+        u_vec->unresolved[i] |= v_vec->unresolved[j] |
+                                w_vec->unresolved[i - j - u_edge_count];
+    }
+  }
+
+  dp_block_free(&block);
+  free(best_error);
+  free(best);
+}
+
+static void dp_merge(rtree_t * node, long method)
+{
+  /* subtrees within a constrained species are not filled */
+  if (node->constraint & CONSTRAINT_INSIDE) return;
+
+  /* in low-memory mode the vector is allocated when the node is merged */
+  if (!dp_vec_allocated(&node->vector))
+    dp_vector_alloc(node);
+
+  if (!node->vector.spec_edgelen_sum)
+    dp_float_errors(node);
+
+  /* the entries filled are the same for both methods, only their optimal
+     back-tracking choices differ */
+  if (dp_dual())
+  {
+    dp_merge_state(node, PTP_METHOD_SINGLE);
+    method = PTP_METHOD_MULTI;
+  }
+
+  dp_merge_state(node, method);
+}
+
+static void dp_recurse(rtree_t * node, long method)
+{
+  int i;
+  int count;
+
+  /* bottom-up traversal */
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*node->leaves - 1) *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(node, postorder);
+
+  for (i = 0; i < count; ++i)
+  {
+    dp_merge(postorder[i], method);
+
+    if (opt_lowmem)
+      dp_discard_children(postorder[i]);
+  }
+
+  free(postorder);
+}
+
+/* Parallel DP fill. Subtrees with fewer than 'cutoff' tips are filled
+   serially as one task. Every larger node waits for its two children and
+   is merged by the worker that completes the last of them, so the result
+   of each merge is identical to the serial recursion. */
+
+static void dp_parallel_count(rtree_t * node,
+                              long cutoff,
+                              long * task_count,
+                              long * serial_count)
+{
+  long top = 0;
+
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(node->leaves + 1) *
+                                         sizeof(rtree_t *));
+
+  stack[top++] = node;
+  while (top)
+  {
+    rtree_t * x = stack[--top];
+
+    if (x->leaves < cutoff)
+    {
+      *serial_count = *serial_count + 1;
+      continue;
+    }
+
+    *task_count = *task_count + 1;
+
+    stack[top++] = x->right;
+    stack[top++] = x->left;
+  }
+
+  free(stack);
+}
 
+static void dp_parallel_build(dp_parallel_t * ctx,
+                              rtree_t * node,
+                              long cutoff)
+{
+  long top = 0;
+
+  /* explicit stack of nodes and the tasks of their parents */
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(node->leaves + 1) *
+                                         sizeof(rtree_t *));
+  dp_task_t ** parents = (dp_task_t **)xmalloc((size_t)(node->leaves + 1) *
+                                               sizeof(dp_task_t *));
+
+  stack[top] = node; parents[top++] = NULL;
+  while (top)
+  {
+    rtree_t * x = stack[--top];
+    dp_task_t * parent = parents[top];
+
+    if (x->leaves < cutoff)
+    {
+      dp_serial_t * serial = ctx->serial + ctx->serial_count++;
+      serial->ctx = ctx;
+      serial->node = x;
+      serial->parent = parent;
+      continue;
     }
+
+    dp_task_t * task = ctx->tasks + ctx->task_count++;
+    task->node = x;
+    task->pending = 2;
+    task->parent = parent;
+
+    stack[top] = x->right; parents[top++] = task;
+    stack[top] = x->left;  parents[top++] = task;
+  }
+
+  free(parents);
+  free(stack);
+}
+
+static void dp_parallel_complete(dp_parallel_t * ctx, dp_task_t * task)
+{
+  /* the worker that finishes the last child of a node merges it, and
+     continues upwards as long as it completes further nodes */
+  while (task && __sync_sub_and_fetch(&task->pending, 1) == 0)
+  {
+    dp_merge(task->node, ctx->method);
+    if (opt_lowmem)
+      dp_discard_children(task->node);
+    task = task->parent;
+  }
+}
+
+static void cb_dp_serial(void * data, long worker)
+{
+  dp_serial_t * serial = (dp_serial_t *)data;
+
+  dp_tree_leaves = serial->ctx->tree_leaves;
+  dp_root_split = serial->ctx->root_split;
+
+  dp_recurse(serial->node, serial->ctx->method);
+  dp_parallel_complete(serial->ctx, serial->parent);
+}
+
+static void dp_recurse_parallel(rtree_t * tree, long method, long threads)
+{
+  long i;
+  long task_count = 0;
+  long serial_count = 0;
+  dp_parallel_t ctx;
+
+  /* aim for enough tasks to keep all threads busy, but never split clades
+     that are too small to be worth scheduling */
+  long cutoff = MAX(DP_TASK_MINLEAVES, tree->leaves / (16*threads));
+
+  dp_parallel_count(tree, cutoff, &task_count, &serial_count);
+
+  ctx.method = method;
+  ctx.tree_leaves = dp_tree_leaves;
+  ctx.root_split = dp_root_split;
+  ctx.tasks = (dp_task_t *)xmalloc((size_t)task_count * sizeof(dp_task_t));
+  ctx.serial = (dp_serial_t *)xmalloc((size_t)serial_count *
+                                      sizeof(dp_serial_t));
+  ctx.task_count = 0;
+  ctx.serial_count = 0;
+
+  dp_parallel_build(&ctx, tree, cutoff);
+
+  threadpool_t * pool = threadpool_create(threads);
+  for (i = 0; i < serial_count; ++i)
+    threadpool_submit(pool, -1, cb_dp_serial, ctx.serial + i);
+  threadpool_destroy(pool);
+
+  free(ctx.serial);
+  free(ctx.tasks);
+}
+
+/* Fill the DP table of tree with the given number of threads */
+void dp_fill_threads(rtree_t * tree, long method, long threads)
+{
+  if (threads > 1 && tree->leaves >= 2*DP_TASK_MINLEAVES)
+    dp_recurse_parallel(tree, method, threads);
+  else
+    dp_recurse(tree, method);
+}
+
+void dp_fill(rtree_t * tree, long method)
+{
+  dp_fill_threads(tree, method, opt_threads);
+}
+
+/* Count the filled and allocated DP entries of the subtree rooted at node,
+   and the entry pairs visited when merging children against the pairs a
+   dense merge would visit */
+void dp_fill_stats(rtree_t * node,
+                   long * filled,
+                   long * entries,
+                   long * visited,
+                   long * pairs)
+{
+  int i;
+  int count;
+
+  rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2*node->leaves - 1) *
+                                            sizeof(rtree_t *));
+  count = rtree_preorder(node, preorder);
+
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = preorder[i];
+
+    *filled = *filled + x->filled_count;
+    *entries = *entries + dp_width(x);
+
+    if (!x->left) continue;
+
+    *visited = *visited + (long)x->left->filled_count *
+                          x->right->filled_count;
+    *pairs = *pairs + dp_width(x->left) * dp_width(x->right);
   }
+
+  free(preorder);
+}
+
+/* Return the index of the entry of the left child of node from which entry
+   'index' of node was computed, -1 if the entry is the start of a
+   coalescent or not filled */
+int dp_vec_left(rtree_t * node, int index, long method)
+{
+  return dp_vec_left_index(dp_state(node, method), index);
+}
+
+/* Return the number of species of entry 'index' of node */
+unsigned int dp_vec_species(rtree_t * node, int index, long method)
+{
+  return dp_vec_species_count(dp_state(node, method), index);
+}
+
+/* Return the index of the entry of the right child of node from which entry
+   'index' of node was computed. Only the left index is stored, the right one
+   follows from index = left + right + number of child edges > minbr */
+int dp_vec_right(rtree_t * node, int index, long method)
+{
+  return index - dp_vec_left(node, index, method) -
+         dp_child_edges(node, NULL);
 }
 
+/* Back-track the DP table from entry 'index' of node, mark the events of
+   the visited nodes and collect the coalescent roots in preorder */
 static void backtrack(rtree_t * node,
                       int index,
+                      long method,
                       bool *warning_minbr,
-                      FILE * out)
+                      rtree_t ** croots,
+                      long * croots_count)
 
 {
-  dp_vector_t * vec = node->vector;
+  long top = 0;
 
-  if ((vec[index].vec_left != -1) && (vec[index].vec_right != -1))
+  /* explicit stack of nodes with the entry to back-track from */
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(node->leaves + 1) *
+                                         sizeof(rtree_t *));
+  int * indices = (int *)xmalloc((size_t)(node->leaves + 1) * sizeof(int));
+
+  stack[top] = node; indices[top++] = index;
+  while (top)
   {
-    node->event = EVENT_SPECIATION;
+    rtree_t * x = stack[--top];
+    int i = indices[top];
+
+    dp_vector_restore(x, method);
+    dp_vector_t * vec = dp_state(x, method);
+
+    if (dp_vec_left_index(vec, i) != -1)
+    {
+      x->event = EVENT_SPECIATION;
+
+      if (x->length <= opt_minbr && x->parent) *warning_minbr = true;
 
-    if (node->length <= opt_minbr && node->parent) *warning_minbr = true;
+      stack[top] = x->right; indices[top++] = dp_vec_right(x,i,method);
+      stack[top] = x->left;  indices[top++] = dp_vec_left_index(vec, i);
+    }
+    else
+    {
+      x->event = EVENT_COALESCENT;
+      croots[*croots_count] = x;
+      *croots_count = *croots_count + 1;
+    }
+
+    dp_vector_release(x);
+  }
+
+  free(indices);
+  free(stack);
+}
+
+/* Return the entry of the filled root DP table with the ML delimitation and
+   store its log-likelihood in logl. The multi-rate method selects the entry
+   with the lowest AIC score */
+static int dp_best_entry(rtree_t * tree, long method, double * logl)
+{
+  int i,x;
+  int best_index;
+  double max;
+
+  dp_species_check(tree->filled_count);
+
+  /* the first filled entry is the default, the remaining ones are
+     considered below edge_count */
+  dp_vector_t * vec = dp_state(tree, method);
+  best_index = tree->filled_list[0];
+  if (method == PTP_METHOD_MULTI)
+  {
+    double min_aic_score = aic(vec->score_multi[best_index],
+                               dp_vec_species_count(vec, best_index),
+                               tree->leaves+2);
+    for (x = 1; x < tree->filled_count; x++)
+    {
+      i = tree->filled_list[x];
+      if (i >= tree->edge_count) break;
 
-    backtrack(node->left, vec[index].vec_left, warning_minbr, out);
-    backtrack(node->right,vec[index].vec_right,warning_minbr, out);
+      double aic_score = aic(vec->score_multi[i], dp_vec_species_count(vec, i), tree->leaves+2);
+      //printf("edges: %d logl: %f aic: %f species: %d\n", i, vec->score_multi[i], aic_score, dp_vec_species_count(vec, i));
+      if (aic_score < min_aic_score)
+      {
+        min_aic_score = aic_score;
+        best_index = i;
+      }
+    }
+    max = vec->score_multi[best_index];
   }
   else
   {
-    species_iter++;
-    node->event = EVENT_COALESCENT;
+    max = vec->score_single[best_index];
+    for (x = 1; x < tree->filled_count; x++)
+    {
+      i = tree->filled_list[x];
+      if (i >= tree->edge_count) break;
+
+      if (max < vec->score_single[i])
+      {
+        max = vec->score_single[i];
+        best_index = i;
+      }
+    }
+  }
+
+  *logl = max;
+  return best_index;
+}
+
+/* Test the back-tracked delimitation with log-likelihood logl against the
+   null model */
+static int dp_lrt(rtree_t * tree,
+                  long method,
+                  double logl,
+                  rtree_t ** croots,
+                  long croots_count,
+                  double * pvalue)
+{
+  long i;
+
+  /* number of coalescent roots with at least one edge > minbr in their
+     subtree, i.e. the number of coalescent population parameters */
+  unsigned int coal_param_count = 0;
+  for (i = 0; i < croots_count; ++i)
+    if (croots[i]->edge_count)
+      coal_param_count++;
+
+  unsigned int df = (method == PTP_METHOD_SINGLE) ? 1 : coal_param_count;
+  return lrt(tree->coal_logl,logl,df,pvalue);
+}
+
+/* Back-track the ML delimitation from the filled DP table of tree without
+   testing it against the null model. Stores its log-likelihood in logl and
+   the roots of its species in croots, which must hold tree->leaves nodes,
+   and returns their number */
+long dp_ml_croots(rtree_t * tree,
+                  long method,
+                  double * logl,
+                  bool * warning_minbr,
+                  rtree_t ** croots)
+{
+  long croots_count = 0;
+
+  int best_index = dp_best_entry(tree, method, logl);
+
+  backtrack(tree, best_index, method, warning_minbr, croots, &croots_count);
 
-    fprintf(out, "\nSpecies %d:\n", species_iter);
-    rtree_print_tips(node,out);
+  return croots_count;
+}
+
+/* Compute the ML delimitation from the filled DP table of tree without
+   writing it. Stores its log-likelihood, the LRT p-value and result, and the
+   roots of the delimited species in croots, which must hold tree->leaves
+   nodes. If the LRT fails the species is the null model, i.e. the root.
+   Returns the number of delimited species */
+long dp_ptp_croots(rtree_t * tree,
+                   long method,
+                   double * logl,
+                   double * pvalue,
+                   int * lrt_pass,
+                   rtree_t ** croots)
+{
+  bool warning_minbr = false;
+
+  long croots_count = dp_ml_croots(tree, method, logl, &warning_minbr, croots);
+
+  *pvalue = -1;
+  *lrt_pass = dp_lrt(tree, method, *logl, croots, croots_count, pvalue);
+
+  if (*lrt_pass || !dp_null_allowed())
+    return croots_count;
+
+  croots[0] = tree;
+  return 1;
+}
+
+/* As dp_ptp_croots() without keeping the species roots */
+long dp_ptp_summary(rtree_t * tree,
+                    long method,
+                    double * logl,
+                    double * pvalue,
+                    int * lrt_pass)
+{
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                          sizeof(rtree_t *));
+
+  long species = dp_ptp_croots(tree, method, logl, pvalue, lrt_pass, croots);
+
+  free(croots);
+
+  return species;
+}
+
+/* Return the AIC score of the ML delimitation in the filled DP table of
+   tree */
+double dp_ml_aic(rtree_t * tree, long method)
+{
+  double logl;
+
+  int best_index = dp_best_entry(tree, method, &logl);
+
+  return aic(logl,
+             dp_vec_species(tree, best_index, method),
+             tree->leaves+2);
+}
+
+/* Exact log-likelihood of the delimitation with the given coalescent roots,
+   computed in double precision from the per-node statistics */
+static double dp_rescore(rtree_t * tree,
+                         long method,
+                         rtree_t ** croots,
+                         long croots_count)
+{
+  long i;
+  long coal_edge_count = 0;
+  double coal_edgelen_sum = 0;
+  double coal_multi_logl = 0;
+
+  for (i = 0; i < croots_count; ++i)
+  {
+    coal_edge_count += croots[i]->edge_count;
+    coal_edgelen_sum += croots[i]->edgelen_sum;
+    coal_multi_logl += croots[i]->coal_logl;
   }
+
+  double spec_logl = loglikelihood(tree->edge_count - coal_edge_count,
+                                   tree->edgelen_sum - coal_edgelen_sum);
+
+  if (method == PTP_METHOD_SINGLE)
+    return loglikelihood(coal_edge_count, coal_edgelen_sum) + spec_logl;
+
+  return coal_multi_logl + spec_logl;
 }
 
-long multi_coalpopedgecount(rtree_t * node)
+/* Criterion by which dp_best_entry() selects the root entry with the given
+   log-likelihood and number of species, lower is better */
+static double dp_entry_key(rtree_t * tree,
+                           long method,
+                           double logl,
+                           unsigned int species_count)
 {
-  long edges = 0;
+  if (method == PTP_METHOD_SINGLE)
+    return -logl;
+
+  return aic(logl, species_count, tree->leaves+2);
+}
+
+/* Verify a DP table filled with single precision entries (--dp_float). The
+   root entries considered by dp_best_entry() whose scores are within the
+   tolerated rounding errors of the best one are back-tracked, and their
+   species are recounted and their scores recomputed in double precision,
+   replacing the root scores. The table is accepted if none of them is
+   unresolved (see dp_merge_state) and the best of them then wins against
+   every other entry by more than the tolerated errors, otherwise the caller
+   must refill it in double precision */
+int dp_float_verify(rtree_t * tree, long method)
+{
+  int x;
+  long i;
+  long count = 0;
+  bool warning_minbr = false;
+
+  if (!tree->filled_count) return 1;
+
+  dp_vector_t * vec = dp_state(tree, method);
+  double * score = (method == PTP_METHOD_SINGLE) ?
+                   vec->score_single : vec->score_multi;
 
-  if (node->left)
+  for (x = 0; x < tree->filled_count; ++x)
+    if (!x || tree->filled_list[x] < tree->edge_count)
+      count++;
+
+  /* keys of the considered entries and their tolerated errors, twice those
+     of the log-likelihoods for the AIC scores */
+  double * key = (double *)xmalloc((size_t)count * sizeof(double));
+  double * error = (double *)xmalloc((size_t)count * sizeof(double));
+  double scale = (method == PTP_METHOD_SINGLE) ? 1 : 2;
+
+  long best = 0;
+  for (x = 0; x < count; ++x)
   {
-    if (node->left->length > opt_minbr)
-      ++edges;
-    edges += multi_coalpopedgecount(node->left);
+    int k = tree->filled_list[x];
+
+    key[x] = dp_entry_key(tree,
+                          method,
+                          score[k],
+                          dp_vec_species_count(vec, k));
+    if (dp_vec_left_index(vec, k) == -1)
+      error[x] = (method == PTP_METHOD_SINGLE) ?
+                 0 : 0.5 * FLT_EPSILON * fabs(tree->coal_logl);
+    else
+      error[x] = dp_float_error(tree,
+                                method,
+                                k,
+                                dp_vec_spec(vec, k),
+                                tree->float_spec_error,
+                                tree->float_coal_error);
+    error[x] *= DP_FLOAT_TOLERANCE * scale;
+
+    if (key[x] < key[best])
+      best = x;
   }
-  if (node->right)
+
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                          sizeof(rtree_t *));
+
+  /* rescore the candidates for the best entry */
+  int resolved = 1;
+  double best_key = key[best];
+  double best_error = error[best];
+  for (x = 0; x < count; ++x)
+  {
+    int k = tree->filled_list[x];
+    long croots_count = 0;
+
+    if (key[x] - error[x] > best_key + best_error) continue;
+
+    if (vec->unresolved[k])
+    {
+      resolved = 0;
+      break;
+    }
+
+    backtrack(tree, k, method, &warning_minbr, croots, &croots_count);
+
+    if ((unsigned int)croots_count != dp_vec_species_count(vec, k))
+      resolved = 0;
+
+    score[k] = dp_rescore(tree, method, croots, croots_count);
+    key[x] = dp_entry_key(tree, method, score[k], (unsigned int)croots_count);
+    error[x] = DP_FLOAT_TOLERANCE * DBL_EPSILON * tree->edge_count *
+               fabs(key[x]);
+
+    /* the back-tracking only marks coalescent roots on top of the defaults */
+    for (i = 0; i < croots_count; ++i)
+      croots[i]->event = EVENT_SPECIATION;
+  }
+
+  free(croots);
+
+  /* the first of the best entries, as selected by dp_best_entry(), and its
+     closest rival */
+  best = 0;
+  for (x = 1; x < count; ++x)
+    if (key[x] < key[best])
+      best = x;
+
+  double gap = __DBL_MAX__;
+  double gap_error = 0;
+  for (x = 0; x < count; ++x)
   {
-    if (node->right->length > opt_minbr)
-      ++edges;
-    edges += multi_coalpopedgecount(node->right);
+    if (x == best) continue;
+
+    if (key[x] - error[x] < key[best] + gap - gap_error)
+    {
+      gap = key[x] - key[best];
+      gap_error = error[x] + error[best];
+    }
   }
 
-  return edges;
+  free(error);
+  free(key);
 
-}
-void multi_getcoalparamscount(rtree_t * node, int index)
-{
-  dp_vector_t * vec = node->vector;
+  int accept = resolved && gap > gap_error;
 
-  if ((vec[index].vec_left != -1) && (vec[index].vec_right != -1))
+  if (!opt_quiet)
   {
-    node->event = EVENT_SPECIATION;
-
-    multi_getcoalparamscount(node->left, vec[index].vec_left);
-    multi_getcoalparamscount(node->right,vec[index].vec_right);
+    if (!resolved)
+      fprintf(stdout,
+              "Single precision DP: best entries are not resolved -- "
+              "refilling in double precision\n");
+    else if (count > 1)
+      fprintf(stdout,
+              "Single precision DP: best entry wins by %.6f, tolerated "
+              "rounding error %.6f%s\n",
+              gap,
+              gap_error,
+              accept ? "" : " -- refilling in double precision");
   }
-  else
-  {
-    node->event = EVENT_COALESCENT;
 
-    long edges = multi_coalpopedgecount(node);
-    if (edges)
-      coal_param_count++; 
-  }
+  return accept;
 }
 
-void dp_ptp(rtree_t * tree, long method)
+/* Write the ML delimitations of both methods from a DP table filled for
+   both at once (report mode), each with the outcome of the LRT for every
+   p-value threshold in pvalues */
+void dp_ml_report(rtree_t * tree, double * pvalues, long pvalues_count)
 {
-  int i;
-  int lrt_pass;
-  int best_index = 0;
-  unsigned int species_count;
-  double max = 0;
-  double pvalue = -1;
+  long i,j;
+  long m;
+  bool warning_minbr = false;
+  const long methods[2] = { PTP_METHOD_SINGLE, PTP_METHOD_MULTI };
 
+  assert(dp_dual());
 
-  /* reset species counter */
-  species_iter = 0;
+  FILE * out = open_file_ext("txt", opt_seed);
 
-  /* fill DP table */
-  dp_recurse(tree, method);
+  if (!opt_quiet)
+    fprintf(stdout, "Writing delimitation report %s.txt ...\n", opt_outfile);
 
-  /* obtain best entry in the root DP table */
-  dp_vector_t * vec = tree->vector;
-  if (method == PTP_METHOD_MULTI)
-  {
-    double min_aic_score = aic(vec[0].score_multi, vec[0].species_count, tree->leaves+2);
-    for (i = 1; i < tree->edge_count; i++)
-    {
-      if (vec[i].filled)
-      {
-        double aic_score = aic(vec[i].score_multi, vec[i].species_count, tree->leaves+2);
-        //printf("edges: %d logl: %f aic: %f species: %d\n", i, vec[i].score_multi, aic_score, vec[i].species_count);
-        if (aic_score < min_aic_score)
-        {
-          min_aic_score = aic_score;
-          best_index = i;
-        }
-      }
-    }
-    max = vec[best_index].score_multi;
-  }
-  else
+  fprintf(out, "Command: %s\n", cmdline);
+  fprintf(out,
+          "Number of edges greater than minimum branch length: %d / %d\n",
+           tree->edge_count,
+           2 * tree->leaves - 2);
+  fprintf(out, "Null-model score: %.6f\n", tree->coal_logl);
+
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                          sizeof(rtree_t *));
+
+  for (m = 0; m < 2; ++m)
   {
-    max = vec[0].score_single;
-    for (i = 1; i < tree->edge_count; i++)
+    long method = methods[m];
+    long croots_count = 0;
+    double logl;
+    double pvalue = -1;
+    const char * name = (method == PTP_METHOD_SINGLE) ? "single" : "multi";
+
+    int best_index = dp_best_entry(tree, method, &logl);
+    backtrack(tree, best_index, method, &warning_minbr, croots, &croots_count);
+    dp_lrt(tree, method, logl, croots, croots_count, &pvalue);
+
+    fprintf(out, "\nBest score for %s coalescent rate: %.6f\n", name, logl);
+    fprintf(out, "LRT computed p-value: %.6f\n", pvalue);
+
+    if (!opt_quiet)
+      fprintf(stdout,
+              "Best score for %s coalescent rate: %.6f (p-value: %.6f, "
+              "%ld species)\n",
+              name,
+              logl,
+              pvalue,
+              croots_count);
+
+    /* the LRT passes for every threshold not below the p-value */
+    for (i = 0; i < pvalues_count; ++i)
+      fprintf(out,
+              "LRT with p-value threshold %g: %s (%ld species)\n",
+              pvalues[i],
+              pvalue <= pvalues[i] ? "passed" : "failed",
+              (pvalue <= pvalues[i] || !dp_null_allowed()) ?
+                croots_count : 1);
+
+    fprintf(out, "Number of species in %s-rate delimitation: %ld\n",
+            name, croots_count);
+    for (j = 0; j < croots_count; ++j)
     {
-      if (max < vec[i].score_single && vec[i].filled)
-      {
-        max = vec[i].score_single;
-        best_index = i;
-      }
+      fprintf(out, "\nSpecies %ld:\n", j+1);
+      rtree_print_tips(croots[j],out);
     }
   }
 
-  /* output some statistics */
-  if (!opt_quiet)
-  {
-    fprintf(stdout,
-           "Number of edges greater than minimum branch length: %d / %d\n",
-           tree->edge_count,
-           2 * tree->leaves - 2);
-    printf("Score Null Model: %.6f\n", tree->coal_logl);
-    if (method == PTP_METHOD_SINGLE)
-      fprintf(stdout, "Best score for single coalescent rate: %.6f\n",
-                      vec[best_index].score_single);
-    else
-      fprintf(stdout, "Best score for multi coalescent rate: %.6f\n",
-                      vec[best_index].score_multi);
-  }
+  if (warning_minbr)
+    fprintf(stderr,"WARNING: A speciation edge is smaller than the specified "
+                   "minimum branch length.\n");
+
+  free(croots);
+  fclose(out);
+}
 
-  /* do a Likelihood Ratio Test (lrt) and return the computed p-value */
-  species_count = vec[best_index].species_count;
+/* Test the back-tracked ML delimitation with log-likelihood max against the
+   null model, report it and write it to the output file. If the LRT fails,
+   the null-model is written instead unless the species bounds exclude it */
+void dp_ptp_write(rtree_t * tree,
+                  long method,
+                  double max,
+                  unsigned int species_count,
+                  rtree_t ** croots,
+                  long croots_count,
+                  bool warning_minbr)
+{
+  long i;
+  int lrt_pass;
+  double pvalue = -1;
 
-  /* fills the coal_param_count variable with # coalescent pop parameters */
-  coal_param_count = 0;
-  multi_getcoalparamscount(tree,best_index);
+  /* reset species counter */
+  species_iter = 0;
 
   /* likelihood ratio test */
-  unsigned int df = (method == PTP_METHOD_SINGLE) ? 1 : coal_param_count;
-  lrt_pass = lrt(tree->coal_logl,max,df,&pvalue);
+  lrt_pass = dp_lrt(tree, method, max, croots, croots_count, &pvalue);
 
   if (!opt_quiet)
     fprintf(stdout,"LRT computed p-value: %.6f\n", pvalue);
@@ -308,13 +1580,21 @@ void dp_ptp(rtree_t * tree, long method)
               tree,
               species_count);
 
-  /* if LRT passed, then back-track the DP table and print the delimitation,
-     otherwise print the null-model (one single species) */
+  /* if LRT passed, then print the back-tracked delimitation, otherwise print
+     the null-model (one single species) unless --min_species excludes it */
 
-  if (lrt_pass)
+  if (!lrt_pass && !dp_null_allowed())
+    fprintf(stdout, "LRT failed -- null-model is outside the species bounds "
+                    "or constraints, ML delimitation is printed\n");
+
+  if (lrt_pass || !dp_null_allowed())
   {
-    bool warning_minbr = false;
-    backtrack(tree, best_index, &warning_minbr,out);
+    for (i = 0; i < croots_count; ++i)
+    {
+      species_iter++;
+      fprintf(out, "\nSpecies %d:\n", species_iter);
+      rtree_print_tips(croots[i],out);
+    }
     if (warning_minbr)
       fprintf(stderr,"WARNING: A speciation edge is smaller than the specified "
                      "minimum branch length.\n");
@@ -337,68 +1617,580 @@ void dp_ptp(rtree_t * tree, long method)
   fclose(out);
 }
 
-void dp_init(rtree_t * tree)
+/* Select, report and write the ML delimitation from the DP table of tree,
+   which must have been filled with dp_fill() */
+void dp_ptp(rtree_t * tree, long method)
 {
-  int i;
+  int best_index = 0;
+  unsigned int species_count;
+  double max = 0;
 
-  if (tree->left)  dp_init(tree->left);
-  if (tree->right) dp_init(tree->right);
+  /* obtain best entry in the root DP table */
+  dp_vector_t * vec = dp_state(tree, method);
+  best_index = dp_best_entry(tree, method, &max);
 
-  // TODO: Check whether this is the best way to handle those
-  //   nasty zero-length edges.
+  /* output some statistics */
+  if (!opt_quiet)
+  {
+    fprintf(stdout,
+           "Number of edges greater than minimum branch length: %d / %d\n",
+           tree->edge_count,
+           2 * tree->leaves - 2);
+
+    long filled = 0;
+    long entries = 0;
+    long visited = 0;
+    long pairs = 0;
+    dp_fill_stats(tree, &filled, &entries, &visited, &pairs);
+    fprintf(stdout,
+            "Filled DP entries: %ld / %ld (%.2f%%)\n",
+            filled,
+            entries,
+            100.0 * filled / entries);
+    fprintf(stdout,
+            "Visited DP entry pairs: %ld / %ld (%.2f%%)\n",
+            visited,
+            pairs,
+            pairs ? 100.0 * visited / pairs : 100.0);
+
+    printf("Score Null Model: %.6f\n", tree->coal_logl);
+    if (method == PTP_METHOD_SINGLE)
+      fprintf(stdout, "Best score for single coalescent rate: %.6f\n",
+                      vec->score_single[best_index]);
+    else
+      fprintf(stdout, "Best score for multi coalescent rate: %.6f\n",
+                      vec->score_multi[best_index]);
+  }
+
+  species_count = dp_vec_species_count(vec, best_index);
+
+  /* back-track the best entry and collect the coalescent roots */
+  bool warning_minbr = false;
+  long croots_count = 0;
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                          sizeof(rtree_t *));
+  backtrack(tree, best_index, method, &warning_minbr, croots, &croots_count);
+
+  dp_ptp_write(tree,
+               method,
+               max,
+               species_count,
+               croots,
+               croots_count,
+               warning_minbr);
+
+  free(croots);
+}
+
+dp_arena_t * dp_arena_create()
+{
+  return (dp_arena_t *)xcalloc(1, sizeof(dp_arena_t));
+}
+
+static void dp_arena_release(dp_arena_t * arena)
+{
+  if (arena->spec_edgelen_sum) free(arena->spec_edgelen_sum);
+  if (arena->coal_multi_logl) free(arena->coal_multi_logl);
+  if (arena->spec_edgelen_sum_f) free(arena->spec_edgelen_sum_f);
+  if (arena->coal_multi_logl_f) free(arena->coal_multi_logl_f);
+  if (arena->unresolved) free(arena->unresolved);
+  if (arena->index) free(arena->index);
+  if (arena->filled) free(arena->filled);
+
+  arena->spec_edgelen_sum = NULL;
+  arena->coal_multi_logl = NULL;
+  arena->spec_edgelen_sum_f = NULL;
+  arena->coal_multi_logl_f = NULL;
+  arena->unresolved = NULL;
+  arena->index = NULL;
+  arena->filled = NULL;
+}
+
+void dp_arena_destroy(dp_arena_t * arena)
+{
+  dp_arena_release(arena);
+  if (arena->score_multi) free(arena->score_multi);
+  if (arena->score_single) free(arena->score_single);
+  free(arena);
+}
 
-  tree->vector = calloc((size_t)(tree->edge_count + 1), sizeof(dp_vector_t));
+static void dp_init_state(dp_vector_t * vec,
+                          dp_arena_t * arena,
+                          long offset,
+                          long index_offset,
+                          long n,
+                          int narrow)
+{
+  memset(vec, 0, sizeof(dp_vector_t));
 
-  for (i = 0; i <= tree->edge_count; i++)
+  if (opt_dp_float)
+  {
+    vec->spec_edgelen_sum_f = arena->spec_edgelen_sum_f + offset;
+    vec->coal_multi_logl_f = arena->coal_multi_logl_f + offset;
+    vec->unresolved = arena->unresolved + offset;
+  }
+  else
   {
-    tree->vector[i].vec_left  = -1;
-    tree->vector[i].vec_right = -1;
+    vec->spec_edgelen_sum = arena->spec_edgelen_sum + offset;
+    vec->coal_multi_logl = arena->coal_multi_logl + offset;
   }
+  dp_vec_index_init(vec, arena->index + index_offset, n, narrow);
+}
+
+static void dp_init_node(rtree_t * tree,
+                         dp_arena_t * arena,
+                         long * used,
+                         long * index_used)
+{
+  long n = dp_width(tree);
+  int narrow = dp_narrow(tree);
+  long index_size = n * dp_index_size(tree);
+
+  // TODO: Check whether this is the best way to handle those
+  //   nasty zero-length edges.
 
   assert(tree->edge_count >= 0);
 
   tree->coal_logl = loglikelihood(tree->edge_count,
                                   tree->edgelen_sum);
+
+  memset(&tree->vector_single, 0, sizeof(dp_vector_t));
+
+  /* in low-memory mode vectors are allocated when filling */
+  if (!arena)
+  {
+    memset(&tree->vector, 0, sizeof(dp_vector_t));
+    tree->filled_list = NULL;
+    tree->filled_count = 0;
+    return;
+  }
+
+  dp_init_state(&tree->vector, arena, *used, *index_used, n, narrow);
+  tree->filled_list = arena->filled + *used;
+  tree->filled_count = 0;
+  *used = *used + n;
+  *index_used = *index_used + index_size;
+
+  if (dp_dual())
+  {
+    dp_init_state(&tree->vector_single, arena, *used, *index_used, n, narrow);
+    *used = *used + n;
+    *index_used = *index_used + index_size;
+  }
+}
+
+/* Attach the score arrays of the root entries, which are kept in the arena
+   for every mode */
+static void dp_root_scores(rtree_t * tree, dp_arena_t * arena)
+{
+  long states = dp_dual() ? 2 : 1;
+  long root_size = dp_width(tree);
+
+  if (states * root_size > arena->score_alloc)
+  {
+    if (arena->score_multi) free(arena->score_multi);
+    if (arena->score_single) free(arena->score_single);
+
+    arena->score_alloc = states * root_size;
+    arena->score_multi = (double *)xmalloc((size_t)arena->score_alloc *
+                                           sizeof(double));
+    arena->score_single = (double *)xmalloc((size_t)arena->score_alloc *
+                                            sizeof(double));
+  }
+
+  /* scores are kept only for the root entries */
+  tree->vector.score_multi = arena->score_multi;
+  tree->vector.score_single = arena->score_single;
+  if (dp_dual())
+  {
+    tree->vector_single.score_multi = arena->score_multi + root_size;
+    tree->vector_single.score_single = arena->score_single + root_size;
+  }
+}
+
+/* Carve the DP vectors of all nodes out of one arena in postorder, such that
+   the vectors of the two children of a node precede the vector of the node.
+   The arena only grows, hence it can be reused for repeated DP fills. In
+   low-memory mode the arena only holds the root scores */
+void dp_init(rtree_t * tree, dp_arena_t * arena)
+{
+  int i;
+  int count;
+  long used = 0;
+  long index_used = 0;
+  long size = 0;
+  long index_size = 0;
+  long states = dp_dual() ? 2 : 1;
+
+  dp_bounds_init(tree);
+
+  loglikelihood_table_init(2*tree->leaves - 2);
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(tree, postorder);
+
+  if (!opt_lowmem)
+  {
+    for (i = 0; i < count; ++i)
+    {
+      size += states * dp_width(postorder[i]);
+      index_size += states * dp_width(postorder[i]) *
+                    dp_index_size(postorder[i]);
+    }
+  }
+
+  /* the arena is reallocated when the precision of the entries changes */
+  if (size > arena->alloc || index_size > arena->index_alloc ||
+      (opt_dp_float && size && !arena->spec_edgelen_sum_f) ||
+      (!opt_dp_float && size && !arena->spec_edgelen_sum))
+  {
+    dp_arena_release(arena);
+
+    arena->alloc = size;
+    arena->index_alloc = index_size;
+    if (opt_dp_float)
+    {
+      arena->spec_edgelen_sum_f = (float *)xmalloc((size_t)size *
+                                                   sizeof(float));
+      arena->coal_multi_logl_f = (float *)xmalloc((size_t)size *
+                                                  sizeof(float));
+      arena->unresolved = (unsigned char *)xmalloc((size_t)size);
+    }
+    else
+    {
+      arena->spec_edgelen_sum = (double *)xmalloc((size_t)size *
+                                                  sizeof(double));
+      arena->coal_multi_logl = (double *)xmalloc((size_t)size *
+                                                 sizeof(double));
+    }
+    arena->index = (char *)xmalloc((size_t)index_size);
+    arena->filled = (int *)xmalloc((size_t)size * sizeof(int));
+  }
+
+  for (i = 0; i < count; ++i)
+    dp_init_node(postorder[i], opt_lowmem ? NULL : arena, &used, &index_used);
+
+  if (opt_lowmem)
+    dp_mark_checkpoints(tree);
+
+  dp_root_scores(tree, arena);
+
+  free(postorder);
 }
 
 void dp_free(rtree_t * tree)
 {
-  if (tree->left)  dp_free(tree->left);
-  if (tree->right) dp_free(tree->right);
+  int i;
+  int count;
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(tree, postorder);
+
+  /* the DP vectors belong to the arena, just detach them from the tree */
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = postorder[i];
 
-  if (tree->vector) free(tree->vector);
+    if (opt_lowmem && dp_vec_allocated(&x->vector))
+      dp_vector_free(x);
+
+    memset(&x->vector, 0, sizeof(dp_vector_t));
+    memset(&x->vector_single, 0, sizeof(dp_vector_t));
+    x->filled_list = NULL;
+    x->filled_count = 0;
+  }
+
+  free(postorder);
 }
 
 void dp_set_pernode_spec_edges(rtree_t * node)
 {
+  int i;
+  int count;
+
   if (!node) return;
 
-  node->spec_edge_count = 0;
-  node->spec_edgelen_sum = 0;
+  /* parents are visited before their children */
+  rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2*node->leaves - 1) *
+                                            sizeof(rtree_t *));
+  count = rtree_preorder(node, preorder);
+
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = preorder[i];
+
+    x->spec_edge_count = 0;
+    x->spec_edgelen_sum = 0;
+
+    /* for each node set spec_edge_count (and spec_edgelen_sum) as the count
+       (or sum) of edges (edge-lengths) of all direct child edges of
+       nodes on the path to root excluding the current node */
+    if (x->parent)
+    {
+      x->spec_edge_count = x->parent->spec_edge_count;
+      x->spec_edgelen_sum = x->parent->spec_edgelen_sum;
+
+      double len = x->parent->left->length;
+      if (len > opt_minbr)
+      {
+        x->spec_edge_count++;
+        x->spec_edgelen_sum += len;
+      }
+
+      len = x->parent->right->length;
+      if (len > opt_minbr)
+      {
+        x->spec_edge_count++;
+        x->spec_edgelen_sum += len;
+      }
+    }
+  }
+
+  free(preorder);
+}
+
+/* Incremental re-evaluation for tree edits. The DP vectors are allocated
+   per node, as in low-memory mode, such that their widths can change. After
+   changing branch lengths or moving subtrees, dp_mark_dirty() is called for
+   every node whose incoming edge changed, i.e. its length or its parent, and
+   dp_update() then recomputes
+
+   - the edge statistics of the nodes on the paths from the marked nodes to
+     the root,
+   - the speciation edge counts and sums of the nodes below, descending only
+     into subtrees whose values change, as they depend on the edges to the
+     children of all ancestors,
+   - the DP vectors of all these nodes, bottom-up.
+
+   The result is identical to filling the DP table of the edited tree from
+   scratch. */
+
+static void dp_incremental_node(rtree_t * node)
+{
+  memset(&node->vector, 0, sizeof(dp_vector_t));
+  memset(&node->vector_single, 0, sizeof(dp_vector_t));
+  node->filled_list = NULL;
+  node->filled_count = 0;
+  node->dirty = 0;
+
+  node->coal_logl = loglikelihood(node->edge_count, node->edgelen_sum);
+}
+
+/* Fill the DP table of tree for incremental re-evaluation. The arena only
+   holds the root scores. Not available in low-memory mode */
+void dp_incremental_init(rtree_t * tree, dp_arena_t * arena, long method)
+{
+  int i;
+  int count;
+
+  if (opt_lowmem)
+    fatal("Incremental DP re-evaluation is not available with --lowmem");
+
+  dp_bounds_init(tree);
 
-  /* for each node set spec_edge_count (and spec_edgelen_sum) as the count
-     (or sum) of edges (edge-lengths) of all direct child edges of
-     nodes on the path to root excluding the current node */
+  loglikelihood_table_init(2*tree->leaves - 2);
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(tree, postorder);
+
+  for (i = 0; i < count; ++i)
+    dp_incremental_node(postorder[i]);
+
+  dp_root_scores(tree, arena);
+  dp_set_pernode_spec_edges(tree);
+
+  /* vectors are allocated when merging */
+  dp_fill(tree, method);
+
+  free(postorder);
+}
+
+/* Mark the edge from node to its parent as changed */
+void dp_mark_dirty(rtree_t * node)
+{
   if (node->parent)
+    node->parent->dirty |= DP_DIRTY_CHILDREN;
+
+  /* the whole path is marked, as the ancestors of a node marked before may
+     have changed since by moving it */
+  for (; node; node = node->parent)
+    node->dirty |= DP_DIRTY_PATH;
+}
+
+/* Collect the nodes below tree (inclusive) that have the given flag in
+   postorder. The flagged nodes include the parents of all flagged nodes */
+static long dp_dirty_postorder(rtree_t * tree, int flag, rtree_t *** list)
+{
+  long i;
+  long count = 0;
+  long top = 0;
+  long alloc = 64;
+
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)alloc * sizeof(rtree_t *));
+  rtree_t ** nodes = (rtree_t **)xmalloc((size_t)alloc * sizeof(rtree_t *));
+
+  /* preorder, whose reverse visits each node after its descendants */
+  if (tree->dirty & flag)
+    stack[top++] = tree;
+  while (top)
+  {
+    rtree_t * x = stack[--top];
+
+    if (count == alloc || top + 2 > alloc)
+    {
+      alloc *= 2;
+      stack = (rtree_t **)xrealloc(stack, (size_t)alloc * sizeof(rtree_t *));
+      nodes = (rtree_t **)xrealloc(nodes, (size_t)alloc * sizeof(rtree_t *));
+    }
+
+    nodes[count++] = x;
+
+    if (!x->left) continue;
+
+    if (x->right->dirty & flag) stack[top++] = x->right;
+    if (x->left->dirty & flag)  stack[top++] = x->left;
+  }
+
+  for (i = 0; i < count/2; ++i)
+  {
+    rtree_t * t = nodes[i];
+    nodes[i] = nodes[count-1-i];
+    nodes[count-1-i] = t;
+  }
+
+  free(stack);
+  *list = nodes;
+  return count;
+}
+
+/* Set the speciation edge count and sum of the nodes below tree whose
+   values are affected by the edits, and flag the nodes whose DP vectors
+   have to be recomputed */
+static void dp_update_spec_edges(rtree_t * tree)
+{
+  long top = 0;
+  long alloc = 64;
+
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)alloc * sizeof(rtree_t *));
+
+  stack[top++] = tree;
+  while (top)
   {
-    node->spec_edge_count = node->parent->spec_edge_count;
-    node->spec_edgelen_sum = node->parent->spec_edgelen_sum;
+    rtree_t * x = stack[--top];
+
+    int spec_edge_count = 0;
+    double spec_edgelen_sum = 0;
 
-    double len = node->parent->left->length;
-    if (len > opt_minbr)
+    /* as in dp_set_pernode_spec_edges() */
+    if (x->parent)
     {
-      node->spec_edge_count++;
-      node->spec_edgelen_sum += len;
+      spec_edge_count = x->parent->spec_edge_count;
+      spec_edgelen_sum = x->parent->spec_edgelen_sum;
+
+      double len = x->parent->left->length;
+      if (len > opt_minbr)
+      {
+        spec_edge_count++;
+        spec_edgelen_sum += len;
+      }
+
+      len = x->parent->right->length;
+      if (len > opt_minbr)
+      {
+        spec_edge_count++;
+        spec_edgelen_sum += len;
+      }
     }
 
-    len = node->parent->right->length;
-    if (len > opt_minbr)
+    int changed = (spec_edge_count != x->spec_edge_count ||
+                   spec_edgelen_sum != x->spec_edgelen_sum);
+
+    x->spec_edge_count = spec_edge_count;
+    x->spec_edgelen_sum = spec_edgelen_sum;
+
+    if (changed || (x->dirty & DP_DIRTY_PATH))
+      x->dirty |= DP_DIRTY_MERGE;
+
+    if (!x->left) continue;
+
+    if (top + 2 > alloc)
     {
-      node->spec_edge_count++;
-      node->spec_edgelen_sum += len;
+      alloc *= 2;
+      stack = (rtree_t **)xrealloc(stack, (size_t)alloc * sizeof(rtree_t *));
     }
+
+    /* the children change if x or the edges to them changed */
+    int all = changed || (x->dirty & DP_DIRTY_CHILDREN);
+
+    if (all || (x->right->dirty & DP_DIRTY_PATH)) stack[top++] = x->right;
+    if (all || (x->left->dirty & DP_DIRTY_PATH))  stack[top++] = x->left;
+  }
+
+  free(stack);
+}
+
+/* Re-evaluate the DP table of tree after the edits marked with
+   dp_mark_dirty() and return the log-likelihood of the ML delimitation. The
+   delimitation itself can be obtained with dp_ptp_summary() or dp_ptp() */
+double dp_update(rtree_t * tree, dp_arena_t * arena, long method)
+{
+  long i;
+  long count;
+  double logl;
+  rtree_t ** list;
+
+  /* edge statistics on the paths to the root */
+  count = dp_dirty_postorder(tree, DP_DIRTY_PATH, &list);
+  for (i = 0; i < count; ++i)
+  {
+    rtree_update_info(list[i]);
+    list[i]->coal_logl = loglikelihood(list[i]->edge_count,
+                                       list[i]->edgelen_sum);
+  }
+  free(list);
+
+  dp_bounds_init(tree);
+
+  dp_update_spec_edges(tree);
+
+  /* recompute the flagged vectors, whose widths may have changed */
+  count = dp_dirty_postorder(tree, DP_DIRTY_MERGE, &list);
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = list[i];
+
+    dp_vector_free(x);
+    if (x == tree)
+      dp_root_scores(tree, arena);
+
+    dp_merge(x, method);
+    x->dirty = 0;
+  }
+  free(list);
+
+  dp_best_entry(tree, method, &logl);
+  return logl;
+}
+
+/* Release the DP vectors allocated by dp_incremental_init() and dp_update() */
+void dp_incremental_free(rtree_t * tree)
+{
+  int i;
+  int count;
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(tree, postorder);
+
+  for (i = 0; i < count; ++i)
+  {
+    if (dp_vec_allocated(&postorder[i]->vector))
+      dp_vector_free(postorder[i]);
+    dp_incremental_node(postorder[i]);
   }
 
-  dp_set_pernode_spec_edges(node->left);
-  dp_set_pernode_spec_edges(node->right);
+  free(postorder);
 }
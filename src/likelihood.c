@@ -87,15 +87,85 @@ l50:
 
 
 
+/* table of n*(log(n) - 1) for the edge counts 0..nlogn_size-1, i.e. the
+   part of the log-likelihood that depends only on the edge count */
+static double * nlogn = NULL;
+static long nlogn_size = 0;
+
+/* Build the table of the edge count terms of the log-likelihood for trees
+   with up to max_edge_count edges. The table only grows, hence it is built
+   once for a tree and reused by all DP and MCMC runs on it. Must not be
+   called while other threads evaluate log-likelihoods */
+void loglikelihood_table_init(long max_edge_count)
+{
+  long i;
+
+  if (max_edge_count < nlogn_size) return;
+
+  free(nlogn);
+  nlogn_size = max_edge_count + 1;
+  nlogn = (double *)xmalloc((size_t)nlogn_size * sizeof(double));
+
+  nlogn[0] = 0;
+  for (i = 1; i < nlogn_size; ++i)
+    nlogn[i] = i * (log(i) - 1);
+}
+
+void loglikelihood_table_free(void)
+{
+  free(nlogn);
+  nlogn = NULL;
+  nlogn_size = 0;
+}
+
 double loglikelihood(long edge_count, double edgelen_sum)
 {
   assert(edge_count >= 0);
 
   if (edge_count == 0 || edgelen_sum < __DBL_MIN__) return 0;
 
+  if (edge_count < nlogn_size)
+    return nlogn[edge_count] - edge_count * log(edgelen_sum);
+
   return edge_count * (log(edge_count) - 1 - log(edgelen_sum));
 }
 
+/* Compute the log-likelihoods of 'count' pairs of edge counts and edge
+   length sums into 'out', using the widest SIMD instruction set available
+   on the running CPU. The edge count terms are looked up in the table of
+   loglikelihood_table_init() */
+void loglikelihood_batch(const int * edge_count,
+                         const double * edgelen_sum,
+                         double * out,
+                         long count)
+{
+  long i;
+
+#ifdef HAVE_X86_KERNELS
+  if (avx2_present)
+  {
+    loglikelihood_batch_avx2(edge_count, edgelen_sum, nlogn, nlogn_size,
+                             out, count);
+    return;
+  }
+  if (avx_present)
+  {
+    loglikelihood_batch_avx(edge_count, edgelen_sum, nlogn, nlogn_size,
+                            out, count);
+    return;
+  }
+  if (sse41_present)
+  {
+    loglikelihood_batch_sse41(edge_count, edgelen_sum, nlogn, nlogn_size,
+                              out, count);
+    return;
+  }
+#endif
+
+  for (i = 0; i < count; ++i)
+    out[i] = loglikelihood(edge_count[i], edgelen_sum[i]);
+}
+
 int lrt(double nullmodel_logl, double ptp_logl, unsigned int df, double * pvalue)
 {
   double diff = 2*(ptp_logl - nullmodel_logl);
@@ -0,0 +1,115 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+#include <immintrin.h>
+
+/* AVX2 version of the vectorized logarithm in likelihood_sse41.c */
+
+static inline __m256d log_avx2(__m256d x)
+{
+  const __m256i mant_mask = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+  const __m256i exp_bias  = _mm256_set1_epi64x(0x3FF0000000000000LL);
+  const __m256i magic_int = _mm256_set1_epi64x(0x4330000000000000LL);
+  const __m256d magic = _mm256_set1_pd(4503599627370496.0 + 1023.0);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d half = _mm256_set1_pd(0.5);
+
+  __m256i bits = _mm256_castpd_si256(x);
+
+  /* unbiased exponent converted to double */
+  __m256i ebits = _mm256_or_si256(_mm256_srli_epi64(bits, 52), magic_int);
+  __m256d e = _mm256_sub_pd(_mm256_castsi256_pd(ebits), magic);
+
+  /* mantissa in [1,2), reduced to [sqrt(1/2), sqrt(2)) */
+  __m256d m = _mm256_castsi256_pd(
+                _mm256_or_si256(_mm256_and_si256(bits, mant_mask), exp_bias));
+  __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(LOG_SQRT2), _CMP_GT_OQ);
+  m = _mm256_blendv_pd(m, _mm256_mul_pd(m, half), big);
+  e = _mm256_add_pd(e, _mm256_and_pd(big, one));
+
+  __m256d f = _mm256_sub_pd(m, one);
+  __m256d z = _mm256_mul_pd(f, f);
+
+  __m256d p = _mm256_set1_pd(LOG_P0);
+  p = _mm256_add_pd(_mm256_mul_pd(p, f), _mm256_set1_pd(LOG_P1));
+  p = _mm256_add_pd(_mm256_mul_pd(p, f), _mm256_set1_pd(LOG_P2));
+  p = _mm256_add_pd(_mm256_mul_pd(p, f), _mm256_set1_pd(LOG_P3));
+  p = _mm256_add_pd(_mm256_mul_pd(p, f), _mm256_set1_pd(LOG_P4));
+  p = _mm256_add_pd(_mm256_mul_pd(p, f), _mm256_set1_pd(LOG_P5));
+
+  __m256d q = _mm256_add_pd(f, _mm256_set1_pd(LOG_Q0));
+  q = _mm256_add_pd(_mm256_mul_pd(q, f), _mm256_set1_pd(LOG_Q1));
+  q = _mm256_add_pd(_mm256_mul_pd(q, f), _mm256_set1_pd(LOG_Q2));
+  q = _mm256_add_pd(_mm256_mul_pd(q, f), _mm256_set1_pd(LOG_Q3));
+  q = _mm256_add_pd(_mm256_mul_pd(q, f), _mm256_set1_pd(LOG_Q4));
+
+  __m256d y = _mm256_mul_pd(f, _mm256_div_pd(_mm256_mul_pd(z, p), q));
+  y = _mm256_sub_pd(y, _mm256_mul_pd(e, _mm256_set1_pd(LOG_LN2_LO)));
+  y = _mm256_sub_pd(y, _mm256_mul_pd(z, half));
+
+  __m256d r = _mm256_add_pd(f, y);
+  return _mm256_add_pd(r, _mm256_mul_pd(e, _mm256_set1_pd(LOG_LN2_HI)));
+}
+
+void loglikelihood_batch_avx2(const int * edge_count,
+                              const double * edgelen_sum,
+                              const double * nlogn,
+                              long nlogn_size,
+                              double * out,
+                              long count)
+{
+  long i,j;
+
+  const __m256d dbl_min = _mm256_set1_pd(__DBL_MIN__);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m128i limit = _mm_set1_epi32((int)nlogn_size);
+
+  for (i = 0; i + 4 <= count; i += 4)
+  {
+    __m128i ni = _mm_loadu_si128((const __m128i *)(edge_count+i));
+
+    /* edge counts outside the table are computed by the scalar version */
+    if (_mm_movemask_epi8(_mm_cmplt_epi32(ni, limit)) != 0xFFFF)
+    {
+      for (j = i; j < i+4; ++j)
+        out[j] = loglikelihood(edge_count[j], edgelen_sum[j]);
+      continue;
+    }
+
+    __m256d n = _mm256_cvtepi32_pd(ni);
+    __m256d t = _mm256_i32gather_pd(nlogn, ni, 8);
+    __m256d s = _mm256_loadu_pd(edgelen_sum+i);
+
+    /* entries with no edges or zero length sum have log-likelihood 0 */
+    __m256d mask = _mm256_or_pd(_mm256_cmp_pd(n, zero, _CMP_EQ_OQ),
+                                _mm256_cmp_pd(s, dbl_min, _CMP_LT_OQ));
+
+    __m256d logs = log_avx2(_mm256_max_pd(s, dbl_min));
+
+    __m256d r = _mm256_sub_pd(t, _mm256_mul_pd(n, logs));
+
+    _mm256_storeu_pd(out+i, _mm256_andnot_pd(mask, r));
+  }
+
+  for (; i < count; ++i)
+    out[i] = loglikelihood(edge_count[i], edgelen_sum[i]);
+}
@@ -0,0 +1,118 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+#include <smmintrin.h>
+
+/* Vectorized natural logarithm for two positive normal doubles. The argument
+   is split into x = 2^e * m with m in [sqrt(1/2), sqrt(2)), and log(m) is
+   approximated by the rational function of the Cephes library, i.e.
+   log(1+f) = f - f^2/2 + f^3 P(f)/Q(f). The result is within a few ulps of
+   the C library log(). */
+
+static inline __m128d log_sse41(__m128d x)
+{
+  const __m128i mant_mask = _mm_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+  const __m128i exp_bias  = _mm_set1_epi64x(0x3FF0000000000000LL);
+  const __m128i magic_int = _mm_set1_epi64x(0x4330000000000000LL);
+  const __m128d magic = _mm_set1_pd(4503599627370496.0 + 1023.0);
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d half = _mm_set1_pd(0.5);
+
+  __m128i bits = _mm_castpd_si128(x);
+
+  /* unbiased exponent converted to double */
+  __m128i ebits = _mm_or_si128(_mm_srli_epi64(bits, 52), magic_int);
+  __m128d e = _mm_sub_pd(_mm_castsi128_pd(ebits), magic);
+
+  /* mantissa in [1,2), reduced to [sqrt(1/2), sqrt(2)) */
+  __m128d m = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, mant_mask),
+                                            exp_bias));
+  __m128d big = _mm_cmpgt_pd(m, _mm_set1_pd(LOG_SQRT2));
+  m = _mm_blendv_pd(m, _mm_mul_pd(m, half), big);
+  e = _mm_add_pd(e, _mm_and_pd(big, one));
+
+  __m128d f = _mm_sub_pd(m, one);
+  __m128d z = _mm_mul_pd(f, f);
+
+  __m128d p = _mm_set1_pd(LOG_P0);
+  p = _mm_add_pd(_mm_mul_pd(p, f), _mm_set1_pd(LOG_P1));
+  p = _mm_add_pd(_mm_mul_pd(p, f), _mm_set1_pd(LOG_P2));
+  p = _mm_add_pd(_mm_mul_pd(p, f), _mm_set1_pd(LOG_P3));
+  p = _mm_add_pd(_mm_mul_pd(p, f), _mm_set1_pd(LOG_P4));
+  p = _mm_add_pd(_mm_mul_pd(p, f), _mm_set1_pd(LOG_P5));
+
+  __m128d q = _mm_add_pd(f, _mm_set1_pd(LOG_Q0));
+  q = _mm_add_pd(_mm_mul_pd(q, f), _mm_set1_pd(LOG_Q1));
+  q = _mm_add_pd(_mm_mul_pd(q, f), _mm_set1_pd(LOG_Q2));
+  q = _mm_add_pd(_mm_mul_pd(q, f), _mm_set1_pd(LOG_Q3));
+  q = _mm_add_pd(_mm_mul_pd(q, f), _mm_set1_pd(LOG_Q4));
+
+  __m128d y = _mm_mul_pd(f, _mm_div_pd(_mm_mul_pd(z, p), q));
+  y = _mm_sub_pd(y, _mm_mul_pd(e, _mm_set1_pd(LOG_LN2_LO)));
+  y = _mm_sub_pd(y, _mm_mul_pd(z, half));
+
+  __m128d r = _mm_add_pd(f, y);
+  return _mm_add_pd(r, _mm_mul_pd(e, _mm_set1_pd(LOG_LN2_HI)));
+}
+
+void loglikelihood_batch_sse41(const int * edge_count,
+                               const double * edgelen_sum,
+                               const double * nlogn,
+                               long nlogn_size,
+                               double * out,
+                               long count)
+{
+  long i;
+
+  const __m128d dbl_min = _mm_set1_pd(__DBL_MIN__);
+  const __m128d zero = _mm_setzero_pd();
+
+  for (i = 0; i + 2 <= count; i += 2)
+  {
+    int n0 = edge_count[i];
+    int n1 = edge_count[i+1];
+
+    /* edge counts outside the table are computed by the scalar version */
+    if (n0 >= nlogn_size || n1 >= nlogn_size)
+    {
+      out[i]   = loglikelihood(n0, edgelen_sum[i]);
+      out[i+1] = loglikelihood(n1, edgelen_sum[i+1]);
+      continue;
+    }
+
+    __m128d n = _mm_set_pd(n1, n0);
+    __m128d t = _mm_set_pd(nlogn[n1], nlogn[n0]);
+    __m128d s = _mm_loadu_pd(edgelen_sum+i);
+
+    /* entries with no edges or zero length sum have log-likelihood 0 */
+    __m128d mask = _mm_or_pd(_mm_cmpeq_pd(n, zero), _mm_cmplt_pd(s, dbl_min));
+
+    __m128d logs = log_sse41(_mm_max_pd(s, dbl_min));
+
+    __m128d r = _mm_sub_pd(t, _mm_mul_pd(n, logs));
+
+    _mm_storeu_pd(out+i, _mm_andnot_pd(mask, r));
+  }
+
+  for (; i < count; ++i)
+    out[i] = loglikelihood(edge_count[i], edgelen_sum[i]);
+}
@@ -67,7 +67,26 @@ long opt_svg_marginright;
 long opt_svg_margintop;
 long opt_svg_marginbottom;
 long opt_svg_inner_radius;
+long opt_threads;
+long opt_lowmem;
+long opt_ml_topk;
+long opt_dp_support;
+long opt_min_species;
+long opt_max_species;
+long opt_beam;
+long opt_beam_check;
+long opt_dp_update_check;
+long opt_dp_float;
+long opt_batch;
+long opt_mcmc_chains;
+long opt_mcmc_swap;
+long opt_mcmc_diag;
+long opt_mcmc_checkpoint;
+long opt_resume;
+char * opt_constraints;
 double opt_mcmc_credible;
+double opt_mcmc_heat;
+double opt_mcmc_stop;
 double opt_svg_legend_ratio;
 double opt_pvalue;
 double opt_minbr;
@@ -75,6 +94,9 @@ char * opt_treefile;
 char * opt_outfile;
 char * opt_outgroup;
 char * opt_pdist_file;
+char * opt_minbr_sweep;
+char * opt_root_scan;
+char * opt_ml_report;
 
 static struct option long_options[] =
 {
@@ -113,6 +135,28 @@ static struct option long_options[] =
   {"single",             no_argument,       0, 0 },  /* 32 */
   {"multi",              no_argument,       0, 0 },  /* 33 */
   {"mcmc_startml",       no_argument,       0, 0 },  /* 34 */
+  {"threads",            required_argument, 0, 0 },  /* 35 */
+  {"lowmem",             no_argument,       0, 0 },  /* 36 */
+  {"minbr_sweep",        required_argument, 0, 0 },  /* 37 */
+  {"ml_report",          required_argument, 0, 0 },  /* 38 */
+  {"ml_topk",            required_argument, 0, 0 },  /* 39 */
+  {"dp_support",         required_argument, 0, 0 },  /* 40 */
+  {"min_species",        required_argument, 0, 0 },  /* 41 */
+  {"max_species",        required_argument, 0, 0 },  /* 42 */
+  {"beam",               required_argument, 0, 0 },  /* 43 */
+  {"beam_check",         no_argument,       0, 0 },  /* 44 */
+  {"dp_update_check",    required_argument, 0, 0 },  /* 45 */
+  {"root_scan",          required_argument, 0, 0 },  /* 46 */
+  {"dp_float",           no_argument,       0, 0 },  /* 47 */
+  {"constraints",        required_argument, 0, 0 },  /* 48 */
+  {"batch",              no_argument,       0, 0 },  /* 49 */
+  {"mcmc_chains",        required_argument, 0, 0 },  /* 50 */
+  {"mcmc_heat",          required_argument, 0, 0 },  /* 51 */
+  {"mcmc_swap",          required_argument, 0, 0 },  /* 52 */
+  {"mcmc_diag",          required_argument, 0, 0 },  /* 53 */
+  {"mcmc_stop",          required_argument, 0, 0 },  /* 54 */
+  {"mcmc_checkpoint",    required_argument, 0, 0 },  /* 55 */
+  {"resume",             no_argument,       0, 0 },  /* 56 */
   { 0, 0, 0, 0 }
 };
 
@@ -121,6 +165,7 @@ void args_init(int argc, char ** argv)
   int option_index = 0;
   int c;
   int mand_options = 0;
+  int seed_given = 0;
 
   /* set defaults */
 
@@ -133,6 +178,9 @@ void args_init(int argc, char ** argv)
   opt_outfile = NULL;
   opt_outgroup = NULL;
   opt_pdist_file = NULL;
+  opt_minbr_sweep = NULL;
+  opt_root_scan = NULL;
+  opt_ml_report = NULL;
   opt_quiet = 0;
   opt_pvalue = 0.001;
   opt_minbr = 0.0001;
@@ -146,6 +194,13 @@ void args_init(int argc, char ** argv)
   opt_mcmc_burnin = 1;
   opt_mcmc_runs = 1;
   opt_mcmc_credible = 0.95;
+  opt_mcmc_chains = 1;
+  opt_mcmc_heat = 0.1;
+  opt_mcmc_swap = 100;
+  opt_mcmc_diag = 0;
+  opt_mcmc_stop = 0;
+  opt_mcmc_checkpoint = 0;
+  opt_resume = 0;
   opt_seed = (long)time(NULL);
   opt_crop = 0;
   opt_ml = 0;
@@ -153,6 +208,17 @@ void args_init(int argc, char ** argv)
   opt_method = PTP_METHOD_MULTI;
   opt_multi = 0;
   opt_single = 0;
+  opt_threads = 1;
+  opt_lowmem = 0;
+  opt_ml_topk = 0;
+  opt_dp_support = 0;
+  opt_min_species = 0;
+  opt_max_species = 0;
+  opt_beam = 0;
+  opt_beam_check = 0;
+  opt_dp_update_check = 0;
+  opt_dp_float = 0;
+  opt_constraints = NULL;
 
   opt_svg_width = 1920;
   opt_svg_fontsize = 12;
@@ -267,6 +333,7 @@ void args_init(int argc, char ** argv)
 
       case 22:
         opt_seed = atol(optarg);
+        seed_given = 1;
         break;
 
       case 23:
@@ -321,6 +388,112 @@ void args_init(int argc, char ** argv)
         opt_mcmc_startml = 1;
         break;
 
+      case 35:
+        opt_threads = atol(optarg);
+        break;
+
+      case 36:
+        opt_lowmem = 1;
+        break;
+
+      case 37:
+        opt_minbr_sweep = optarg;
+        break;
+
+      case 38:
+        opt_ml_report = optarg;
+        break;
+
+      case 39:
+        opt_ml_topk = atol(optarg);
+        if (opt_ml_topk < 1)
+          fatal("--ml_topk must be a positive integer");
+        break;
+
+      case 40:
+        opt_dp_support = atol(optarg);
+        if (opt_dp_support < 1)
+          fatal("--dp_support must be a positive integer");
+        break;
+
+      case 41:
+        opt_min_species = atol(optarg);
+        if (opt_min_species < 1)
+          fatal("--min_species must be a positive integer");
+        break;
+
+      case 42:
+        opt_max_species = atol(optarg);
+        if (opt_max_species < 1)
+          fatal("--max_species must be a positive integer");
+        break;
+
+      case 43:
+        opt_beam = atol(optarg);
+        if (opt_beam < 1)
+          fatal("--beam must be a positive integer");
+        break;
+
+      case 44:
+        opt_beam_check = 1;
+        break;
+
+      case 45:
+        opt_dp_update_check = atol(optarg);
+        if (opt_dp_update_check < 1)
+          fatal("--dp_update_check must be a positive integer");
+        break;
+
+      case 46:
+        opt_root_scan = optarg;
+        break;
+
+      case 47:
+        opt_dp_float = 1;
+        break;
+
+      case 48:
+        opt_constraints = optarg;
+        break;
+
+      case 49:
+        opt_batch = 1;
+        break;
+
+      case 50:
+        opt_mcmc_chains = atol(optarg);
+        break;
+
+      case 51:
+        opt_mcmc_heat = strtod(optarg, &end);
+        if (end == optarg) {
+          fatal(" is not a valid number.\n");
+        }
+        break;
+
+      case 52:
+        opt_mcmc_swap = atol(optarg);
+        break;
+
+      case 53:
+        opt_mcmc_diag = atol(optarg);
+        break;
+
+      case 54:
+        opt_mcmc_stop = strtod(optarg, &end);
+        if (end == optarg) {
+          fatal(" is not a valid number.\n");
+        }
+        break;
+
+      case 55:
+        opt_mcmc_checkpoint = atol(optarg);
+        break;
+
+      case 56:
+        opt_resume = 1;
+        break;
+
       default:
         fatal("Internal error in option parsing");
     }
@@ -348,6 +521,18 @@ void args_init(int argc, char ** argv)
     commands++;
   if (opt_ml)
     commands++;
+  if (opt_minbr_sweep)
+    commands++;
+  if (opt_root_scan)
+    commands++;
+  if (opt_ml_report)
+    commands++;
+  if (opt_ml_topk)
+    commands++;
+  if (opt_dp_support)
+    commands++;
+  if (opt_dp_update_check)
+    commands++;
 
   /* if more than one independent command, fail */
   if (commands > 1)
@@ -357,6 +542,75 @@ void args_init(int argc, char ** argv)
   if (opt_mcmc_startrandom + opt_mcmc_startnull + opt_mcmc_startml > 1)
     fatal("You can only select one out of --mcmc_startrandom, --mcmc_startnull, --mcmc_startml");
 
+  if (opt_threads < 1)
+    fatal("--threads must be a positive integer");
+
+  if (opt_min_species && opt_max_species && opt_min_species > opt_max_species)
+    fatal("--min_species must be smaller or equal to --max_species");
+
+  if (opt_beam && !opt_ml)
+    fatal("--beam can only be used with --ml");
+
+  if (opt_beam_check && !opt_beam)
+    fatal("--beam_check requires --beam");
+
+  if (opt_dp_update_check && opt_lowmem)
+    fatal("--dp_update_check cannot be used with --lowmem");
+
+  if (opt_dp_float && !opt_ml)
+    fatal("--dp_float can only be used with --ml");
+
+  if (opt_dp_float && opt_beam)
+    fatal("--dp_float cannot be used with --beam");
+
+  if (opt_constraints && !opt_ml && !opt_ml_report && !opt_minbr_sweep)
+    fatal("--constraints can only be used with --ml, --ml_report or "
+          "--minbr_sweep");
+
+  if (opt_constraints && opt_beam)
+    fatal("--constraints cannot be used with --beam");
+
+  if (opt_batch && !opt_ml)
+    fatal("--batch can only be used with --ml");
+
+  if (opt_batch && (opt_beam || opt_dp_float || opt_constraints))
+    fatal("--batch cannot be used with --beam, --dp_float or --constraints");
+
+  if (opt_mcmc_chains < 1)
+    fatal("--mcmc_chains must be a positive integer");
+
+  if (opt_mcmc_heat <= 0)
+    fatal("--mcmc_heat must be a positive number");
+
+  if (opt_mcmc_swap < 1)
+    fatal("--mcmc_swap must be a positive integer");
+
+  if (opt_mcmc_chains > 1 && !opt_mcmc)
+    fatal("--mcmc_chains can only be used with --mcmc");
+
+  if (opt_mcmc_diag < 0)
+    fatal("--mcmc_diag must be a positive integer");
+
+  if (opt_mcmc_stop < 0)
+    fatal("--mcmc_stop must be a positive number");
+
+  if (opt_mcmc_diag && !opt_mcmc)
+    fatal("--mcmc_diag can only be used with --mcmc");
+
+  if (opt_mcmc_stop && (!opt_mcmc_diag || opt_mcmc_runs < 2))
+    fatal("--mcmc_stop requires --mcmc_diag and at least two --mcmc_runs");
+
+  if (opt_mcmc_checkpoint < 0)
+    fatal("--mcmc_checkpoint must be a positive integer");
+
+  if ((opt_mcmc_checkpoint || opt_resume) && !opt_mcmc)
+    fatal("--mcmc_checkpoint and --resume can only be used with --mcmc");
+
+  /* the checkpoint and log file names contain the seed, hence a resumed run
+     must be given the seed of the interrupted one */
+  if ((opt_mcmc_checkpoint || opt_resume) && !seed_given)
+    fatal("--mcmc_checkpoint and --resume require --seed");
+
   /* if more than one independent command, fail */
   if (opt_multi && opt_single)
     fatal("You can either specify --multi or --single, but not both at once.");
@@ -390,23 +644,45 @@ void cmd_help()
           "  --multi                   Use one lambda per coalescent (this is default).\n"
           "  --single                  Use one lambda for all coalescent.\n"
           "  --ml                      Maximum-likelihood heuristic.\n"
+          "  --ml_report LIST          ML delimitations of both methods and LRT for each p-value in LIST.\n"
+          "  --ml_topk INT             Enumerate the INT best delimitations of the ML heuristic.\n"
           "  --mcmc INT                Support values for the delimitation (INT steps).\n"
+          "  --dp_support INT          Support values from INT independent delimitations sampled with the DP.\n"
+          "  --dp_update_check INT     Compare the incremental DP re-evaluation with a full fill on INT random edits.\n"
           "  --mcmc_sample INT         Sample every INT iteration (default: 1000).\n"
           "  --mcmc_log                Log samples and create SVG plot of log-likelihoods.\n"
           "  --mcmc_burnin INT         Ignore all MCMC steps below threshold.\n"
           "  --mcmc_runs INT           Perform multiple MCMC runs.\n"
           "  --mcmc_credible <0..1>    Credible interval (default: 0.95).\n"
+          "  --mcmc_chains INT         Metropolis-coupled chains per run, one cold and INT-1 heated (default: 1).\n"
+          "  --mcmc_heat REAL          Temperature increment between the chains of --mcmc_chains (default: 0.1).\n"
+          "  --mcmc_swap INT           Propose a swap between chains every INT steps (default: 100).\n"
+          "  --mcmc_diag INT           Report ASDSF, PSRF and ESS of the runs every INT steps.\n"
+          "  --mcmc_stop REAL          Stop all runs once the ASDSF of --mcmc_diag is at most REAL.\n"
+          "  --mcmc_checkpoint INT     Write a checkpoint of all runs every INT steps.\n"
+          "  --resume                  Resume the MCMC runs from their last checkpoint.\n"
           "  --mcmc_startnull          Start each run with the null model (one single species).\n"
           "  --mcmc_startrandom        Start each run with a random delimitation.\n"
           "  --mcmc_startml            Start each run with the delimitation obtained by the Maximum-likelihood heuristic.\n"
           "  --pvalue REAL             Set p-value for LRT (default: 0.001)\n"
           "  --minbr REAL              Set minimum branch length (default: 0.0001)\n"
           "  --minbr_auto FILENAME     Detect minimum branch length from FASTA p-distances\n"
+          "  --minbr_sweep LIST        ML delimitation for each minimum branch length in the comma-separated LIST.\n"
+          "  --root_scan all|TAXA      ML delimitation of an unrooted tree for every root edge, or the edges of TAXA.\n"
+          "  --min_species INT         Only consider delimitations with at least INT species.\n"
+          "  --max_species INT         Only consider delimitations with at most INT species.\n"
+          "  --beam INT                Approximate --ml keeping the INT best candidates per node.\n"
+          "  --beam_check              Compare the --beam delimitation with the exact one.\n"
           "  --outgroup TAXA           Root unrooted tree at outgroup (default: taxon with longest branch).\n"
           "  --outgroup_crop           Crop outgroup from tree\n"
+          "  --constraints FILENAME    Constrain clades to be species, within one species, or split.\n"
           "  --quiet                   only output warnings and fatal errors to stderr.\n"
           "  --precision INT           Precision of floating point numbers on output (default: 7).\n"
           "  --seed                    Seed for pseudo-random number generator.\n"
+          "  --threads INT             Number of threads for filling the DP table, --mcmc_runs and --mcmc_chains (default: 1).\n"
+          "  --lowmem                  Keep only checkpoints of the DP table and recompute the rest when needed.\n"
+          "  --dp_float                Store the DP table in single precision and verify the result in double.\n"
+          "  --batch                   Run --ml on every tree of the tree file in parallel and write one table.\n"
           "\n"
           "Input and output options:\n"
           "  --tree_file FILENAME      tree file in newick format.\n"
@@ -426,6 +702,63 @@ void cmd_help()
          );
 }
 
+/* Root an unrooted tree at the outgroup, or at the tip with the longest
+   branch if no outgroup was specified, and crop the outgroup if requested */
+static rtree_t * root_utree(utree_t * utree, unsigned int tip_count)
+{
+  rtree_t * rtree;
+  utree_t * og_root = NULL;
+
+  /* if outgroup was not specified, get the tip with the longest branch */
+  if (!opt_outgroup)
+  {
+    og_root = utree_longest_branchtip(utree, tip_count);
+    assert(og_root);
+    if (!opt_batch)
+      fprintf(stdout,
+              "Selected %s as outgroup based on longest tip-branch criterion\n",
+              og_root->label);
+  }
+  else
+  {
+    /* get LCA of out group */
+    og_root = utree_outgroup_lca(utree, tip_count);
+    if (!og_root)
+    {
+      utree_destroy(utree);
+      fatal("Outgroup must be a single tip or a list of all tips of a subtree");
+    }
+  }
+
+  if (opt_crop)
+  {
+    rtree = utree_crop(og_root);
+  }
+  else
+  {
+    rtree = utree_convert_rtree(og_root);
+  }
+
+  return rtree;
+}
+
+/* Crop the outgroup from a rooted tree */
+static rtree_t * crop_rtree(rtree_t * rtree)
+{
+  if (!opt_outgroup)
+    fatal("--outgroup must be specified when using --outgroup_crop.");
+
+  /* get LCA of outgroup */
+  rtree_t * og_root = get_outgroup_lca(rtree);
+
+  /* crop outgroup from tree */
+  rtree = rtree_crop(rtree,og_root);
+  if (!rtree)
+    fatal("Cropping the outgroup leads to less than two tips.");
+
+  return rtree;
+}
+
 static rtree_t * load_tree(void)
 {
   /* parse tree */
@@ -447,37 +780,7 @@ static rtree_t * load_tree(void)
       fprintf(stdout, "Converting to rooted tree...\n");
     }
 
-    /* if outgroup was not specified, get the node with the longest branch */
-    utree_t * og_root = NULL;
-
-    /* if outgroup was not specified, get the tip with the longest branch */
-    if (!opt_outgroup)
-    {
-      og_root = utree_longest_branchtip(utree, tip_count);
-      assert(og_root);
-      fprintf(stdout,
-              "Selected %s as outgroup based on longest tip-branch criterion\n",
-              og_root->label);
-    }
-    else
-    {
-      /* get LCA of out group */
-      og_root = utree_outgroup_lca(utree, tip_count);
-      if (!og_root)
-      {
-        utree_destroy(utree);
-        fatal("Outgroup must be a single tip or a list of all tips of a subtree");
-      }
-    }
-
-    if (opt_crop)
-    {
-      rtree = utree_crop(og_root);
-    }
-    else
-    {
-      rtree = utree_convert_rtree(og_root);
-    }
+    rtree = root_utree(utree, tip_count);
 
     utree_destroy(utree);
   }
@@ -487,21 +790,122 @@ static rtree_t * load_tree(void)
       fprintf(stdout, "Loaded rooted tree...\n");
       
     if (opt_crop)
+      rtree = crop_rtree(rtree);
+  }
+
+  if (opt_constraints)
+    constraints_load(rtree, opt_constraints);
+
+  return rtree;
+}
+
+/* Parse the tree held in stream, which is tried as a rooted tree first and
+   as an unrooted one next, and root it as load_tree() does */
+static rtree_t * load_tree_stream(FILE * stream, long index)
+{
+  unsigned int tip_count;
+
+  rewind(stream);
+  rtree_t * rtree = rtree_parse_newick_stream(stream);
+
+  if (rtree)
+    return opt_crop ? crop_rtree(rtree) : rtree;
+
+  rewind(stream);
+  utree_t * utree = utree_parse_newick_stream(stream, &tip_count);
+  if (!utree)
+    fatal("Tree %ld is neither unrooted nor rooted.", index);
+
+  rtree = root_utree(utree, tip_count);
+
+  utree_destroy(utree);
+
+  return rtree;
+}
+
+/* Parse all trees of the tree file for --batch. Each tree ends with a
+   semicolon outside quoted labels, and is copied to a temporary file that
+   is parsed on its own, as the parsers accept a single tree */
+static rtree_t ** load_trees(long * count)
+{
+  int c;
+  int quote = 0;
+  int empty = 1;
+  long alloc = 16;
+
+  if (!opt_quiet)
+    fprintf(stdout, "Parsing tree file...\n");
+
+  FILE * in = xopen(opt_treefile, "r");
+  FILE * stream = tmpfile();
+  if (!stream)
+    fatal("Unable to create temporary file");
+
+  rtree_t ** trees = (rtree_t **)xmalloc((size_t)alloc * sizeof(rtree_t *));
+  *count = 0;
+
+  while (1)
+  {
+    c = fgetc(in);
+
+    if (c != EOF)
     {
-      if (!opt_outgroup)
-        fatal("--outgroup must be specified when using --outgroup_crop.");
+      fputc(c, stream);
 
-      /* get LCA of outgroup */
-      rtree_t * og_root = get_outgroup_lca(rtree);
+      if (quote)
+      {
+        /* escaped characters do not close the quoted label */
+        if (c == '\\')
+        {
+          c = fgetc(in);
+          if (c != EOF)
+            fputc(c, stream);
+        }
+        else if (c == quote)
+          quote = 0;
+        continue;
+      }
 
-      /* crop outgroup from tree */
-      rtree = rtree_crop(rtree,og_root);
-      if (!rtree)
-        fatal("Cropping the outgroup leads to less than two tips.");
+      if (c == '\'' || c == '"')
+        quote = c;
+      if (!isspace(c))
+        empty = 0;
+      if (c != ';')
+        continue;
     }
+    else if (empty)
+    {
+      fclose(stream);
+      break;
+    }
+
+    if (*count == alloc)
+    {
+      alloc *= 2;
+      trees = (rtree_t **)xrealloc(trees, (size_t)alloc * sizeof(rtree_t *));
+    }
+    trees[*count] = load_tree_stream(stream, *count + 1);
+    *count = *count + 1;
+
+    fclose(stream);
+    if (c == EOF)
+      break;
+
+    stream = tmpfile();
+    if (!stream)
+      fatal("Unable to create temporary file");
+    empty = 1;
   }
 
-  return rtree;
+  fclose(in);
+
+  if (!*count)
+    fatal("No trees found in %s", opt_treefile);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Loaded %ld trees...\n", *count);
+
+  return trees;
 }
 
 void cmd_auto()
@@ -518,15 +922,131 @@ void cmd_ml(void)
 {
   rtree_t * rtree = load_tree();
 
-  dp_init(rtree);
+  if (opt_beam)
+  {
+    /* approximate DP without vectors */
+    dp_set_pernode_spec_edges(rtree);
+    dp_beam(rtree, opt_method, opt_beam);
+  }
+  else
+  {
+    dp_arena_t * arena = dp_arena_create();
+
+    dp_init(rtree, arena);
+    dp_set_pernode_spec_edges(rtree);
+    dp_fill(rtree, opt_method);
+
+    if (opt_dp_float && !dp_float_verify(rtree, opt_method))
+    {
+      /* the best delimitations are too close for single precision */
+      dp_free(rtree);
+      opt_dp_float = 0;
+      dp_init(rtree, arena);
+      dp_fill(rtree, opt_method);
+    }
+
+    dp_ptp(rtree, opt_method);
+    dp_free(rtree);
+
+    dp_arena_destroy(arena);
+  }
+
+  if (opt_treeshow)
+    rtree_show_ascii(rtree);
+
+  cmd_svg(rtree, opt_seed, "svg");
+
+  /* deallocate tree structure */
+  rtree_destroy(rtree);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Done...\n");
+}
+
+void cmd_ml_batch(void)
+{
+  long i;
+  long count;
+
+  rtree_t ** trees = load_trees(&count);
+
+  ml_batch(trees, count, opt_method);
+
+  /* deallocate tree structures */
+  for (i = 0; i < count; ++i)
+    rtree_destroy(trees[i]);
+  free(trees);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Done...\n");
+}
+
+void cmd_ml_report(void)
+{
+  long i;
+  long count;
+
+  double * pvalues = parse_real_list(opt_ml_report, "--ml_report", &count);
+  for (i = 0; i < count; ++i)
+    if (pvalues[i] > 1)
+      fatal("P-values in --ml_report must be between 0 and 1");
+
+  rtree_t * rtree = load_tree();
+
+  /* one fill holds the DP vectors of both methods */
+  dp_arena_t * arena = dp_arena_create();
+
+  dp_init(rtree, arena);
   dp_set_pernode_spec_edges(rtree);
-  dp_ptp(rtree, opt_method);
+  dp_fill(rtree, opt_method);
+  dp_ml_report(rtree, pvalues, count);
   dp_free(rtree);
 
+  dp_arena_destroy(arena);
+  free(pvalues);
+
+  /* deallocate tree structure */
+  rtree_destroy(rtree);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Done...\n");
+}
+
+void cmd_ml_topk(void)
+{
+  rtree_t * rtree = load_tree();
+
+  dp_set_pernode_spec_edges(rtree);
+  dp_topk(rtree, opt_method, opt_ml_topk);
+
+  /* deallocate tree structure */
+  rtree_destroy(rtree);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Done...\n");
+}
+
+void cmd_dp_support(void)
+{
+  rtree_t * rtree = load_tree();
+
+  post_support(rtree, opt_method);
+
   if (opt_treeshow)
     rtree_show_ascii(rtree);
 
-  cmd_svg(rtree, opt_seed, "svg");
+  /* deallocate tree structure */
+  rtree_destroy(rtree);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Done...\n");
+}
+
+void cmd_dp_update_check(void)
+{
+  rtree_t * rtree = load_tree();
+
+  dp_update_check(rtree, opt_method, opt_dp_update_check);
 
   /* deallocate tree structure */
   rtree_destroy(rtree);
@@ -535,6 +1055,41 @@ void cmd_ml(void)
     fprintf(stdout, "Done...\n");
 }
 
+void cmd_minbr_sweep(void)
+{
+  rtree_t * rtree = load_tree();
+
+  minbr_sweep(rtree, opt_method);
+
+  /* deallocate tree structure */
+  rtree_destroy(rtree);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Done...\n");
+}
+
+void cmd_root_scan(void)
+{
+  unsigned int tip_count;
+
+  if (opt_crop)
+    fatal("--outgroup_crop cannot be used with --root_scan");
+
+  if (!opt_quiet)
+    fprintf(stdout, "Parsing tree file...\n");
+
+  utree_t * utree = utree_parse_newick(opt_treefile, &tip_count);
+  if (!utree)
+    fatal("--root_scan requires an unrooted tree");
+
+  root_scan(utree, tip_count, opt_method);
+
+  utree_destroy(utree);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Done...\n");
+}
+
 void cmd_multirun(void)
 {
   if (opt_mcmc_steps == 0)
@@ -599,6 +1154,8 @@ int main (int argc, char * argv[])
 
   args_init(argc, argv);
 
+  cpu_features_detect();
+
   show_header();
 
   /* init random number generator and maintain compatibility with srand48 */
@@ -616,11 +1173,40 @@ int main (int argc, char * argv[])
   {
     cmd_multirun();
   }
+  else if (opt_ml && opt_batch)
+  {
+    cmd_ml_batch();
+  }
   else if (opt_ml)
   {
     cmd_ml();
   }
+  else if (opt_minbr_sweep)
+  {
+    cmd_minbr_sweep();
+  }
+  else if (opt_root_scan)
+  {
+    cmd_root_scan();
+  }
+  else if (opt_ml_report)
+  {
+    cmd_ml_report();
+  }
+  else if (opt_ml_topk)
+  {
+    cmd_ml_topk();
+  }
+  else if (opt_dp_support)
+  {
+    cmd_dp_support();
+  }
+  else if (opt_dp_update_check)
+  {
+    cmd_dp_update_check();
+  }
 
+  loglikelihood_table_free();
   free(cmdline);
   return (0);
 }
@@ -34,6 +34,7 @@
 #include <limits.h>
 #include <locale.h>
 #include <math.h>
+#include <float.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -102,6 +103,52 @@
 #define PTP_METHOD_SINGLE       0
 #define PTP_METHOD_MULTI        1
 
+/* minimum number of tips of a clade for being filled as a separate task
+   when the DP runs on multiple threads */
+#define DP_TASK_MINLEAVES       256
+
+/* flags of nodes affected by tree edits for dp_update(). A node is on the
+   path of an edit, the edges to its children changed, or its DP vector has
+   to be recomputed */
+#define DP_DIRTY_PATH           1
+#define DP_DIRTY_CHILDREN       2
+#define DP_DIRTY_MERGE          4
+
+/* maximum number of refills of the beam DP under fixed rates (--beam) */
+#define DP_BEAM_ROUNDS          10
+
+/* constraints on the event of a node (--constraints). The node is the root
+   of a species, lies within a species (root or not), is a speciation event,
+   or lies below the root of a constrained species and is not filled by the
+   DP */
+#define CONSTRAINT_COALESCENT   1
+#define CONSTRAINT_JOIN         2
+#define CONSTRAINT_SPLIT        4
+#define CONSTRAINT_INSIDE       8
+
+/* a DP table filled in single precision (--dp_float) is accepted if every
+   candidate it selected, within the DP and at the root, wins by more than
+   this many times the estimated rounding errors of the two scores */
+#define DP_FLOAT_TOLERANCE      4
+
+/* coefficients of the rational approximation used by the vectorized
+   logarithm in likelihood_sse41.c, likelihood_avx.c and likelihood_avx2.c
+   (Cephes library) */
+#define LOG_SQRT2    1.41421356237309504880
+#define LOG_LN2_HI   0.693359375
+#define LOG_LN2_LO   2.121944400546905827679e-4
+#define LOG_P0       1.01875663804580931796e-4
+#define LOG_P1       4.97494994976747001425e-1
+#define LOG_P2       4.70579119878881725854e0
+#define LOG_P3       1.44989225341610930846e1
+#define LOG_P4       1.79368678507819816313e1
+#define LOG_P5       7.70838733755885391666e0
+#define LOG_Q0       1.12873587189167450590e1
+#define LOG_Q1       4.52279145837532221105e1
+#define LOG_Q2       8.29875266912776603211e1
+#define LOG_Q3       7.11544750618563894466e1
+#define LOG_Q4       2.31251620126765340583e1
+
 #define REGEX_REAL   "([-+]?[0-9]*\\.?[0-9]+([eE][-+]?[0-9]+)?)"
 
 /* structures and data types */
@@ -110,26 +157,110 @@ typedef unsigned int UINT32;
 typedef unsigned short WORD;
 typedef unsigned char BYTE;
 
+/* DP vector of a node stored as separate arrays indexed by the number of
+   speciation edges in the subtree */
 typedef struct dp_vector_s
 {
   /* sum of speciation edge lengths of current subtree */
-  double spec_edgelen_sum;
+  double * spec_edgelen_sum;
 
   /* coalescent logl of subtree for multi lambda */
-  double coal_multi_logl;
+  double * coal_multi_logl;
 
-  /* best single- and multi-rate log-likelihood for current subtree */
-  double score_multi;
-  double score_single;
+  /* the two arrays above in single precision (--dp_float), in which case
+     the double precision ones are NULL */
+  float * spec_edgelen_sum_f;
+  float * coal_multi_logl_f;
 
-  /* back-tracking information */
-  int vec_left;
-  int vec_right;
+  /* in single precision, whether the choice of each entry, or of an entry
+     it was built from, was within the rounding errors of another candidate
+     and may hence differ in double precision. NULL in double precision */
+  unsigned char * unresolved;
 
-  unsigned int species_count;
-  int filled;
+  /* best single- and multi-rate log-likelihood for current subtree, only
+     stored for the root of the tree */
+  double * score_multi;
+  double * score_single;
+
+  /* back-tracking information, -1 if the entry is the start of a coalescent
+     or not filled (see dp_vec_right for the right child) */
+  int * vec_left;
+
+  unsigned int * species_count;
+
+  /* the two arrays above in 16 bits, used for the nodes whose width and
+     number of tips allow it, in which case the 32-bit ones are NULL */
+  short * vec_left_s;
+  unsigned short * species_count_s;
 } dp_vector_t;
 
+/* candidate partial delimitation of a DP entry in top-K mode, built from
+   the candidates of rank left_rank and right_rank of the two children */
+typedef struct dp_cand_s
+{
+  double score;
+  double spec_edgelen_sum;
+  double coal_multi_logl;
+  unsigned int species_count;
+
+  /* entry of the left child, -1 if the entry is the start of a coalescent */
+  int left;
+  int left_rank;
+  int right_rank;
+
+  /* entry of the candidate itself (beam mode) */
+  int entry;
+} dp_cand_t;
+
+/* candidate of a node together with its entry, its rank and the key by
+   which candidates are ordered (top-K and beam mode) */
+typedef struct dp_cand_key_s
+{
+  dp_cand_t * cand;
+  int index;
+  int rank;
+  double key;
+} dp_cand_key_t;
+
+/* pairs of entries of the two children of a node merged into its entries,
+   whose log-likelihoods are computed as one block (see dp_block_add) */
+typedef struct dp_block_s
+{
+  long count;
+
+  /* child entries (or candidates) of each pair as identified by the caller */
+  int * left;
+  int * right;
+
+  int * spec_edge_count;
+  int * coal_edge_count;
+  double * u_spec_edgelen_sum;
+  double * spec_edgelen_sum;
+  double * coal_edgelen_sum;
+  double * spec_logl;
+  double * coal_logl;
+} dp_block_t;
+
+/* storage for the DP vectors of all nodes of a tree */
+typedef struct dp_arena_s
+{
+  double * spec_edgelen_sum;
+  double * coal_multi_logl;
+  float * spec_edgelen_sum_f;
+  float * coal_multi_logl_f;
+  unsigned char * unresolved;
+  int * filled;
+  long alloc;
+
+  /* vec_left and species_count arrays of all nodes, in 16 or 32 bits */
+  char * index;
+  long index_alloc;
+
+  double * score_multi;
+  double * score_single;
+  long score_alloc;
+} dp_arena_t;
+
 typedef struct utree_s
 {
   char * label;
@@ -177,7 +308,48 @@ typedef struct rtree_s
   double support;
 
   /* dynamic programming vector */
-  dp_vector_t * vector;
+  dp_vector_t vector;
+
+  /* single-rate DP vector when both methods are filled at once (report
+     mode), in which case vector holds the multi-rate one */
+  dp_vector_t vector_single;
+
+  /* indices of the filled entries of the DP vector in increasing order */
+  int * filled_list;
+  int filled_count;
+
+  /* whether the DP vector is kept after filling in low-memory mode */
+  int checkpoint;
+
+  /* DP_DIRTY_* flags of the incremental re-evaluation (dp_update) */
+  int dirty;
+
+  /* CONSTRAINT_* flags of the clade constraints (--constraints) */
+  int constraint;
+
+  /* estimated rounding errors of the speciation edge length sums and of the
+     multi-rate coalescent log-likelihoods of the DP vector, and the largest
+     magnitude of the latter, when the vector is stored in single precision
+     (--dp_float) */
+  double float_spec_error;
+  double float_coal_error;
+  double float_coal_max;
+
+  /* candidates of all DP entries, those of entry i starting at topk_start[i]
+     with the one of dp_merge() followed by the others in decreasing order of
+     score, and their number, in top-K mode (--ml_topk). See dp_topk_list_t
+     for the candidates kept */
+  dp_cand_t * topk;
+  long * topk_start;
+  int * topk_count;
+
+  /* best candidates of the node over all entries and their number, in beam
+     mode (--beam). Once the parent is merged only the ranks of the child
+     candidates are kept, two per candidate, the left one -1 for the start
+     of a coalescent */
+  dp_cand_t * beam;
+  int * beam_ranks;
+  int beam_count;
 
   /* auxialiary data */
   void * data;
@@ -235,6 +407,11 @@ typedef struct pair_s
   size_t index;
 } pair_t;
 
+typedef struct threadpool_s threadpool_t;
+
+/* the state of one MCMC run, defined in aic.c */
+typedef struct mcmc_s mcmc_t;
+
 /* macros */
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
@@ -272,7 +449,11 @@ extern long opt_svg_marginright;
 extern long opt_svg_margintop;
 extern long opt_svg_marginbottom;
 extern long opt_svg_inner_radius;
+extern long opt_threads;
+extern long opt_lowmem;
 extern double opt_mcmc_credible;
+extern double opt_mcmc_heat;
+extern double opt_mcmc_stop;
 extern double opt_svg_legend_ratio;
 extern double opt_pvalue;
 extern double opt_minbr;
@@ -280,6 +461,24 @@ extern char * opt_treefile;
 extern char * opt_outfile;
 extern char * opt_outgroup;
 extern char * opt_pdist_file;
+extern char * opt_minbr_sweep;
+extern char * opt_root_scan;
+extern char * opt_ml_report;
+extern long opt_ml_topk;
+extern long opt_dp_support;
+extern long opt_min_species;
+extern long opt_max_species;
+extern long opt_beam;
+extern long opt_beam_check;
+extern long opt_dp_update_check;
+extern long opt_dp_float;
+extern char * opt_constraints;
+extern long opt_batch;
+extern long opt_mcmc_chains;
+extern long opt_mcmc_swap;
+extern long opt_mcmc_diag;
+extern long opt_mcmc_checkpoint;
+extern long opt_resume;
 extern char * cmdline;
 
 /* common data */
@@ -316,9 +515,12 @@ char * xstrdup(const char * s);
 char * xstrndup(const char * s, size_t len);
 long getusec(void);
 FILE * xopen(const char * filename, const char * mode);
+void xfwrite(const void * ptr, size_t size, size_t count, FILE * fp);
+void xfread(void * ptr, size_t size, size_t count, FILE * fp);
 void random_init(unsigned short * rstate, long seedval);
 double mptp_erand48(unsigned short * rstate);
 long mptp_nrand48(unsigned short * rstate); 
+double * parse_real_list(const char * list, const char * option, long * count);
 
 /* functions in mptp.c */
 
@@ -328,17 +530,27 @@ void getentirecommandline(int argc, char * argv[]);
 void fillheader(void);
 void show_header(void);
 void cmd_ml(void);
+void cmd_ml_batch(void);
 void cmd_multirun(void);
 void cmd_auto(void);
+void cmd_minbr_sweep(void);
+void cmd_root_scan(void);
+void cmd_ml_report(void);
+void cmd_ml_topk(void);
+void cmd_dp_support(void);
+void cmd_dp_update_check(void);
 
 /* functions in parse_rtree.y */
 
 rtree_t * rtree_parse_newick(const char * filename);
+rtree_t * rtree_parse_newick_stream(FILE * stream);
 void rtree_destroy(rtree_t * root);
 
 /* functions in parse_utree.y */
 
 utree_t * utree_parse_newick(const char * filename, unsigned int * tip_count);
+utree_t * utree_parse_newick_stream(FILE * stream,
+                                     unsigned int * tip_count);
 
 void utree_destroy(utree_t * root);
 
@@ -355,6 +567,10 @@ int utree_traverse(utree_t * root,
 utree_t * utree_longest_branchtip(utree_t * node, unsigned int tip_count);
 utree_t * utree_outgroup_lca(utree_t * root, unsigned int tip_count);
 rtree_t * utree_crop(utree_t * lca);
+utree_t ** utree_tipstring_nodes(utree_t * root,
+                                 char * tipstring,
+                                 unsigned int utree_tip_count,
+                                 unsigned int * tiplist_count);
 
 /* functions in rtree.c */
 
@@ -363,7 +579,11 @@ char * rtree_export_newick(rtree_t * root);
 int rtree_query_tipnodes(rtree_t * root, rtree_t ** node_list);
 int rtree_query_innernodes(rtree_t * root, rtree_t ** node_list);
 void rtree_reset_info(rtree_t * root);
+void rtree_update_info(rtree_t * node);
 void rtree_print_tips(rtree_t * node, FILE * out);
+char * rtree_tip_labels(rtree_t * node);
+int rtree_preorder(rtree_t * root, rtree_t ** outbuffer);
+int rtree_postorder(rtree_t * root, rtree_t ** outbuffer);
 int rtree_traverse(rtree_t * root,
                    int (*cbtrav)(rtree_t *),
                    unsigned short * rstate,
@@ -373,6 +593,9 @@ int rtree_traverse_postorder(rtree_t * root,
                              int (*cbtrav)(rtree_t *),
                              rtree_t ** outbuffer);
 rtree_t * get_outgroup_lca(rtree_t * root);
+rtree_t ** rtree_tipstring_nodes(rtree_t * root,
+                                 char * tipstring,
+                                 unsigned int * tiplist_count);
 rtree_t * rtree_lca(rtree_t * root,
                     rtree_t ** tip_nodes,
                     unsigned int count);
@@ -394,13 +617,78 @@ void lca_destroy(void);
 unsigned long arch_get_memused(void);
 unsigned long arch_get_memtotal(void);
 long arch_get_cores(void);
+void cpu_features_detect(void);
 
 /* functions in dp.c */
 
-void dp_init(rtree_t * tree);
+dp_arena_t * dp_arena_create(void);
+void dp_arena_destroy(dp_arena_t * arena);
+void dp_init(rtree_t * tree, dp_arena_t * arena);
 void dp_free(rtree_t * tree);
+void dp_fill(rtree_t * tree, long method);
+void dp_fill_threads(rtree_t * tree, long method, long threads);
+void dp_fill_stats(rtree_t * node,
+                   long * filled,
+                   long * entries,
+                   long * visited,
+                   long * pairs);
 void dp_ptp(rtree_t * rtree, long method);
+int dp_float_verify(rtree_t * tree, long method);
+void dp_ml_report(rtree_t * tree, double * pvalues, long pvalues_count);
+long dp_ptp_croots(rtree_t * tree,
+                   long method,
+                   double * logl,
+                   double * pvalue,
+                   int * lrt_pass,
+                   rtree_t ** croots);
+long dp_ml_croots(rtree_t * tree,
+                  long method,
+                  double * logl,
+                  bool * warning_minbr,
+                  rtree_t ** croots);
+void dp_ptp_write(rtree_t * tree,
+                  long method,
+                  double max,
+                  unsigned int species_count,
+                  rtree_t ** croots,
+                  long croots_count,
+                  bool warning_minbr);
+long dp_ptp_summary(rtree_t * tree,
+                    long method,
+                    double * logl,
+                    double * pvalue,
+                    int * lrt_pass);
+double dp_ml_aic(rtree_t * tree, long method);
+void dp_species_check(long count);
+void dp_bounds_init(rtree_t * tree);
+long dp_width(rtree_t * node);
+int dp_species_feasible(rtree_t * node, unsigned int species_count);
+int dp_child_edges(rtree_t * node, double * edgelen_sum);
+void dp_block_alloc(dp_block_t * block, long size);
+void dp_block_free(dp_block_t * block);
+void dp_block_add(dp_block_t * block,
+                  rtree_t * node,
+                  int i,
+                  double u_edgelen_sum,
+                  double v_spec_edgelen_sum,
+                  double w_spec_edgelen_sum,
+                  int left,
+                  int right);
+void dp_block_logl(dp_block_t * block, int coal);
+double dp_block_score(dp_block_t * block,
+                      long x,
+                      long method,
+                      double coal_multi_logl);
 void dp_set_pernode_spec_edges(rtree_t * node);
+void dp_incremental_init(rtree_t * tree, dp_arena_t * arena, long method);
+void dp_mark_dirty(rtree_t * node);
+double dp_update(rtree_t * tree, dp_arena_t * arena, long method);
+void dp_incremental_free(rtree_t * tree);
+int dp_vec_left(rtree_t * node, int index, long method);
+int dp_vec_right(rtree_t * node, int index, long method);
+unsigned int dp_vec_species(rtree_t * node, int index, long method);
+void dp_vector_restore(rtree_t * node, long method);
+void dp_vector_release(rtree_t * node);
 
 /* functions in svg.c */
 
@@ -408,7 +696,40 @@ void cmd_svg(rtree_t * rtree, long seed, const char * ext);
 
 /* functions in likelihood.c */
 
+void loglikelihood_table_init(long max_edge_count);
+void loglikelihood_table_free(void);
 double loglikelihood(long edge_count, double edgelen_sum);
+void loglikelihood_batch(const int * edge_count,
+                         const double * edgelen_sum,
+                         double * out,
+                         long count);
+
+/* functions in likelihood_sse41.c */
+
+void loglikelihood_batch_sse41(const int * edge_count,
+                               const double * edgelen_sum,
+                               const double * nlogn,
+                               long nlogn_size,
+                               double * out,
+                               long count);
+
+/* functions in likelihood_avx.c */
+
+void loglikelihood_batch_avx(const int * edge_count,
+                             const double * edgelen_sum,
+                             const double * nlogn,
+                             long nlogn_size,
+                             double * out,
+                             long count);
+
+/* functions in likelihood_avx2.c */
+
+void loglikelihood_batch_avx2(const int * edge_count,
+                              const double * edgelen_sum,
+                              const double * nlogn,
+                              long nlogn_size,
+                              double * out,
+                              long count);
 int lrt(double nullmodel_logl, double ptp_logl, unsigned int df, double * pvalue);
 double aic(double logl, long k, long n);
 
@@ -425,6 +746,7 @@ void output_info(FILE * out,
 void output_minbr(double minbr);
 
 FILE * open_file_ext(const char * extension, long seed);
+FILE * open_file_ext_mode(const char * extension, long seed, const char * mode);
 
 /* functions in svg_landscape.c */
 
@@ -446,6 +768,42 @@ double random_delimitation(rtree_t * root,
 
 void multirun(rtree_t * root, long method);
 
+/* functions in topk.c */
+
+void dp_topk(rtree_t * tree, long method, long k);
+int dp_cand_key_cmp(const void * va, const void * vb);
+
+/* functions in beam.c */
+
+void dp_beam(rtree_t * tree, long method, long width);
+
+/* functions in update.c */
+
+void dp_update_check(rtree_t * root, long method, long edits);
+
+/* functions in sweep.c */
+
+void minbr_sweep(rtree_t * root, long method);
+void root_scan(utree_t * utree, unsigned int tip_count, long method);
+
+/* functions in batch.c */
+
+void ml_batch(rtree_t ** trees, long count, long method);
+
+/* functions in constraints.c */
+
+void constraints_load(rtree_t * root, const char * filename);
+
+/* functions in convergence.c */
+
+double conv_asdsf(double ** support, long runs, long count);
+double conv_psrf(double ** trace, long runs, long n);
+double conv_ess(double * trace, long n);
+
+/* functions in posterior.c */
+
+void post_support(rtree_t * root, long method);
+
 /* functions in fasta.c */
 
 pll_fasta_t * pll_fasta_open(const char * filename,
@@ -469,7 +827,26 @@ void detect_min_bl(rtree_t * rtree);
 
 /* functions in aic.c */
 
+mcmc_t * aic_mcmc_start(rtree_t * tree,
+                        rtree_t * mltree,
+                        long method,
+                        unsigned short * rstate,
+                        long seed,
+                        double heat,
+                        FILE * out);
+void aic_mcmc_run_steps(mcmc_t * mcmc, long steps);
+void aic_mcmc_run(mcmc_t * mcmc);
+int aic_mcmc_swap(mcmc_t * a, mcmc_t * b, unsigned short * rstate);
+long aic_mcmc_support(mcmc_t * mcmc, double * support);
+double * aic_mcmc_trace(mcmc_t * mcmc, long * count);
+void aic_mcmc_stop(mcmc_t * mcmc);
+void aic_mcmc_save(mcmc_t * mcmc, FILE * fp);
+void aic_mcmc_load(mcmc_t * mcmc, FILE * fp);
+void aic_mcmc_finish(mcmc_t * mcmc,
+                     double * mcmc_min_logl,
+                     double * mcmc_max_logl);
 void aic_mcmc(rtree_t * tree,
+              rtree_t * mltree,
               long method,
               unsigned short * rstate,
               long seed,
@@ -512,3 +889,18 @@ void list_clear(list_t * list, void (*cb_dealloc)(void *));
 list_t * list_create(void * data);
 
 void hashtable_destroy(hashtable_t * ht, void (*cb_dealloc)(void *));
+
+/* functions in threads.c */
+
+threadpool_t * threadpool_create(long threads);
+
+long threadpool_size(threadpool_t * pool);
+
+void threadpool_submit(threadpool_t * pool,
+                       long worker,
+                       void (*cb)(void *, long),
+                       void * data);
+
+void threadpool_wait(threadpool_t * pool);
+
+void threadpool_destroy(threadpool_t * pool);
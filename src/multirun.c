@@ -24,6 +24,10 @@
 #define MPTP_INNER_CROOT 1
 #define MPTP_TIP_CROOT   2
 
+#define MPTP_CHECKPOINT_MAGIC "MPTPCKP2"
+#define MPTP_CHECKPOINT_OPTIONS 9
+#define MPTP_CHECKPOINT_REALS   2
+
 static double asv(int * mlcroots, double * support, int count)
 {
   int i;
@@ -47,81 +51,606 @@ static double asv(int * mlcroots, double * support, int count)
   return sum / croots_count;
 }
 
-static void extract_croots_recursive(rtree_t * node,
-                                     int * index,
-                                     int * outbuffer)
+/* extract the coalescent root flags of the nodes of a tree into an array, in
+   preorder and skipping subtrees without edges longer than minbr */
+static int extract_croots(rtree_t * root, int * outbuffer)
 {
-  if (!node->edge_count) return;
+  int index = 0;
+  int count = 0;
+  long top = 0;
+
+  if (!root->edge_count) return -1;
 
-  if (node->parent)
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(root->leaves + 1) *
+                                         sizeof(rtree_t *));
+  stack[top++] = root;
+  while (top)
   {
-    outbuffer[*index] = 0;
-    if (node->event == EVENT_COALESCENT &&
-        node->parent->event == EVENT_SPECIATION)
+    rtree_t * node = stack[--top];
+
+    if (!node->edge_count) continue;
+
+    outbuffer[index] = 0;
+    if (node->parent)
     {
-      outbuffer[*index] = MPTP_INNER_CROOT;
+      if (node->event == EVENT_COALESCENT &&
+          node->parent->event == EVENT_SPECIATION)
+      {
+        outbuffer[index] = MPTP_INNER_CROOT;
+      }
+      else
+      {
+        if ((node->event == EVENT_SPECIATION) && (node->left->edge_count == 0 || node->right->edge_count == 0))
+          outbuffer[index] = MPTP_TIP_CROOT;
+      }
     }
     else
     {
-      if ((node->event == EVENT_SPECIATION) && (node->left->edge_count == 0 || node->right->edge_count == 0))
-        outbuffer[*index] = MPTP_TIP_CROOT;
+      if (node->event == EVENT_COALESCENT)
+        outbuffer[index] = MPTP_INNER_CROOT;
     }
 
+    if (outbuffer[index])
+      ++count;
+    ++index;
+
+    stack[top++] = node->right;
+    stack[top++] = node->left;
   }
-  else
-  {
-    outbuffer[*index] = 0;
-    if (node->event == EVENT_COALESCENT)
-      outbuffer[*index] = MPTP_INNER_CROOT;
-  }
-  
-  *index = *index+1;
 
-  extract_croots_recursive(node->left,  index, outbuffer);
-  extract_croots_recursive(node->right, index, outbuffer);
+  free(stack);
+  return count;
 }
 
-/* recursively extract support values from a tree into an array */
-static int extract_croots(rtree_t * root, int * outbuffer)
+/* extract support values from a tree into an array, in the same order as
+   extract_croots */
+static int extract_support(rtree_t * root, double * outbuffer)
 {
   int index = 0;
-  int count = 0;
-  int i;
+  long top = 0;
 
   if (!root->edge_count) return -1;
 
-  extract_croots_recursive(root, &index, outbuffer);
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(root->leaves + 1) *
+                                         sizeof(rtree_t *));
+  stack[top++] = root;
+  while (top)
+  {
+    rtree_t * node = stack[--top];
 
-  for (i = 0; i < index; ++i)
-    if (outbuffer[i])
-      ++count;
+    if (!node->edge_count) continue;
 
-  return count;
+    outbuffer[index++] = node->support;
+
+    stack[top++] = node->right;
+    stack[top++] = node->left;
+  }
+
+  free(stack);
+  return index;
 }
 
-static void extract_support_recursive(rtree_t * node,
-                                      int * index,
-                                      double * outbuffer)
+static void cb_mcmc_run(void * data, long worker)
 {
-  if (!node->edge_count) return;
+  aic_mcmc_run((mcmc_t *)data);
+}
 
-  outbuffer[*index] = node->support;
-  *index = *index + 1;
+/* chain advanced by the given number of steps in one stage of
+   multirun_staged */
+typedef struct mcmc_stage_s
+{
+  mcmc_t * mcmc;
+  long steps;
+} mcmc_stage_t;
 
-  extract_support_recursive(node->left,  index, outbuffer);
-  extract_support_recursive(node->right, index, outbuffer);
+static void cb_mcmc_stage(void * data, long worker)
+{
+  mcmc_stage_t * stage = (mcmc_stage_t *)data;
+
+  aic_mcmc_run_steps(stage->mcmc, stage->steps);
 }
 
-/* recursively extract support values from a tree into an array */
-static int extract_support(rtree_t * root, double * outbuffer)
+/* Copy the buffered progress messages of a run to stdout */
+static void flush_run_output(FILE * fp)
 {
-  int index = 0;
+  size_t n;
+  char buffer[4096];
 
-  if (!root->edge_count) return -1;
+  rewind(fp);
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    fwrite(buffer, 1, n, stdout);
+  fclose(fp);
+}
 
-  extract_support_recursive(root, &index, outbuffer);
+/* Add the support values of a finished run to the combined ones, and write
+   its tree, SVG and log-likelihood landscape */
+static void run_output(rtree_t * tree,
+                       long seed,
+                       double mcmc_min_logl,
+                       double mcmc_max_logl,
+                       double * combined_val,
+                       rtree_t ** inner_node_list)
+{
+  long j;
 
-  return index;
+  /* add up support values */
+  rtree_query_innernodes(tree, inner_node_list);
+  for (j = 0; j < tree->leaves-1; ++j)
+    combined_val[j] += inner_node_list[j]->support;
+
+
+  /* print SVG log-likelihood landscape of current run given its
+     generated seed */
+  if (opt_mcmc_log)
+  {
+    svg_landscape(mcmc_min_logl, mcmc_max_logl, seed);
+  }
+
+  /* output SVG tree with support values for current run */
+  char * newick = rtree_export_newick(tree);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Creating tree with support values in %s.%ld.tree ...\n",
+            opt_outfile,
+            seed);
+
+  FILE * newick_fp = open_file_ext("tree", seed);
+  fprintf(newick_fp, "%s\n", newick);
+  fclose(newick_fp);
+
+  cmd_svg(tree, seed, "svg");
+
+  free(newick);
+}
+
+/* Compute the convergence diagnostics of the cold chains of the runs at the
+   given step: the ASDSF of the current support values and the PSRF of the
+   sampled log-likelihoods across runs, and the ESS of the log-likelihoods
+   of each run. Returns whether the ASDSF reached the threshold of
+   --mcmc_stop */
+static int check_convergence(mcmc_t ** runs, long leaves, long step)
+{
+  long i;
+  long n = 0;
+  long count = 0;
+  int converged = 0;
+  double min_ess = 0;
+
+  double ** support = (double **)xmalloc((size_t)opt_mcmc_runs *
+                                         sizeof(double *));
+  double ** trace = (double **)xmalloc((size_t)opt_mcmc_runs *
+                                       sizeof(double *));
+
+  for (i = 0; i < opt_mcmc_runs; ++i)
+  {
+    long run_count, run_n;
+    mcmc_t * mcmc = runs[i*opt_mcmc_chains];
+
+    support[i] = (double *)xmalloc((size_t)leaves * sizeof(double));
+    run_count = aic_mcmc_support(mcmc, support[i]);
+    trace[i] = aic_mcmc_trace(mcmc, &run_n);
+
+    double ess = conv_ess(trace[i], run_n);
+
+    if (i == 0 || run_count < count) count = run_count;
+    if (i == 0 || run_n < n) n = run_n;
+    if (i == 0 || ess < min_ess) min_ess = ess;
+  }
+
+  if (count && n >= 2)
+  {
+    if (opt_mcmc_runs > 1)
+    {
+      double asdsf = conv_asdsf(support, opt_mcmc_runs, count);
+      double psrf = conv_psrf(trace, opt_mcmc_runs, n);
+
+      if (!opt_quiet)
+        fprintf(stdout,
+                "Step %ld: ASDSF %f, PSRF of log-L %f, minimum ESS of "
+                "log-L %.1f\n",
+                step,
+                asdsf,
+                psrf,
+                min_ess);
+
+      if (opt_mcmc_stop && asdsf <= opt_mcmc_stop)
+        converged = 1;
+    }
+    else if (!opt_quiet)
+      fprintf(stdout, "Step %ld: ESS of log-L %.1f\n", step, min_ess);
+  }
+
+  for (i = 0; i < opt_mcmc_runs; ++i)
+    free(support[i]);
+  free(support);
+  free(trace);
+
+  return converged;
+}
+
+static char * checkpoint_filename(void)
+{
+  char * filename = NULL;
+
+  if (asprintf(&filename, "%s.%ld.checkpoint", opt_outfile, opt_seed) == -1)
+    fatal("Unable to allocate enough memory.");
+
+  return filename;
+}
+
+/* The options a checkpoint depends on. A run is only resumed with the same
+   options, such that it continues exactly as without the interruption */
+static void checkpoint_options(long * options,
+                               double * reals,
+                               long leaves,
+                               long method)
+{
+  options[0] = leaves;
+  options[1] = method;
+  options[2] = opt_mcmc_runs;
+  options[3] = opt_mcmc_chains;
+  options[4] = opt_mcmc_burnin;
+  options[5] = opt_mcmc_sample;
+  options[6] = opt_mcmc_swap;
+  options[7] = opt_mcmc_log;
+  options[8] = (opt_mcmc_diag != 0);
+
+  reals[0] = opt_mcmc_heat;
+  reals[1] = opt_minbr;
+}
+
+/* Write the state of all chains of all runs after 'step' steps to the
+   checkpoint file. The checkpoint is written to a temporary file and then
+   renamed, hence an interruption never leaves a partial checkpoint */
+static void checkpoint_write(mcmc_t ** runs,
+                             unsigned short * chain_rstates,
+                             long * swaps_proposed,
+                             long * swaps_accepted,
+                             long leaves,
+                             long method,
+                             long step)
+{
+  long i;
+  long count = opt_mcmc_runs * opt_mcmc_chains;
+  char * filename = checkpoint_filename();
+  char * tmpname = NULL;
+
+  if (asprintf(&tmpname, "%s.tmp", filename) == -1)
+    fatal("Unable to allocate enough memory.");
+
+  long options[MPTP_CHECKPOINT_OPTIONS];
+  double reals[MPTP_CHECKPOINT_REALS];
+  checkpoint_options(options, reals, leaves, method);
+
+  FILE * fp = xopen(tmpname, "wb");
+
+  xfwrite(MPTP_CHECKPOINT_MAGIC, 1, 8, fp);
+  xfwrite(options, sizeof(long), MPTP_CHECKPOINT_OPTIONS, fp);
+  xfwrite(reals, sizeof(double), MPTP_CHECKPOINT_REALS, fp);
+  xfwrite(&step, sizeof(long), 1, fp);
+  xfwrite(chain_rstates, sizeof(unsigned short), (size_t)count * 3, fp);
+  xfwrite(swaps_proposed, sizeof(long), (size_t)count, fp);
+  xfwrite(swaps_accepted, sizeof(long), (size_t)count, fp);
+
+  for (i = 0; i < count; ++i)
+    aic_mcmc_save(runs[i], fp);
+
+  xfwrite(MPTP_CHECKPOINT_MAGIC, 1, 8, fp);
+
+  if (fflush(fp) || fsync(fileno(fp)) || fclose(fp))
+    fatal("Unable to write checkpoint %s", tmpname);
+
+  if (rename(tmpname, filename))
+    fatal("Unable to write checkpoint %s", filename);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Checkpoint at step %ld written in %s ...\n",
+            step,
+            filename);
+
+  free(tmpname);
+  free(filename);
+}
+
+/* Restore the state of the started chains of all runs from the checkpoint
+   file and return the step it was written at */
+static long checkpoint_read(mcmc_t ** runs,
+                            unsigned short * chain_rstates,
+                            long * swaps_proposed,
+                            long * swaps_accepted,
+                            long leaves,
+                            long method)
+{
+  long i;
+  long step;
+  long count = opt_mcmc_runs * opt_mcmc_chains;
+  char magic[8];
+  char * filename = checkpoint_filename();
+
+  FILE * fp = xopen(filename, "rb");
+
+  xfread(magic, 1, 8, fp);
+  if (memcmp(magic, MPTP_CHECKPOINT_MAGIC, 8))
+    fatal("File %s is not an mptp checkpoint", filename);
+
+  /* compare the stored options with the current ones */
+  long options[MPTP_CHECKPOINT_OPTIONS];
+  long stored_options[MPTP_CHECKPOINT_OPTIONS];
+  double reals[MPTP_CHECKPOINT_REALS];
+  double stored_reals[MPTP_CHECKPOINT_REALS];
+
+  checkpoint_options(options, reals, leaves, method);
+  xfread(stored_options, sizeof(long), MPTP_CHECKPOINT_OPTIONS, fp);
+  xfread(stored_reals, sizeof(double), MPTP_CHECKPOINT_REALS, fp);
+
+  if (memcmp(options, stored_options, sizeof(options)) ||
+      memcmp(reals, stored_reals, sizeof(reals)))
+    fatal("Checkpoint %s was written for a different tree or with different "
+          "MCMC options", filename);
+
+  xfread(&step, sizeof(long), 1, fp);
+  if (step < 1 || step > opt_mcmc_steps)
+    fatal("Checkpoint %s was written at step %ld, after the last step of "
+          "--mcmc", filename, step);
+
+  xfread(chain_rstates, sizeof(unsigned short), (size_t)count * 3, fp);
+  xfread(swaps_proposed, sizeof(long), (size_t)count, fp);
+  xfread(swaps_accepted, sizeof(long), (size_t)count, fp);
+
+  for (i = 0; i < count; ++i)
+    aic_mcmc_load(runs[i], fp);
+
+  xfread(magic, 1, 8, fp);
+  if (memcmp(magic, MPTP_CHECKPOINT_MAGIC, 8) || fgetc(fp) != EOF)
+    fatal("Corrupted checkpoint %s", filename);
+
+  fclose(fp);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Resuming from step %ld of checkpoint %s ...\n",
+            step,
+            filename);
+
+  free(filename);
+  return step;
+}
+
+/* Sample the runs in stages: the runs are started one after the other, as
+   they share the DP table of the ML tree, then sampled concurrently, and
+   finished in order. Progress messages of concurrent runs are buffered per
+   run so that the output is the same as for sequential runs.
+
+   With --mcmc_chains each run is Metropolis-coupled (MC^3): besides its
+   cold chain it has heated chains k = 1..chains-1 on clones of its tree
+   whose AIC weights are raised to 1/(1 + k * heat). The chains of all runs
+   are advanced in blocks of --mcmc_swap steps on the thread pool, and after
+   each block an exchange of the delimitations of two neighbouring chains is
+   proposed in every run. Support values are only collected by the cold
+   chain. Heated chain k draws from a generator seeded with the run seed
+   plus k, and the exchanges from one seeded with the run seed plus the
+   number of chains.
+
+   With --mcmc_diag the stages also end every --mcmc_diag steps, where the
+   convergence of the runs is checked and, with --mcmc_stop, all runs are
+   ended once they converged.
+
+   With --mcmc_checkpoint the state of all chains is written every
+   --mcmc_checkpoint steps, after the swaps of that step, and --resume
+   continues from the last checkpoint instead of step 1 */
+static void multirun_staged(rtree_t ** trees,
+                            rtree_t * mltree,
+                            long method,
+                            unsigned short ** rstates,
+                            long * seeds,
+                            double * mcmc_min_logl,
+                            double * mcmc_max_logl,
+                            double * combined_val,
+                            rtree_t ** inner_node_list)
+{
+  long i,k;
+  long chains = opt_mcmc_chains;
+  long count = opt_mcmc_runs * chains;
+  int buffered = (opt_mcmc_runs > 1);
+  double min_logl, max_logl;
+
+  /* chain k of run i is at index i*chains + k, the cold chain is k = 0 */
+  mcmc_t ** runs = (mcmc_t **)xmalloc((size_t)count * sizeof(mcmc_t *));
+  rtree_t ** chain_trees = (rtree_t **)xmalloc((size_t)count *
+                                               sizeof(rtree_t *));
+  unsigned short * chain_rstates;
+  chain_rstates = (unsigned short *)xmalloc((size_t)count * 3 *
+                                            sizeof(unsigned short));
+  mcmc_stage_t * stages = (mcmc_stage_t *)xmalloc((size_t)count *
+                                                 sizeof(mcmc_stage_t));
+  long * swaps_proposed = (long *)xcalloc((size_t)count, sizeof(long));
+  long * swaps_accepted = (long *)xcalloc((size_t)count, sizeof(long));
+  FILE ** runs_out = (FILE **)xmalloc((size_t)opt_mcmc_runs *
+                                      sizeof(FILE *));
+
+  for (i = 0; i < opt_mcmc_runs; ++i)
+  {
+    runs_out[i] = stdout;
+    if (buffered)
+    {
+      runs_out[i] = tmpfile();
+      if (!runs_out[i])
+        fatal("Unable to create temporary file");
+    }
+    else if (!opt_quiet)
+      fprintf(stdout, "\nMCMC run %ld...\n", i);
+
+    runs[i*chains] = aic_mcmc_start(trees[i],
+                                    mltree,
+                                    method,
+                                    rstates[i],
+                                    seeds[i],
+                                    1,
+                                    runs_out[i]);
+
+    for (k = 1; k < chains; ++k)
+    {
+      unsigned short * rstate = chain_rstates + 3*(i*chains + k);
+
+      random_init(rstate, seeds[i] + k);
+      chain_trees[i*chains + k] = rtree_clone(trees[i], NULL);
+      runs[i*chains + k] = aic_mcmc_start(chain_trees[i*chains + k],
+                                          mltree,
+                                          method,
+                                          rstate,
+                                          seeds[i] + k,
+                                          1 / (1 + k*opt_mcmc_heat),
+                                          NULL);
+    }
+
+    random_init(chain_rstates + 3*i*chains, seeds[i] + chains);
+  }
+
+  long done = 1;
+  if (opt_resume)
+    done = checkpoint_read(runs,
+                           chain_rstates,
+                           swaps_proposed,
+                           swaps_accepted,
+                           trees[0]->leaves,
+                           method);
+
+  threadpool_t * pool = NULL;
+  if (opt_threads > 1)
+    pool = threadpool_create(MIN(opt_threads, count));
+
+  if (chains == 1 && !opt_mcmc_diag && !opt_mcmc_checkpoint)
+  {
+    for (i = 0; i < count; ++i)
+    {
+      if (pool)
+        threadpool_submit(pool, -1, cb_mcmc_run, runs[i]);
+      else
+        aic_mcmc_run(runs[i]);
+    }
+  }
+  else
+  {
+    /* the chains are advanced in stages that end at the steps where a swap
+       is proposed, the convergence of the runs is checked or a checkpoint
+       is written */
+    while (done < opt_mcmc_steps)
+    {
+      long end = opt_mcmc_steps;
+      if (chains > 1)
+        end = MIN(end, done + opt_mcmc_swap - (done-1) % opt_mcmc_swap);
+      if (opt_mcmc_diag)
+        end = MIN(end, done + opt_mcmc_diag - (done-1) % opt_mcmc_diag);
+      if (opt_mcmc_checkpoint)
+        end = MIN(end,
+                  done + opt_mcmc_checkpoint - (done-1) % opt_mcmc_checkpoint);
+
+      for (i = 0; i < count; ++i)
+      {
+        stages[i].mcmc = runs[i];
+        stages[i].steps = end - done;
+
+        if (pool)
+          threadpool_submit(pool, -1, cb_mcmc_stage, stages + i);
+        else
+          aic_mcmc_run_steps(runs[i], stages[i].steps);
+      }
+      if (pool)
+        threadpool_wait(pool);
+
+      done = end;
+      if (done == opt_mcmc_steps) break;
+
+      if (opt_mcmc_diag && (done-1) % opt_mcmc_diag == 0 &&
+          check_convergence(runs, trees[0]->leaves, done))
+      {
+        for (i = 0; i < count; ++i)
+          aic_mcmc_stop(runs[i]);
+        break;
+      }
+
+      /* propose to exchange the delimitations of chains k and k+1 */
+      if (chains > 1 && (done-1) % opt_mcmc_swap == 0)
+      {
+        for (i = 0; i < opt_mcmc_runs; ++i)
+        {
+          unsigned short * rstate = chain_rstates + 3*i*chains;
+
+          k = mptp_nrand48(rstate) % (chains - 1);
+          swaps_proposed[i*chains + k]++;
+          swaps_accepted[i*chains + k] += aic_mcmc_swap(runs[i*chains + k],
+                                                        runs[i*chains + k + 1],
+                                                        rstate);
+        }
+      }
+
+      if (opt_mcmc_checkpoint && (done-1) % opt_mcmc_checkpoint == 0)
+        checkpoint_write(runs,
+                         chain_rstates,
+                         swaps_proposed,
+                         swaps_accepted,
+                         trees[0]->leaves,
+                         method,
+                         done);
+    }
+
+    if (opt_mcmc_stop && !opt_quiet)
+    {
+      if (done < opt_mcmc_steps)
+        fprintf(stdout,
+                "Runs converged at step %ld (ASDSF at most %f)\n",
+                done,
+                opt_mcmc_stop);
+      else
+        fprintf(stdout,
+                "Runs did not converge within %ld steps (ASDSF above %f)\n",
+                opt_mcmc_steps,
+                opt_mcmc_stop);
+    }
+  }
+
+  if (pool)
+    threadpool_destroy(pool);
+
+  for (i = 0; i < opt_mcmc_runs; ++i)
+  {
+    if (buffered && !opt_quiet)
+      fprintf(stdout, "\nMCMC run %ld...\n", i);
+
+    aic_mcmc_finish(runs[i*chains], mcmc_min_logl+i, mcmc_max_logl+i);
+    if (buffered)
+      flush_run_output(runs_out[i]);
+
+    for (k = 1; k < chains; ++k)
+    {
+      aic_mcmc_finish(runs[i*chains + k], &min_logl, &max_logl);
+      rtree_destroy(chain_trees[i*chains + k]);
+
+      if (!opt_quiet)
+        fprintf(stdout,
+                "Accepted swaps between chains %ld and %ld: %ld / %ld\n",
+                k-1,
+                k,
+                swaps_accepted[i*chains + k-1],
+                swaps_proposed[i*chains + k-1]);
+    }
+
+    run_output(trees[i],
+               seeds[i],
+               mcmc_min_logl[i],
+               mcmc_max_logl[i],
+               combined_val,
+               inner_node_list);
+  }
+
+  free(runs_out);
+  free(stages);
+  free(swaps_accepted);
+  free(swaps_proposed);
+  free(chain_rstates);
+  free(chain_trees);
+  free(runs);
 }
 
 void multirun(rtree_t * root, long method)
@@ -179,50 +708,48 @@ void multirun(rtree_t * root, long method)
   rtree_t ** inner_node_list = (rtree_t **)xmalloc((size_t)(root->leaves-1) *
                                                    sizeof(rtree_t *));
 
-  /* execute each run sequentially  */
-  for (i = 0; i < opt_mcmc_runs; ++i)
-  {
-    dp_init(trees[i]);
-    dp_set_pernode_spec_edges(trees[i]);
-    if (!opt_quiet)
-      fprintf(stdout, "\nMCMC run %ld...\n", i);
-    aic_mcmc(trees[i],
-             method,
-             rstates[i],
-             seeds[i],
-             mcmc_min_logl+i,
-             mcmc_max_logl+i);
-    dp_free(trees[i]);
-
-    /* add up support values */
-    rtree_query_innernodes(trees[i], inner_node_list);
-    for (j = 0; j < trees[i]->leaves-1; ++j)
-      combined_val[j] += inner_node_list[j]->support;
-
+  /* fill the DP table once on the ML tree. It is shared read-only by all
+     runs for their ML starting delimitation and by the ASV computation */
+  dp_arena_t * arena = dp_arena_create();
+  dp_init(mltree, arena);
+  dp_set_pernode_spec_edges(mltree);
+  dp_fill(mltree, method);
 
-    /* print SVG log-likelihood landscape of current run given its
-       generated seed */
-    if (opt_mcmc_log)
+  if (opt_mcmc_chains > 1 || opt_mcmc_diag || opt_mcmc_checkpoint ||
+      opt_resume || (opt_threads > 1 && opt_mcmc_runs > 1))
+  {
+    multirun_staged(trees,
+                    mltree,
+                    method,
+                    rstates,
+                    seeds,
+                    mcmc_min_logl,
+                    mcmc_max_logl,
+                    combined_val,
+                    inner_node_list);
+  }
+  else
+  {
+    /* execute each run sequentially  */
+    for (i = 0; i < opt_mcmc_runs; ++i)
     {
-      svg_landscape(mcmc_min_logl[i], mcmc_max_logl[i], seeds[i]);
+      if (!opt_quiet)
+        fprintf(stdout, "\nMCMC run %ld...\n", i);
+      aic_mcmc(trees[i],
+               mltree,
+               method,
+               rstates[i],
+               seeds[i],
+               mcmc_min_logl+i,
+               mcmc_max_logl+i);
+
+      run_output(trees[i],
+                 seeds[i],
+                 mcmc_min_logl[i],
+                 mcmc_max_logl[i],
+                 combined_val,
+                 inner_node_list);
     }
-
-    /* output SVG tree with support values for current run */
-    char * newick = rtree_export_newick(trees[i]);
-
-    if (!opt_quiet)
-      fprintf(stdout,
-              "Creating tree with support values in %s.%ld.tree ...\n",
-              opt_outfile,
-              seeds[i]);
-
-    FILE * newick_fp = open_file_ext("tree", seeds[i]);
-    fprintf(newick_fp, "%s\n", newick);
-    fclose(newick_fp);
-
-    cmd_svg(trees[i], seeds[i], "svg");
-
-    free(newick);
   }
 
   /* compute the min and max log-l values among all runs */
@@ -256,8 +783,6 @@ void multirun(rtree_t * root, long method)
   }
 
   /* compute ML tree */
-  dp_init(mltree);
-  dp_set_pernode_spec_edges(mltree);
   dp_ptp(mltree, method);
   int * mlcroots = (int *)xmalloc((size_t)(mltree->leaves) * sizeof(int));
   int croots_count = extract_croots(mltree, mlcroots);
@@ -282,30 +807,14 @@ void multirun(rtree_t * root, long method)
   }
 
   dp_free(mltree);
+  dp_arena_destroy(arena);
   rtree_destroy(mltree);
   free(mlcroots);
 
   /* compute the standard deviation of each support value given the runs,
      and then compute a consensus average standard deviation for all support
      values */
-  double mean, var, stdev, avg_stdev = 0;
-  for (i = 0; i < support_count; ++i)
-  {
-    mean = var = stdev = 0;
-    for (j = 0; j < opt_mcmc_runs; ++j)
-      mean += support[j][i];
-
-    mean /= opt_mcmc_runs;
-
-    for (j = 0; j < opt_mcmc_runs; ++j)
-      var += (mean - support[j][i])*(mean - support[j][i]);
-
-    var /= opt_mcmc_runs;
-    stdev = sqrt(var);
-
-    avg_stdev += stdev;
-  }
-  avg_stdev /= support_count;
+  double avg_stdev = conv_asdsf(support, opt_mcmc_runs, support_count);
 
   if (!opt_quiet)
     printf("Average standard deviation of support values among runs: %f\n",
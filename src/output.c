@@ -22,9 +22,14 @@
 #include "mptp.h"
 
 FILE * open_file_ext(const char * extension, long seed)
+{
+  return open_file_ext_mode(extension, seed, "w");
+}
+
+FILE * open_file_ext_mode(const char * extension, long seed, const char * mode)
 {
   char * filename = NULL;
-  if (opt_mcmc)
+  if (opt_mcmc || opt_dp_support)
   {
     if (asprintf(&filename, "%s.%ld.%s", opt_outfile, seed, extension) == -1)
       fatal("Unable to allocate enough memory.");
@@ -35,7 +40,7 @@ FILE * open_file_ext(const char * extension, long seed)
       fatal("Unable to allocate enough memory.");
   }
 
-  FILE * out = xopen(filename,"w");
+  FILE * out = xopen(filename,mode);
 
   free(filename);
 
@@ -25,17 +25,41 @@ extern int rtree_lex();
 extern FILE * rtree_in;
 extern void rtree_lex_destroy();
 
+/* allow nesting as deep as the number of tips of very unbalanced trees */
+#define YYMAXDEPTH 10000000
+
 void rtree_destroy(rtree_t * root)
 {
+  long top = 0;
+  long alloc = 64;
+
   if (!root) return;
 
-  rtree_destroy(root->left);
-  rtree_destroy(root->right);
-  if (root->data)
-    free(root->data);
+  /* nodes may have a single child while the tree is being cropped, so the
+     stack grows on demand instead of being sized by the number of tips */
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)alloc * sizeof(rtree_t *));
+
+  stack[top++] = root;
+  while (top)
+  {
+    rtree_t * node = stack[--top];
 
-  free(root->label);
-  free(root);
+    if (top + 2 > alloc)
+    {
+      alloc *= 2;
+      stack = (rtree_t **)xrealloc(stack, (size_t)alloc * sizeof(rtree_t *));
+    }
+    if (node->left)  stack[top++] = node->left;
+    if (node->right) stack[top++] = node->right;
+
+    if (node->data)
+      free(node->data);
+
+    free(node->label);
+    free(node);
+  }
+
+  free(stack);
 }
 
 
@@ -168,31 +192,39 @@ number: NUMBER   {$$=$1;};
 
 %%
 
-rtree_t * rtree_parse_newick(const char * filename)
+/* Parse one tree from an open stream, which is left open */
+rtree_t * rtree_parse_newick_stream(FILE * stream)
 {
   struct rtree_s * tree;
 
   tree = (rtree_t *)calloc(1, sizeof(rtree_t));
 
-  rtree_in = fopen(filename, "r");
-  if (!rtree_in)
+  rtree_in = stream;
+  if (rtree_parse(tree))
   {
     rtree_destroy(tree);
-    snprintf(errmsg, 200, "Unable to open file (%s)", filename);
-    return NULL;
+    tree = NULL;
   }
-  else if (rtree_parse(tree))
+
+  rtree_lex_destroy();
+
+  return tree;
+}
+
+rtree_t * rtree_parse_newick(const char * filename)
+{
+  rtree_t * tree;
+
+  FILE * stream = fopen(filename, "r");
+  if (!stream)
   {
-    rtree_destroy(tree);
-    tree = NULL;
-    fclose(rtree_in);
-    rtree_lex_destroy();
+    snprintf(errmsg, 200, "Unable to open file (%s)", filename);
     return NULL;
   }
-  
-  if (rtree_in) fclose(rtree_in);
 
-  rtree_lex_destroy();
+  tree = rtree_parse_newick_stream(stream);
+
+  fclose(stream);
 
   return tree;
 }
@@ -186,7 +186,9 @@ number: NUMBER   { $$=$1;};
 
 %%
 
-utree_t * utree_parse_newick(const char * filename, unsigned int * tip_count)
+/* Parse one tree from an open stream, which is left open */
+utree_t * utree_parse_newick_stream(FILE * stream,
+                                     unsigned int * tip_count)
 {
   struct utree_s * tree;
 
@@ -195,27 +197,35 @@ utree_t * utree_parse_newick(const char * filename, unsigned int * tip_count)
 
   tree = (utree_t *)calloc(1, sizeof(utree_t));
 
-  utree_in = fopen(filename, "r");
-  if (!utree_in)
+  utree_in = stream;
+  if (utree_parse(tree))
   {
     utree_destroy(tree);
-    snprintf(errmsg, 200, "Unable to open file (%s)", filename);
-    return NULL;
+    tree = NULL;
   }
-  else if (utree_parse(tree))
+
+  utree_lex_destroy();
+
+  if (tree)
+    *tip_count = tip_cnt;
+
+  return tree;
+}
+
+utree_t * utree_parse_newick(const char * filename, unsigned int * tip_count)
+{
+  utree_t * tree;
+
+  FILE * stream = fopen(filename, "r");
+  if (!stream)
   {
-    utree_destroy(tree);
-    tree = NULL;
-    fclose(utree_in);
-    utree_lex_destroy();
+    snprintf(errmsg, 200, "Unable to open file (%s)", filename);
     return NULL;
   }
-  
-  if (utree_in) fclose(utree_in);
 
-  utree_lex_destroy();
+  tree = utree_parse_newick_stream(stream, tip_count);
+
+  fclose(stream);
 
-  *tip_count = tip_cnt;
-  
   return tree;
 }
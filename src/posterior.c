@@ -0,0 +1,681 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+
+/* Support values without MCMC. The target distribution is the one sampled
+   by aic_mcmc(), i.e. each delimitation is weighted by exp(-AIC).
+
+   The PTP likelihood is not a sum over the subtrees, since the rates are
+   estimated from the edges of the whole delimitation. With fixed rates it
+   is, and a sum-product pass over the tree gives, for each node and number
+   of species in its subtree, the log of the total weight of all
+   delimitations of the subtree. Delimitations are drawn independently from
+   this proposal by backward sampling, and are weighted by their exact AIC
+   score relative to the proposal (self-normalized importance sampling).
+
+   A single pair of fixed rates covers the target poorly when it has modes
+   with different rates, hence the proposal is a mixture over a grid of
+   rates around a centre, weighted with the balance heuristic. The centre
+   starts at the rates of the ML delimitation and is moved to the weighted
+   mean rates of a pilot run */
+
+#define POST_GRID_SIZE      5
+#define POST_PILOT_SAMPLES  1000
+#define POST_PILOT_ROUNDS   6
+
+typedef struct post_s
+{
+  double * logz;         /* log-weights of 1..leaves species (index 0 unused) */
+  double spec_logw;      /* log-weight of the speciation edges of the node */
+  int spec_edge_count;   /* child edges longer than minbr */
+  double spec_edgelen_sum;
+} post_t;
+
+/* one component of the proposal mixture */
+typedef struct post_comp_s
+{
+  double rate_spec;
+  double rate_coal;
+  double lognorm;
+} post_comp_t;
+
+/* one sampled delimitation */
+typedef struct post_draw_s
+{
+  long species_count;
+  long spec_edge_count;
+  double spec_edgelen_sum;
+  double coal_multi_logl;
+  double target_logw;
+} post_draw_t;
+
+/* importance-weighted sums of a sampling run */
+typedef struct post_run_s
+{
+  double max_logw;
+  double weight_sum;
+  double weight_sqsum;
+  double ess;
+  double spec_count_sum;
+  double spec_len_sum;
+  double coal_count_sum;
+  double coal_len_sum;
+  double * spec_weight;       /* per inner node, or NULL */
+  double * species_weight;    /* per number of species, or NULL */
+} post_run_t;
+
+/* node lists, buffers and proposal components shared by all runs */
+typedef struct post_ws_s
+{
+  rtree_t ** postorder;
+  rtree_t ** inner_node_list;
+  rtree_t ** stack;
+  long * stack_s;
+  double * terms;
+  double * root_logw;
+  post_comp_t comp[POST_GRID_SIZE*POST_GRID_SIZE];
+  long comp_count;
+} post_ws_t;
+
+static double logsumexp(const double * x, long count)
+{
+  long i;
+  double max = -__DBL_MAX__;
+  double sum = 0;
+
+  for (i = 0; i < count; ++i)
+    if (x[i] > max)
+      max = x[i];
+
+  if (max == -__DBL_MAX__)
+    return max;
+
+  for (i = 0; i < count; ++i)
+    sum += exp(x[i] - max);
+
+  return max + log(sum);
+}
+
+/* log-likelihood of a set of edges under an exponential distribution with a
+   fixed rate */
+static double fixed_rate_logl(long edge_count, double edgelen_sum, double rate)
+{
+  return edge_count * log(rate) - rate * edgelen_sum;
+}
+
+/* speciation and coalescent rates of the ML delimitation */
+static void ml_rates(rtree_t * root,
+                     long method,
+                     double * rate_spec,
+                     double * rate_coal)
+{
+  long i;
+  long top = 0;
+  long spec_edge_count = 0;
+  long coal_edge_count = 0;
+  double spec_edgelen_sum = 0;
+  double coal_edgelen_sum = 0;
+  double logl;
+  double pvalue;
+  int lrt_pass;
+
+  dp_arena_t * arena = dp_arena_create();
+  dp_init(root, arena);
+  dp_set_pernode_spec_edges(root);
+  dp_fill(root, method);
+  dp_ptp_summary(root, method, &logl, &pvalue, &lrt_pass);
+  dp_free(root);
+  dp_arena_destroy(arena);
+
+  /* descend from the root through the speciation nodes */
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(2*root->leaves) *
+                                         sizeof(rtree_t *));
+  stack[top++] = root;
+  while (top)
+  {
+    rtree_t * node = stack[--top];
+
+    if (node->event != EVENT_SPECIATION)
+    {
+      coal_edge_count += node->edge_count;
+      coal_edgelen_sum += node->edgelen_sum;
+      continue;
+    }
+
+    rtree_t * child[2] = { node->left, node->right };
+    for (i = 0; i < 2; ++i)
+    {
+      if (child[i]->length > opt_minbr)
+      {
+        spec_edge_count++;
+        spec_edgelen_sum += child[i]->length;
+      }
+      stack[top++] = child[i];
+    }
+  }
+  free(stack);
+
+  /* fall back to the rate of the whole tree if a process has no edges */
+  double tree_rate = (root->edgelen_sum > __DBL_MIN__) ?
+                       root->edge_count / root->edgelen_sum : 1;
+
+  *rate_spec = (spec_edge_count && spec_edgelen_sum > __DBL_MIN__) ?
+                 spec_edge_count / spec_edgelen_sum : tree_rate;
+  *rate_coal = (coal_edge_count && coal_edgelen_sum > __DBL_MIN__) ?
+                 coal_edge_count / coal_edgelen_sum : tree_rate;
+}
+
+/* largest number of species of a delimitation of the subtree at node */
+static long post_width(rtree_t * node)
+{
+  if (opt_max_species && opt_max_species < node->leaves)
+    return opt_max_species;
+
+  return node->leaves;
+}
+
+/* grid of proposal components around the given rates. The coalescent rate
+   only matters for the single-rate model */
+static void post_set_grid(post_ws_t * ws,
+                          long method,
+                          double rate_spec,
+                          double rate_coal,
+                          double step)
+{
+  long a,b;
+  long coal_grid = (method == PTP_METHOD_SINGLE) ? POST_GRID_SIZE : 1;
+
+  ws->comp_count = 0;
+  for (a = 0; a < POST_GRID_SIZE; ++a)
+    for (b = 0; b < coal_grid; ++b)
+    {
+      post_comp_t * c = ws->comp + ws->comp_count++;
+
+      c->rate_spec = rate_spec * pow(step, a - POST_GRID_SIZE/2);
+      c->rate_coal = (coal_grid == 1) ?
+                       rate_coal : rate_coal * pow(step, b - POST_GRID_SIZE/2);
+      c->lognorm = 0;
+    }
+}
+
+/* Sum-product pass for one component: logz[s] is the log of the summed
+   proposal weight of all delimitations of the subtree at node with s
+   species. The weights are exp(2 logl) to match the exp(-AIC) target. Sets
+   the proposal distribution of the number of species at the root and
+   returns its log-normalizer */
+static double post_fill(rtree_t * root,
+                        post_ws_t * ws,
+                        long method,
+                        post_comp_t * comp)
+{
+  long i,s,a;
+
+  long nodes_count = 2*root->leaves - 1;
+
+  for (i = 0; i < nodes_count; ++i)
+  {
+    rtree_t * node = ws->postorder[i];
+    post_t * p = (post_t *)(node->data);
+
+    if (!p)
+    {
+      p = (post_t *)xcalloc(1, sizeof(post_t));
+      p->logz = (double *)xmalloc((size_t)(post_width(node)+1) *
+                                  sizeof(double));
+      node->data = p;
+    }
+
+    /* the whole subtree is one coalescent */
+    if (method == PTP_METHOD_MULTI)
+      p->logz[1] = 2 * loglikelihood(node->edge_count, node->edgelen_sum);
+    else
+      p->logz[1] = 2 * fixed_rate_logl(node->edge_count,
+                                       node->edgelen_sum,
+                                       comp->rate_coal);
+
+    if (!node->left) continue;
+
+    p->spec_edge_count = 0;
+    p->spec_edgelen_sum = 0;
+    if (node->left->length > opt_minbr)
+    {
+      p->spec_edge_count++;
+      p->spec_edgelen_sum += node->left->length;
+    }
+    if (node->right->length > opt_minbr)
+    {
+      p->spec_edge_count++;
+      p->spec_edgelen_sum += node->right->length;
+    }
+    p->spec_logw = 2 * fixed_rate_logl(p->spec_edge_count,
+                                       p->spec_edgelen_sum,
+                                       comp->rate_spec);
+
+    /* node is a speciation and its children split the s species */
+    post_t * lp = (post_t *)(node->left->data);
+    post_t * rp = (post_t *)(node->right->data);
+    long lleaves = node->left->leaves;
+    long rleaves = node->right->leaves;
+
+    for (s = 2; s <= post_width(node); ++s)
+    {
+      long amin = (s - rleaves > 1) ? s - rleaves : 1;
+      long amax = (s - 1 < lleaves) ? s - 1 : lleaves;
+
+      for (a = amin; a <= amax; ++a)
+        ws->terms[a-amin] = lp->logz[a] + rp->logz[s-a];
+
+      p->logz[s] = p->spec_logw + logsumexp(ws->terms, amax-amin+1);
+    }
+  }
+
+  post_t * rootp = (post_t *)(root->data);
+  for (s = 1; s <= root->leaves; ++s)
+  {
+    double penalty = aic(0, s, root->leaves+2);
+    if (s > post_width(root) || s < opt_min_species || !isfinite(penalty))
+      ws->root_logw[s-1] = -__DBL_MAX__;
+    else
+      ws->root_logw[s-1] = rootp->logz[s] - penalty;
+  }
+
+  return logsumexp(ws->root_logw, root->leaves);
+}
+
+/* draw an index from the distribution proportional to exp(logw[i]) */
+static long sample_index(const double * logw,
+                         long count,
+                         double lognorm,
+                         unsigned short * rstate)
+{
+  long i;
+  double r = mptp_erand48(rstate);
+  double cum = 0;
+
+  for (i = 0; i < count; ++i)
+  {
+    cum += exp(logw[i] - lognorm);
+    if (r < cum)
+      return i;
+  }
+
+  /* rounding, return the last index with non-zero probability */
+  for (i = count-1; i > 0; --i)
+    if (logw[i] > -__DBL_MAX__)
+      break;
+
+  return i;
+}
+
+/* Draw one delimitation with s species from the filled table, setting the
+   event of each node, and compute its exact log-weight under the target */
+static void post_sample(rtree_t * root,
+                        long method,
+                        long s,
+                        post_ws_t * ws,
+                        unsigned short * rstate,
+                        post_draw_t * draw)
+{
+  long top = 0;
+  long a;
+  long spec_edge_count = 0;
+  double spec_edgelen_sum = 0;
+  double coal_multi_logl = 0;
+
+  rtree_t ** stack = ws->stack;
+  long * stack_s = ws->stack_s;
+  double * terms = ws->terms;
+
+  stack[top] = root;
+  stack_s[top++] = s;
+
+  while (top)
+  {
+    --top;
+    rtree_t * node = stack[top];
+    long ns = stack_s[top];
+    post_t * p = (post_t *)(node->data);
+
+    /* 0 marks nodes within a coalescent, 1 the root of a coalescent */
+    if (ns <= 1)
+    {
+      node->event = EVENT_COALESCENT;
+      if (ns == 1)
+        coal_multi_logl += loglikelihood(node->edge_count, node->edgelen_sum);
+      if (node->left)
+      {
+        stack[top] = node->left;
+        stack_s[top++] = 0;
+        stack[top] = node->right;
+        stack_s[top++] = 0;
+      }
+      continue;
+    }
+
+    node->event = EVENT_SPECIATION;
+    spec_edge_count += p->spec_edge_count;
+    spec_edgelen_sum += p->spec_edgelen_sum;
+
+    post_t * lp = (post_t *)(node->left->data);
+    post_t * rp = (post_t *)(node->right->data);
+    long rleaves = node->right->leaves;
+    long amin = (ns - rleaves > 1) ? ns - rleaves : 1;
+    long amax = (ns - 1 < node->left->leaves) ? ns - 1 : node->left->leaves;
+
+    for (a = amin; a <= amax; ++a)
+      terms[a-amin] = lp->logz[a] + rp->logz[ns-a];
+
+    a = amin + sample_index(terms,
+                            amax-amin+1,
+                            p->logz[ns] - p->spec_logw,
+                            rstate);
+
+    stack[top] = node->left;
+    stack_s[top++] = a;
+    stack[top] = node->right;
+    stack_s[top++] = ns - a;
+  }
+
+  /* exact log-likelihood, computed as in aic_mcmc() */
+  double logl;
+  long coal_edge_count = root->edge_count - spec_edge_count;
+  double coal_edgelen_sum = root->edgelen_sum - spec_edgelen_sum;
+
+  if (spec_edge_count == 0 ||
+      (method == PTP_METHOD_SINGLE && coal_edge_count == 0))
+    logl = root->coal_logl;
+  else if (method == PTP_METHOD_SINGLE)
+    logl = loglikelihood(coal_edge_count, coal_edgelen_sum) +
+           loglikelihood(spec_edge_count, spec_edgelen_sum);
+  else
+    logl = coal_multi_logl + loglikelihood(spec_edge_count, spec_edgelen_sum);
+
+  draw->species_count = s;
+  draw->spec_edge_count = spec_edge_count;
+  draw->spec_edgelen_sum = spec_edgelen_sum;
+  draw->coal_multi_logl = coal_multi_logl;
+  draw->target_logw = -aic(logl, s, root->leaves+2);
+}
+
+/* log-probability of a delimitation under the proposal mixture, computed
+   from its edge statistics */
+static double post_mixture_logp(rtree_t * root,
+                                long method,
+                                post_ws_t * ws,
+                                post_draw_t * draw)
+{
+  long k;
+  long coal_edge_count = root->edge_count - draw->spec_edge_count;
+  double coal_edgelen_sum = root->edgelen_sum - draw->spec_edgelen_sum;
+  double penalty = aic(0, draw->species_count, root->leaves+2);
+
+  for (k = 0; k < ws->comp_count; ++k)
+  {
+    post_comp_t * c = ws->comp + k;
+    double coal = (method == PTP_METHOD_MULTI) ?
+                    draw->coal_multi_logl :
+                    fixed_rate_logl(coal_edge_count,
+                                    coal_edgelen_sum,
+                                    c->rate_coal);
+
+    ws->terms[k] = 2 * (fixed_rate_logl(draw->spec_edge_count,
+                                        draw->spec_edgelen_sum,
+                                        c->rate_spec) + coal) -
+                   penalty - c->lognorm;
+  }
+
+  return logsumexp(ws->terms, ws->comp_count) - log(ws->comp_count);
+}
+
+/* Draw 'samples' delimitations from the proposal mixture, in equal shares
+   from each component, and accumulate their importance weights into run.
+   Weights are kept relative to the largest one seen, and the sums are
+   rescaled whenever it changes */
+static void post_run(rtree_t * root,
+                     long method,
+                     long samples,
+                     post_ws_t * ws,
+                     unsigned short * rstate,
+                     post_run_t * run)
+{
+  long i,j,k,s;
+  post_draw_t draw;
+
+  run->max_logw = -__DBL_MAX__;
+  run->weight_sum = 0;
+  run->weight_sqsum = 0;
+  run->spec_count_sum = 0;
+  run->spec_len_sum = 0;
+  run->coal_count_sum = 0;
+  run->coal_len_sum = 0;
+  if (run->spec_weight)
+    memset(run->spec_weight, 0, (size_t)(root->leaves-1) * sizeof(double));
+  if (run->species_weight)
+    memset(run->species_weight, 0, (size_t)(root->leaves+1) * sizeof(double));
+
+  /* The normalizers of all components are needed for the mixture weights
+     before any sample is drawn, but the per-node tables hold a single
+     component, as they are quadratic in the number of leaves. Hence every
+     component but the first is filled again before drawing from it. The
+     normalizers are computed in reverse order so that the tables of the
+     first component are left in place */
+  for (k = ws->comp_count-1; k >= 0; --k)
+    ws->comp[k].lognorm = post_fill(root, ws, method, ws->comp+k);
+
+  for (k = 0; k < ws->comp_count; ++k)
+  {
+    long share = samples / ws->comp_count +
+                 (k < samples % ws->comp_count ? 1 : 0);
+    if (!share) continue;
+
+    double lognorm = ws->comp[k].lognorm;
+    if (k)
+      post_fill(root, ws, method, ws->comp+k);
+
+    for (i = 0; i < share; ++i)
+    {
+      s = 1 + sample_index(ws->root_logw, root->leaves, lognorm, rstate);
+      post_sample(root, method, s, ws, rstate, &draw);
+
+      double logw = draw.target_logw -
+                    post_mixture_logp(root, method, ws, &draw);
+
+      if (logw > run->max_logw)
+      {
+        double scale = (run->max_logw == -__DBL_MAX__) ?
+                         0 : exp(run->max_logw - logw);
+
+        if (run->spec_weight)
+          for (j = 0; j < root->leaves-1; ++j)
+            run->spec_weight[j] *= scale;
+        if (run->species_weight)
+          for (j = 1; j <= root->leaves; ++j)
+            run->species_weight[j] *= scale;
+        run->weight_sum *= scale;
+        run->weight_sqsum *= scale*scale;
+        run->spec_count_sum *= scale;
+        run->spec_len_sum *= scale;
+        run->coal_count_sum *= scale;
+        run->coal_len_sum *= scale;
+        run->max_logw = logw;
+      }
+
+      double w = exp(logw - run->max_logw);
+      run->weight_sum += w;
+      run->weight_sqsum += w*w;
+      run->spec_count_sum += w * draw.spec_edge_count;
+      run->spec_len_sum += w * draw.spec_edgelen_sum;
+      run->coal_count_sum += w * (root->edge_count - draw.spec_edge_count);
+      run->coal_len_sum += w * (root->edgelen_sum - draw.spec_edgelen_sum);
+
+      if (run->species_weight)
+        run->species_weight[s] += w;
+
+      if (run->spec_weight)
+        for (j = 0; j < root->leaves-1; ++j)
+          if (ws->inner_node_list[j]->event == EVENT_SPECIATION)
+            run->spec_weight[j] += w;
+    }
+  }
+
+  run->ess = run->weight_sum * run->weight_sum / run->weight_sqsum;
+}
+
+void post_support(rtree_t * root, long method)
+{
+  long i,j;
+  long round;
+  unsigned short rstate[3];
+  double rate_spec;
+  double rate_coal;
+  post_ws_t ws;
+  post_run_t run;
+
+  long nodes_count = 2*root->leaves - 1;
+
+  loglikelihood_table_init(nodes_count - 1);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Computing ML delimitation for the initial rates...\n");
+
+  ml_rates(root, method, &rate_spec, &rate_coal);
+
+  root->coal_logl = loglikelihood(root->edge_count, root->edgelen_sum);
+
+  ws.postorder = (rtree_t **)xmalloc((size_t)nodes_count * sizeof(rtree_t *));
+  rtree_postorder(root, ws.postorder);
+  ws.inner_node_list = (rtree_t **)xmalloc((size_t)(root->leaves-1) *
+                                           sizeof(rtree_t *));
+  rtree_query_innernodes(root, ws.inner_node_list);
+  ws.stack = (rtree_t **)xmalloc((size_t)nodes_count * sizeof(rtree_t *));
+  ws.stack_s = (long *)xmalloc((size_t)nodes_count * sizeof(long));
+  ws.terms = (double *)xmalloc((size_t)(root->leaves +
+                                        POST_GRID_SIZE*POST_GRID_SIZE) *
+                               sizeof(double));
+  ws.root_logw = (double *)xmalloc((size_t)(root->leaves) * sizeof(double));
+
+  random_init(rstate, opt_seed);
+
+  /* pilot runs starting around the ML rates. Each centres the grid at the
+     weighted mean rates of the target and makes it finer, until the grid is
+     fine enough for the sample to be well spread over the components */
+  double step = 4;
+  run.spec_weight = NULL;
+  run.species_weight = NULL;
+  for (round = 0; round < POST_PILOT_ROUNDS; ++round)
+  {
+    post_set_grid(&ws, method, rate_spec, rate_coal, step);
+    post_run(root, method, POST_PILOT_SAMPLES, &ws, rstate, &run);
+
+    if (!opt_quiet)
+      fprintf(stdout,
+              "Pilot run %ld around rates %f (speciation) and %f (coalescent): "
+              "effective sample size %.1f of %d\n",
+              round+1,
+              rate_spec,
+              rate_coal,
+              run.ess,
+              POST_PILOT_SAMPLES);
+
+    if (run.spec_count_sum > 0 && run.spec_len_sum > __DBL_MIN__)
+      rate_spec = run.spec_count_sum / run.spec_len_sum;
+    if (run.coal_count_sum > 0 && run.coal_len_sum > __DBL_MIN__)
+      rate_coal = run.coal_count_sum / run.coal_len_sum;
+
+    if (run.ess >= POST_PILOT_SAMPLES / 2) break;
+
+    step = sqrt(step);
+  }
+
+  post_set_grid(&ws, method, rate_spec, rate_coal, step);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Sampling %ld delimitations around rates %f (speciation) and "
+            "%f (coalescent)...\n",
+            opt_dp_support,
+            rate_spec,
+            rate_coal);
+
+  run.spec_weight = (double *)xmalloc((size_t)(root->leaves-1) *
+                                      sizeof(double));
+  run.species_weight = (double *)xmalloc((size_t)(root->leaves+1) *
+                                         sizeof(double));
+  post_run(root, method, opt_dp_support, &ws, rstate, &run);
+
+  /* write support values to all inner nodes */
+  for (j = 0; j < root->leaves-1; ++j)
+  {
+    ws.inner_node_list[j]->aic_support = run.spec_weight[j] / run.weight_sum;
+    ws.inner_node_list[j]->support = ws.inner_node_list[j]->aic_support;
+  }
+
+  if (!opt_quiet)
+  {
+    long best = 1;
+    for (j = 2; j <= root->leaves; ++j)
+      if (run.species_weight[j] > run.species_weight[best])
+        best = j;
+
+    fprintf(stdout,
+            "Effective sample size: %.1f of %ld\n",
+            run.ess,
+            opt_dp_support);
+    fprintf(stdout,
+            "Most supported number of species: %ld (%f)\n",
+            best,
+            run.species_weight[best] / run.weight_sum);
+  }
+
+  for (i = 0; i < nodes_count; ++i)
+  {
+    post_t * p = (post_t *)(ws.postorder[i]->data);
+    free(p->logz);
+    free(p);
+    ws.postorder[i]->data = NULL;
+  }
+
+  free(run.spec_weight);
+  free(run.species_weight);
+  free(ws.postorder);
+  free(ws.inner_node_list);
+  free(ws.stack);
+  free(ws.stack_s);
+  free(ws.terms);
+  free(ws.root_logw);
+
+  /* output tree and SVG with support values */
+  char * newick = rtree_export_newick(root);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Creating tree with support values in %s.%ld.tree ...\n",
+            opt_outfile,
+            opt_seed);
+
+  FILE * newick_fp = open_file_ext("tree", opt_seed);
+  fprintf(newick_fp, "%s\n", newick);
+  fclose(newick_fp);
+  free(newick);
+
+  cmd_svg(root, opt_seed, "svg");
+}
@@ -108,115 +108,167 @@ void rtree_show_ascii(rtree_t * tree)
   free(active_node_order);
 }
 
-static char * rtree_export_newick_recursive(rtree_t * root)
-{
-  char * newick;
-  char * support = NULL;
+/* Iterative traversals used by the routines that visit all nodes of a
+   tree, such that very unbalanced trees do not overflow the call stack.
+   'outbuffer' must have room for the 2*leaves-1 nodes of the subtree rooted
+   at 'root'. Both functions return the number of nodes stored. */
 
-  if (!root) return NULL;
+int rtree_preorder(rtree_t * root, rtree_t ** outbuffer)
+{
+  int count = 0;
+  long top = 0;
 
-  if (!(root->left) || !(root->right))
-  {
-    if (asprintf(&newick, "%s:%f", root->label, root->length) == -1)
-      fatal("Unable to allocate enough memory.");
-  }
-  else
-  {
-    char * subtree1 = rtree_export_newick_recursive(root->left);
-    char * subtree2 = rtree_export_newick_recursive(root->right);
+  if (!root) return 0;
 
-    if (opt_mcmc)
-      if (asprintf(&support, "%f", root->support) == -1)
-        fatal("Unable to allocate enough memory.");
+  /* at most one pending right subtree per tip */
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(root->leaves + 1) *
+                                         sizeof(rtree_t *));
 
-    if (asprintf(&newick, "(%s,%s)%s:%f", subtree1,
-                                      subtree2,
-                                      (opt_mcmc) ? support : "",
-                                      root->length) == -1)
-      fatal("Unable to allocate enough memory.");
+  stack[top++] = root;
+  while (top)
+  {
+    rtree_t * node = stack[--top];
 
-    if (opt_mcmc)
-      free(support);
+    outbuffer[count++] = node;
 
-    free(subtree1);
-    free(subtree2);
+    if (node->left)
+    {
+      stack[top++] = node->right;
+      stack[top++] = node->left;
+    }
   }
 
-  return newick;
+  free(stack);
+  return count;
 }
 
-char * rtree_export_newick(rtree_t * root)
+int rtree_postorder(rtree_t * root, rtree_t ** outbuffer)
 {
-  char * newick;
-  char * support = NULL;
+  int count = 0;
+  int i;
+  long top = 0;
 
-  if (!root) return NULL;
+  if (!root) return 0;
 
-  if (!(root->left) || !(root->right))
-  {
-    if (asprintf(&newick, "%s:%f", root->label, root->length) == -1)
-      fatal("Unable to allocate enough memory.");
-  }
-  else
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(root->leaves + 1) *
+                                         sizeof(rtree_t *));
+
+  /* a preorder that visits right subtrees first is the reverse of the
+     postorder that visits left subtrees first */
+  stack[top++] = root;
+  while (top)
   {
-    char * subtree1 = rtree_export_newick_recursive(root->left);
-    char * subtree2 = rtree_export_newick_recursive(root->right);
+    rtree_t * node = stack[--top];
 
-    if (opt_mcmc)
-      if (asprintf(&support, "%f", root->support) == -1)
-        fatal("Unable to allocate enough memory.");
+    outbuffer[count++] = node;
 
-    if (asprintf(&newick, "(%s,%s)%s:%f;", subtree1,
-                                       subtree2,
-                                       (opt_mcmc) ? support : "",
-                                       root->length) == -1)
-      fatal("Unable to allocate enough memory.");
-    if (opt_mcmc)
-      free(support);
+    if (node->left)
+    {
+      stack[top++] = node->left;
+      stack[top++] = node->right;
+    }
+  }
 
-    free(subtree1);
-    free(subtree2);
+  for (i = 0; i < count/2; ++i)
+  {
+    rtree_t * temp = outbuffer[i];
+    outbuffer[i] = outbuffer[count-i-1];
+    outbuffer[count-i-1] = temp;
   }
 
-  return newick;
+  free(stack);
+  return count;
 }
 
-static void rtree_traverse_recursive(rtree_t * node,
-                                     int (*cbtrav)(rtree_t *),
-                                     int * index,
-                                     unsigned short * rstate,
-                                     rtree_t ** outbuffer)
+static void newick_append(char ** buffer,
+                          size_t * len,
+                          size_t * alloc,
+                          const char * format,
+                          ...)
 {
-  double rand_double = 0;
+  va_list args;
 
-  if (!node->left)
+  while (1)
   {
-    if (!cbtrav(node))
+    va_start(args, format);
+    int n = vsnprintf(*buffer + *len, *alloc - *len, format, args);
+    va_end(args);
+
+    if (n < 0)
+      fatal("Unable to allocate enough memory.");
+
+    if ((size_t)n < *alloc - *len)
     {
-      outbuffer[*index] = node;
-      *index = *index + 1;
+      *len += (size_t)n;
+      return;
     }
-    return;
-  }
-  if (!cbtrav(node))
-  {
-    outbuffer[*index] = node;
-    *index = *index + 1;
-    return;
+
+    *alloc = 2*(*alloc) + (size_t)n;
+    *buffer = (char *)xrealloc(*buffer, *alloc);
   }
+}
+
+char * rtree_export_newick(rtree_t * root)
+{
+  size_t len = 0;
+  size_t alloc = 1024;
+  long top = 0;
+
+  if (!root) return NULL;
+
+  char * newick = (char *)xmalloc(alloc);
+  newick[0] = 0;
 
-  rand_double = mptp_erand48(rstate);
-  if (rand_double >= 0.5)
+  if (!(root->left) || !(root->right))
   {
-    rtree_traverse_recursive(node->left, cbtrav, index, rstate, outbuffer);
-    rtree_traverse_recursive(node->right, cbtrav, index, rstate, outbuffer);
+    newick_append(&newick,&len,&alloc, "%s:%f", root->label, root->length);
+    return newick;
   }
-  else
+
+  /* each inner node is pushed twice: once for opening its parenthesis and
+     once, marked by a negative visit count, for closing it */
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(3*root->leaves) *
+                                         sizeof(rtree_t *));
+  int * visit = (int *)xmalloc((size_t)(3*root->leaves) * sizeof(int));
+
+  stack[top] = root; visit[top++] = 0;
+  while (top)
   {
-    rtree_traverse_recursive(node->right, cbtrav, index, rstate, outbuffer);
-    rtree_traverse_recursive(node->left, cbtrav, index, rstate, outbuffer);
+    rtree_t * node = stack[--top];
+    int state = visit[top];
+
+    if (!node->left)
+    {
+      newick_append(&newick,&len,&alloc, "%s:%f", node->label, node->length);
+    }
+    else if (state == 0)
+    {
+      newick_append(&newick,&len,&alloc, "(");
+
+      stack[top] = node;        visit[top++] = 2;
+      stack[top] = node->right; visit[top++] = 0;
+      stack[top] = node;        visit[top++] = 1;
+      stack[top] = node->left;  visit[top++] = 0;
+    }
+    else if (state == 1)
+    {
+      newick_append(&newick,&len,&alloc, ",");
+    }
+    else
+    {
+      newick_append(&newick,&len,&alloc, ")");
+      if (opt_mcmc || opt_dp_support)
+        newick_append(&newick,&len,&alloc, "%f", node->support);
+      newick_append(&newick,&len,&alloc, ":%f", node->length);
+    }
   }
 
+  newick_append(&newick,&len,&alloc, ";");
+
+  free(visit);
+  free(stack);
+
+  return newick;
 }
 
 int rtree_traverse(rtree_t * root,
@@ -238,27 +290,39 @@ int rtree_traverse(rtree_t * root,
      at each node the callback function is called to decide whether we
      are going to traversing the subtree rooted at the specific node */
 
-  rtree_traverse_recursive(root, cbtrav, &index, rstate, outbuffer);
-  return index;
-}
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(root->leaves + 1) *
+                                         sizeof(rtree_t *));
+  long top = 0;
 
-static void rtree_traverse_postorder_recursive(rtree_t * node,
-                                               int (*cbtrav)(rtree_t *),
-                                               int * index,
-                                               rtree_t ** outbuffer)
-{
-  if (!node) return;
+  stack[top++] = root;
+  while (top)
+  {
+    rtree_t * node = stack[--top];
+
+    if (!cbtrav(node))
+    {
+      outbuffer[index++] = node;
+      continue;
+    }
 
-  rtree_traverse_postorder_recursive(node->left,  cbtrav, index, outbuffer);
-  rtree_traverse_postorder_recursive(node->right, cbtrav, index, outbuffer);
+    if (!node->left) continue;
 
-  if (cbtrav(node))
-  {
-    outbuffer[*index] = node;
-    *index = *index + 1;
+    /* the subtree that is pushed last is traversed first */
+    if (mptp_erand48(rstate) >= 0.5)
+    {
+      stack[top++] = node->right;
+      stack[top++] = node->left;
+    }
+    else
+    {
+      stack[top++] = node->left;
+      stack[top++] = node->right;
+    }
   }
-}
 
+  free(stack);
+  return index;
+}
 
 int rtree_traverse_postorder(rtree_t * root,
                              int (*cbtrav)(rtree_t *),
@@ -278,158 +342,294 @@ int rtree_traverse_postorder(rtree_t * root,
      at each node the callback function is called to decide whether to
      place the node in the list */
 
-  rtree_traverse_postorder_recursive(root, cbtrav, &index, outbuffer);
-  return index;
-}
-
-static int rtree_height_recursive(rtree_t * node)
-{
-  if (!node) return 1;
+  int i;
+  int count;
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*root->leaves - 1) *
+                                             sizeof(rtree_t *));
 
-  int a = rtree_height_recursive(node->left);
-  int b = rtree_height_recursive(node->right);
+  count = rtree_postorder(root, postorder);
+  for (i = 0; i < count; ++i)
+    if (cbtrav(postorder[i]))
+      outbuffer[index++] = postorder[i];
 
-  return MAX(a,b)+1;
+  free(postorder);
+  return index;
 }
 
-
 int rtree_height(rtree_t * root)
 {
-  return rtree_height_recursive(root);
-}
+  long top = 0;
+  int height = 1;
 
-static void rtree_query_tipnodes_recursive(rtree_t * node,
-                                           rtree_t ** node_list,
-                                           int * index)
-{
-  if (!node) return;
+  if (!root) return 1;
 
-  if (!node->left)
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(root->leaves + 1) *
+                                         sizeof(rtree_t *));
+  int * depth = (int *)xmalloc((size_t)(root->leaves + 1) * sizeof(int));
+
+  /* the height counts the nodes on the longest root-to-tip path plus one */
+  stack[top] = root; depth[top++] = 2;
+  while (top)
   {
-    node_list[*index] = node;
-    *index = *index + 1;
-    return;
+    rtree_t * node = stack[--top];
+    int d = depth[top];
+
+    if (d > height) height = d;
+
+    if (node->left)
+    {
+      stack[top] = node->right; depth[top++] = d+1;
+      stack[top] = node->left;  depth[top++] = d+1;
+    }
   }
 
-  rtree_query_tipnodes_recursive(node->left,  node_list, index);
-  rtree_query_tipnodes_recursive(node->right, node_list, index);
+  free(depth);
+  free(stack);
+  return height;
 }
 
 int rtree_query_tipnodes(rtree_t * root,
                          rtree_t ** node_list)
 {
+  int i;
+  int count;
   int index = 0;
 
   if (!root) return 0;
-  if (!root->left)
-  {
-    node_list[index++] = root;
-    return index;
-  }
 
-  rtree_query_tipnodes_recursive(root->left,  node_list, &index);
-  rtree_query_tipnodes_recursive(root->right, node_list, &index);
-
-  return index;
-}
-
-static void rtree_query_innernodes_recursive(rtree_t * root,
-                                             rtree_t ** node_list,
-                                             int * index)
-{
-  if (!root) return;
-  if (!root->left) return;
-
-  /* postorder traversal */
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*root->leaves - 1) *
+                                             sizeof(rtree_t *));
 
-  rtree_query_innernodes_recursive(root->left,  node_list, index);
-  rtree_query_innernodes_recursive(root->right, node_list, index);
+  count = rtree_postorder(root, postorder);
+  for (i = 0; i < count; ++i)
+    if (!postorder[i]->left)
+      node_list[index++] = postorder[i];
 
-  node_list[*index] = root;
-  *index = *index + 1;
-  return;
+  free(postorder);
+  return index;
 }
 
 int rtree_query_innernodes(rtree_t * root,
                            rtree_t ** node_list)
 {
+  int i;
+  int count;
   int index = 0;
 
   if (!root) return 0;
   if (!root->left) return 0;
 
-  rtree_query_innernodes_recursive(root->left,  node_list, &index);
-  rtree_query_innernodes_recursive(root->right, node_list, &index);
+  /* postorder traversal */
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*root->leaves - 1) *
+                                             sizeof(rtree_t *));
 
-  node_list[index++] = root;
+  count = rtree_postorder(root, postorder);
+  for (i = 0; i < count; ++i)
+    if (postorder[i]->left)
+      node_list[index++] = postorder[i];
 
+  free(postorder);
   return index;
 }
 
+/* Recompute the tip count and the edge statistics of node from those of its
+   children */
+void rtree_update_info(rtree_t * node)
+{
+  if (!node->left)
+  {
+    node->leaves = 1;
+    node->edge_count = 0;
+    node->edgelen_sum = 0;
+    node->max_species_count = 1;
+    return;
+  }
+
+  node->leaves = node->left->leaves + node->right->leaves;
+  node->edge_count = node->left->edge_count +
+                     node->right->edge_count;
+  node->edgelen_sum = node->left->edgelen_sum +
+                      node->right->edgelen_sum;
+
+  if (node->left->length > opt_minbr)
+  {
+    node->edge_count++;
+    node->edgelen_sum += node->left->length;
+  }
+  if (node->right->length > opt_minbr)
+  {
+    node->edge_count++;
+    node->edgelen_sum += node->right->length;
+  }
+
+  node->max_species_count = 1;
+  if (node->edge_count > 0)
+    node->max_species_count = node->left->max_species_count +
+                              node->right->max_species_count;
+}
+
 void rtree_reset_info(rtree_t * root)
 {
+  int i;
+  int count;
+
   if (!root->left)
   {
     root->leaves = 1;
     root->edge_count = 0;
     root->edgelen_sum = 0;
+    root->max_species_count = 1;
     return;
   }
 
-  rtree_reset_info(root->left);
-  rtree_reset_info(root->right);
-
-  root->leaves = root->left->leaves + root->right->leaves;
-  root->edge_count = root->left->edge_count +
-                     root->right->edge_count;
-  root->edgelen_sum = root->left->edgelen_sum +
-                      root->right->edgelen_sum;
-
-  if (root->left->length > opt_minbr)
+  /* the tip counts may be stale, so size the buffer by a full traversal */
+  long nodes = 0;
+  long top = 0;
+  long alloc = 64;
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)alloc * sizeof(rtree_t *));
+  stack[top++] = root;
+  while (top)
   {
-    root->edge_count++;
-    root->edgelen_sum += root->left->length;
-  }
-  if (root->right->length > opt_minbr)
-  {
-    root->edge_count++;
-    root->edgelen_sum += root->right->length;
+    rtree_t * node = stack[--top];
+    ++nodes;
+    if (node->left)
+    {
+      if (top + 2 > alloc)
+      {
+        alloc *= 2;
+        stack = (rtree_t **)xrealloc(stack, (size_t)alloc * sizeof(rtree_t *));
+      }
+      stack[top++] = node->right;
+      stack[top++] = node->left;
+    }
   }
+  free(stack);
+
+  root->leaves = (int)(nodes + 1) / 2;
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)nodes *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(root, postorder);
+
+  for (i = 0; i < count; ++i)
+    rtree_update_info(postorder[i]);
+
+  free(postorder);
 }
 
 void rtree_print_tips(rtree_t * node, FILE * out)
 {
-  if (node->left)  rtree_print_tips(node->left,out);
-  if (node->right) rtree_print_tips(node->right,out);
+  int i;
+  int count;
+
+  rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2*node->leaves - 1) *
+                                            sizeof(rtree_t *));
+
+  count = rtree_preorder(node, preorder);
+  for (i = 0; i < count; ++i)
+    if (!preorder[i]->left && !preorder[i]->right)
+      fprintf(out, "%s\n", preorder[i]->label);
 
-  if (!node->left && !node->right)
-    fprintf(out, "%s\n", node->label);
+  free(preorder);
+}
+
+/* Comma-separated labels of the tips of the subtree rooted at node */
+char * rtree_tip_labels(rtree_t * node)
+{
+  int i;
+  int count;
+  size_t len = 0;
+
+  rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2*node->leaves - 1) *
+                                            sizeof(rtree_t *));
+  count = rtree_preorder(node, preorder);
+
+  for (i = 0; i < count; ++i)
+    if (!preorder[i]->left)
+      len += strlen(preorder[i]->label) + 1;
+
+  char * taxa = (char *)xmalloc(len + 1);
+  char * p = taxa;
+  *p = 0;
+
+  for (i = 0; i < count; ++i)
+  {
+    if (preorder[i]->left) continue;
+
+    if (p != taxa) *p++ = ',';
+    strcpy(p, preorder[i]->label);
+    p += strlen(p);
+  }
+
+  free(preorder);
+  return taxa;
 }
 
 
 rtree_t * rtree_clone(rtree_t * node, rtree_t * parent)
 {
+  int i;
+  int count;
+
   if (!node) return NULL;
 
-  /* clone node */
-  rtree_t * clone = (rtree_t *)xcalloc(1,sizeof(rtree_t));
-  memcpy(clone,node,sizeof(rtree_t));
-  clone->parent = parent;
-  clone->data = NULL;
+  rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2*node->leaves - 1) *
+                                            sizeof(rtree_t *));
+  count = rtree_preorder(node, preorder);
+
+  /* the clone of each node is kept in a list aligned with the preorder, and
+     the index of each node in its mark while linking the clones */
+  rtree_t ** clones = (rtree_t **)xmalloc((size_t)count * sizeof(rtree_t *));
+  int * mark = (int *)xmalloc((size_t)count * sizeof(int));
+
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = preorder[i];
+
+    rtree_t * clone = (rtree_t *)xcalloc(1,sizeof(rtree_t));
+    memcpy(clone,x,sizeof(rtree_t));
+    clone->data = NULL;
+
+    if (x->label)
+      clone->label = xstrdup(x->label);
+
+    clones[i] = clone;
+    mark[i] = x->mark;
+    x->mark = i;
+  }
+
+  clones[0]->parent = parent;
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * x = preorder[i];
+
+    if (x->left)
+    {
+      clones[i]->left = clones[x->left->mark];
+      clones[i]->right = clones[x->right->mark];
+      clones[i]->left->parent = clones[i];
+      clones[i]->right->parent = clones[i];
+    }
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    preorder[i]->mark = mark[i];
+    clones[i]->mark = mark[i];
+  }
 
-  if (node->label)
-    clone->label = xstrdup(node->label);
+  rtree_t * clone = clones[0];
 
-  /* clone the two subtrees */
-  clone->left  = rtree_clone(node->left, clone);
-  clone->right = rtree_clone(node->right, clone);
+  free(mark);
+  free(clones);
+  free(preorder);
 
   return clone;
 }
 
-static rtree_t ** rtree_tipstring_nodes(rtree_t * root,
-                                        char * tipstring,
-                                        unsigned int * tiplist_count)
+rtree_t ** rtree_tipstring_nodes(rtree_t * root,
+                                 char * tipstring,
+                                 unsigned int * tiplist_count)
 {
   size_t i;
   unsigned int k;
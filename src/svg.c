@@ -89,44 +89,47 @@ static void svg_text(double x, double y, long fontsize, const char * text)
           x,y,fontsize,text);
 }
 
-static void rtree_set_xcoord(rtree_t * node)
+static void rtree_set_xcoord(rtree_t * root)
 {
-  /* create the coordinate info of the node's scaled branch length (edge
-     towards root) */
-  coord_t * coord = create_coord(node->length * scaler, 0);
-  node->data = (void *)coord;
-
-  /* if the node has a parent then add the x coord of the parent such that
-     the branch is shifted towards right, otherwise, if the node is the root,
-     align it with the left margin */
-  if (node->parent)
-    coord->x += ((coord_t *)(node->parent->data))->x;
-  else
+  int i;
+  int count;
+
+  rtree_t ** preorder = (rtree_t **)xmalloc((size_t)(2 * root->leaves - 1) *
+                                            sizeof(rtree_t *));
+
+  /* set coordinates of the nodes in a pre-order fashion, such that the
+     parent of a node is always processed before the node */
+  count = rtree_preorder(root, preorder);
+
+  for (i = 0; i < count; ++i)
   {
-    coord->x = opt_svg_marginleft;
+    rtree_t * node = preorder[i];
+
+    /* create the coordinate info of the node's scaled branch length (edge
+       towards root) */
+    coord_t * coord = create_coord(node->length * scaler, 0);
+    node->data = (void *)coord;
+
+    /* if the node has a parent then add the x coord of the parent such that
+       the branch is shifted towards right, otherwise, if the node is the
+       root, align it with the left margin */
+    if (node->parent)
+      coord->x += ((coord_t *)(node->parent->data))->x;
+    else
+    {
+      coord->x = opt_svg_marginleft;
+    }
   }
 
-  if (!node->left)
-    return;
-
-  /* recursively set coordinates of the other nodes in a pre-order fashion */
-  rtree_set_xcoord(node->left);
-  rtree_set_xcoord(node->right);
+  free(preorder);
 }
 
-static void svg_rtree_plot(rtree_t * node)
+static void svg_rtree_plot_node(rtree_t * node)
 {
   char * current_color;
   double y;
   double stroke_width = 3;
 
-  /* traverse tree in post-order */
-  if (node->left)
-  {
-    svg_rtree_plot(node->left);
-    svg_rtree_plot(node->right);
-  }
-
   /* any node that has a parent, i.e. any node apart from the root */
   if (node->parent)
   {
@@ -148,7 +151,7 @@ static void svg_rtree_plot(rtree_t * node)
       y = (ly + ry) / 2.0;
 
       /* decide the color */
-      if (opt_mcmc)
+      if (opt_mcmc || opt_dp_support)
       {
         if (asprintf(&current_color, "rgb(%f%%,%f%%,%f%%)",
                  GRADIENT(node->support),
@@ -168,11 +171,11 @@ static void svg_rtree_plot(rtree_t * node)
       svg_circle(x, y, opt_svg_inner_radius, current_color);
 
       /* deallocate color if mcmc */
-      if (opt_mcmc)
+      if (opt_mcmc || opt_dp_support)
         free(current_color);
 
       /* if support value greater than threshold output it */
-      if (opt_mcmc)
+      if (opt_mcmc || opt_dp_support)
       {
         if (node->support > 0.5)
         {
@@ -188,7 +191,7 @@ static void svg_rtree_plot(rtree_t * node)
     }
 
     /* decide the color based on the parent node */
-    if (opt_mcmc)
+    if (opt_mcmc || opt_dp_support)
     {
       if (asprintf(&current_color, "rgb(%f%%,%f%%,%f%%)",
                GRADIENT(node->parent->support),
@@ -207,7 +210,7 @@ static void svg_rtree_plot(rtree_t * node)
     svg_line(px,y,x,y,current_color,stroke_width);
     ((coord_t *)(node->data))->y = y;
 
-    if (opt_mcmc)
+    if (opt_mcmc || opt_dp_support)
       free(current_color);
 
     /* if node is a tip then print its label */
@@ -234,7 +237,7 @@ static void svg_rtree_plot(rtree_t * node)
     x = opt_svg_marginleft;
 
     /* decide the color */
-    if (opt_mcmc)
+    if (opt_mcmc || opt_dp_support)
     {
       if (asprintf(&current_color, "rgb(%f%%,%f%%,%f%%)",
                GRADIENT(node->support),
@@ -252,10 +255,10 @@ static void svg_rtree_plot(rtree_t * node)
     svg_line(x,ly,x,ry,current_color,stroke_width);
     svg_circle(x,y,opt_svg_inner_radius,current_color);
 
-    if (opt_mcmc)
+    if (opt_mcmc || opt_dp_support)
       free(current_color);
 
-    if (opt_mcmc)
+    if (opt_mcmc || opt_dp_support)
     {
       if (node->support > 0.5)
       {
@@ -271,6 +274,22 @@ static void svg_rtree_plot(rtree_t * node)
   }
 }
 
+static void svg_rtree_plot(rtree_t * root)
+{
+  int i;
+  int count;
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2 * root->leaves - 1) *
+                                             sizeof(rtree_t *));
+
+  /* traverse tree in post-order */
+  count = rtree_postorder(root, postorder);
+  for (i = 0; i < count; ++i)
+    svg_rtree_plot_node(postorder[i]);
+
+  free(postorder);
+}
+
 static void rtree_scaler_init(rtree_t * root)
 {
   double len = 0;
@@ -385,7 +404,7 @@ void cmd_svg(rtree_t * root, long seed, const char * ext)
 
   if (!opt_quiet)
   {
-    if (opt_mcmc)
+    if (opt_mcmc || opt_dp_support)
       fprintf(stdout,
               "Creating SVG delimitation file %s.%ld.svg ...\n",
               opt_outfile,
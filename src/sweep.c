@@ -0,0 +1,230 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+
+/* Compute the ML delimitation of the tree for each minimum branch length
+   given with --minbr_sweep. The tree is parsed only once; the per-node edge
+   statistics are recomputed for each threshold, and the DP table reuses the
+   same arena. The results are written as one table to the output file */
+void minbr_sweep(rtree_t * root, long method)
+{
+  long i;
+  long count;
+  double saved_minbr = opt_minbr;
+
+  double * values = parse_real_list(opt_minbr_sweep, "--minbr_sweep", &count);
+
+  FILE * out = open_file_ext("txt", opt_seed);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Writing minimum branch length sweep to %s.txt ...\n",
+            opt_outfile);
+
+  fprintf(out, "Command: %s\n", cmdline);
+  fprintf(out, "minbr\tedges\tnull_logl\tml_logl\tpvalue\tlrt\tspecies\n");
+
+  dp_arena_t * arena = dp_arena_create();
+
+  for (i = 0; i < count; ++i)
+  {
+    double logl;
+    double pvalue;
+    int lrt_pass;
+
+    opt_minbr = values[i];
+    rtree_reset_info(root);
+
+    dp_init(root, arena);
+    dp_set_pernode_spec_edges(root);
+    dp_fill(root, method);
+
+    long species = dp_ptp_summary(root, method, &logl, &pvalue, &lrt_pass);
+
+    dp_free(root);
+
+    if (!opt_quiet)
+      fprintf(stdout,
+              "minbr %g: %d / %d edges, %ld species (LRT %s)\n",
+              values[i],
+              root->edge_count,
+              2 * root->leaves - 2,
+              species,
+              lrt_pass ? "passed" : "failed");
+
+    fprintf(out,
+            "%g\t%d\t%.6f\t%.6f\t%.6f\t%s\t%ld\n",
+            values[i],
+            root->edge_count,
+            root->coal_logl,
+            logl,
+            pvalue,
+            lrt_pass ? "passed" : "failed",
+            species);
+  }
+
+  dp_arena_destroy(arena);
+  fclose(out);
+  free(values);
+
+  /* restore the per-node statistics of the --minbr threshold */
+  opt_minbr = saved_minbr;
+  rtree_reset_info(root);
+}
+
+/* Compute the ML delimitation of the unrooted tree rooted at each edge, or
+   at the edges of the tips given with --root_scan. Every rooting places the
+   root in the middle of the edge as --outgroup does, with the smaller side
+   of the edge as outgroup. The DP table reuses the same arena. The results
+   are written as one table to the output file, followed by the best root,
+   i.e. the one with the highest log-likelihood for the single-rate method
+   and the lowest AIC score for the multi-rate one */
+void root_scan(utree_t * utree, unsigned int tip_count, long method)
+{
+  long i;
+  unsigned int j;
+  long count = 0;
+  utree_t ** roots;
+
+  if (!strcmp(opt_root_scan, "all"))
+  {
+    /* the tip edges followed by the inner edges */
+    roots = (utree_t **)xmalloc((size_t)(2*tip_count - 3) *
+                                sizeof(utree_t *));
+    count = utree_query_tipnodes(utree, roots);
+
+    utree_t ** inner = (utree_t **)xmalloc((size_t)(tip_count - 2) *
+                                           sizeof(utree_t *));
+    int inner_count = utree_query_innernodes(utree, inner);
+
+    for (i = 0; i < inner_count; ++i)
+    {
+      utree_t * x = inner[i];
+      for (j = 0; j < 3; ++j, x = x->next)
+        if (x->back->next && x < x->back)
+          roots[count++] = x;
+    }
+
+    free(inner);
+  }
+  else
+  {
+    unsigned int taxa_count;
+    roots = utree_tipstring_nodes(utree, opt_root_scan, tip_count, &taxa_count);
+    count = taxa_count;
+  }
+
+  FILE * out = open_file_ext("txt", opt_seed);
+
+  if (!opt_quiet)
+    fprintf(stdout, "Writing root scan of %ld edges to %s.txt ...\n",
+            count, opt_outfile);
+
+  fprintf(out, "Command: %s\n", cmdline);
+  fprintf(out, "edge\tlength\tnull_logl\tml_logl\taic\tpvalue\tlrt\tspecies\t"
+               "outgroup_tips\toutgroup\n");
+
+  dp_arena_t * arena = dp_arena_create();
+
+  long best = -1;
+  double best_logl = 0;
+  double best_aic = 0;
+  char * best_taxa = NULL;
+
+  for (i = 0; i < count; ++i)
+  {
+    double logl;
+    double pvalue;
+    int lrt_pass;
+
+    rtree_t * rtree = utree_convert_rtree(roots[i]);
+    if (rtree->left->leaves > rtree->right->leaves)
+    {
+      rtree_destroy(rtree);
+      rtree = utree_convert_rtree(roots[i]->back);
+    }
+
+    dp_init(rtree, arena);
+    dp_set_pernode_spec_edges(rtree);
+    dp_fill(rtree, method);
+
+    long species = dp_ptp_summary(rtree, method, &logl, &pvalue, &lrt_pass);
+    double aic_score = dp_ml_aic(rtree, method);
+
+    dp_free(rtree);
+
+    char * taxa = rtree_tip_labels(rtree->left);
+
+    if (!opt_quiet)
+      fprintf(stdout,
+              "edge %ld: log-likelihood %.6f, AIC %.6f, %ld species (LRT %s)\n",
+              i+1,
+              logl,
+              aic_score,
+              species,
+              lrt_pass ? "passed" : "failed");
+
+    fprintf(out,
+            "%ld\t%g\t%.6f\t%.6f\t%.6f\t%.6f\t%s\t%ld\t%d\t%s\n",
+            i+1,
+            roots[i]->length,
+            rtree->coal_logl,
+            logl,
+            aic_score,
+            pvalue,
+            lrt_pass ? "passed" : "failed",
+            species,
+            rtree->left->leaves,
+            taxa);
+
+    if (best == -1 ||
+        (method == PTP_METHOD_SINGLE && logl > best_logl) ||
+        (method == PTP_METHOD_MULTI && aic_score < best_aic))
+    {
+      best = i;
+      best_logl = logl;
+      best_aic = aic_score;
+      free(best_taxa);
+      best_taxa = taxa;
+    }
+    else
+      free(taxa);
+
+    rtree_destroy(rtree);
+  }
+
+  fprintf(out, "\nBest root: edge %ld\n", best+1);
+  fprintf(out, "Outgroup: %s\n", best_taxa);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Best root: edge %ld (log-likelihood %.6f, AIC %.6f), "
+            "outgroup: %s\n",
+            best+1,
+            best_logl,
+            best_aic,
+            best_taxa);
+
+  dp_arena_destroy(arena);
+  fclose(out);
+  free(best_taxa);
+  free(roots);
+}
@@ -0,0 +1,280 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+
+/* Work-stealing thread pool. Each worker owns a double-ended queue of tasks.
+   A worker pushes and pops tasks at the tail of its own queue (LIFO, which
+   keeps recently produced data in cache), and when its queue runs dry it
+   steals the oldest task from the head of another worker's queue. Tasks
+   submitted from outside the pool are distributed round-robin. */
+
+typedef struct task_s
+{
+  void (*cb)(void *, long);
+  void * data;
+} task_t;
+
+typedef struct deque_s
+{
+  pthread_mutex_t mutex;
+  task_t * tasks;
+  long head;
+  long tail;
+  long alloc;
+} deque_t;
+
+typedef struct worker_s
+{
+  threadpool_t * pool;
+  long index;
+} worker_t;
+
+struct threadpool_s
+{
+  long threads;
+  pthread_t * tids;
+  worker_t * workers;
+  deque_t * deques;
+
+  /* protects the counters below and the two condition variables */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_work;
+  pthread_cond_t cond_done;
+
+  /* number of tasks sitting in the queues, and number of tasks that were
+     submitted but have not completed yet */
+  long queued;
+  long pending;
+
+  long next_deque;
+  int quit;
+};
+
+static void deque_push(deque_t * dq, task_t task)
+{
+  pthread_mutex_lock(&dq->mutex);
+
+  if (dq->tail == dq->alloc)
+  {
+    /* compact the queue before growing it */
+    if (dq->head)
+    {
+      memmove(dq->tasks,
+              dq->tasks + dq->head,
+              (size_t)(dq->tail - dq->head) * sizeof(task_t));
+      dq->tail -= dq->head;
+      dq->head = 0;
+    }
+    if (dq->tail == dq->alloc)
+    {
+      dq->alloc = dq->alloc ? 2*dq->alloc : 64;
+      dq->tasks = (task_t *)xrealloc(dq->tasks,
+                                     (size_t)dq->alloc * sizeof(task_t));
+    }
+  }
+  dq->tasks[dq->tail++] = task;
+
+  pthread_mutex_unlock(&dq->mutex);
+}
+
+static int deque_pop(deque_t * dq, task_t * task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&dq->mutex);
+  if (dq->tail > dq->head)
+  {
+    *task = dq->tasks[--dq->tail];
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->mutex);
+
+  return found;
+}
+
+static int deque_steal(deque_t * dq, task_t * task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&dq->mutex);
+  if (dq->tail > dq->head)
+  {
+    *task = dq->tasks[dq->head++];
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->mutex);
+
+  return found;
+}
+
+static int pool_gettask(threadpool_t * pool, long index, task_t * task)
+{
+  long i;
+
+  if (deque_pop(pool->deques + index, task))
+    return 1;
+
+  for (i = 1; i < pool->threads; ++i)
+    if (deque_steal(pool->deques + (index + i) % pool->threads, task))
+      return 1;
+
+  return 0;
+}
+
+static void * worker_main(void * arg)
+{
+  worker_t * worker = (worker_t *)arg;
+  threadpool_t * pool = worker->pool;
+  task_t task;
+
+  while (1)
+  {
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->queued && !pool->quit)
+      pthread_cond_wait(&pool->cond_work, &pool->mutex);
+    if (pool->quit)
+    {
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    /* another worker may have taken the task in the meantime */
+    if (!pool_gettask(pool, worker->index, &task))
+      continue;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->queued--;
+    pthread_mutex_unlock(&pool->mutex);
+
+    task.cb(task.data, worker->index);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->pending == 0)
+      pthread_cond_broadcast(&pool->cond_done);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  return NULL;
+}
+
+threadpool_t * threadpool_create(long threads)
+{
+  long i;
+
+  assert(threads > 0);
+
+  threadpool_t * pool = (threadpool_t *)xcalloc(1, sizeof(threadpool_t));
+
+  pool->threads = threads;
+  pool->tids = (pthread_t *)xmalloc((size_t)threads * sizeof(pthread_t));
+  pool->workers = (worker_t *)xmalloc((size_t)threads * sizeof(worker_t));
+  pool->deques = (deque_t *)xcalloc((size_t)threads, sizeof(deque_t));
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond_work, NULL);
+  pthread_cond_init(&pool->cond_done, NULL);
+
+  for (i = 0; i < threads; ++i)
+    pthread_mutex_init(&pool->deques[i].mutex, NULL);
+
+  for (i = 0; i < threads; ++i)
+  {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (pthread_create(pool->tids+i, NULL, worker_main, pool->workers+i))
+      fatal("Cannot create thread");
+  }
+
+  return pool;
+}
+
+long threadpool_size(threadpool_t * pool)
+{
+  return pool->threads;
+}
+
+void threadpool_submit(threadpool_t * pool,
+                       long worker,
+                       void (*cb)(void *, long),
+                       void * data)
+{
+  task_t task;
+
+  task.cb = cb;
+  task.data = data;
+
+  /* tasks submitted from outside the pool are spread among workers */
+  if (worker < 0)
+  {
+    pthread_mutex_lock(&pool->mutex);
+    worker = pool->next_deque;
+    pool->next_deque = (pool->next_deque + 1) % pool->threads;
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  deque_push(pool->deques + worker, task);
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->queued++;
+  pool->pending++;
+  pthread_cond_signal(&pool->cond_work);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void threadpool_wait(threadpool_t * pool)
+{
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->pending)
+    pthread_cond_wait(&pool->cond_done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void threadpool_destroy(threadpool_t * pool)
+{
+  long i;
+
+  threadpool_wait(pool);
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->cond_work);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 0; i < pool->threads; ++i)
+    pthread_join(pool->tids[i], NULL);
+
+  for (i = 0; i < pool->threads; ++i)
+  {
+    pthread_mutex_destroy(&pool->deques[i].mutex);
+    free(pool->deques[i].tasks);
+  }
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond_work);
+  pthread_cond_destroy(&pool->cond_done);
+
+  free(pool->deques);
+  free(pool->workers);
+  free(pool->tids);
+  free(pool);
+}
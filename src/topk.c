@@ -0,0 +1,481 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+
+/* candidates of an entry while its node is merged. The multi-rate method
+   keeps the K best candidates of each species count, whose AIC scores are
+   then in the same order as their log-likelihoods, and the single-rate
+   method the K best candidates of the entry in bucket 0. Each bucket is in
+   decreasing order of score */
+typedef struct dp_topk_list_s
+{
+  dp_cand_t ** bucket;
+  int * count;
+  int size;
+} dp_topk_list_t;
+
+/* Insert candidate c into the list of an entry, unless the bucket of c
+   already has K candidates with at least its score */
+static void dp_topk_insert(dp_topk_list_t * list,
+                           long method,
+                           long k,
+                           dp_cand_t * c)
+{
+  int p;
+  int x = (method == PTP_METHOD_MULTI) ? (int)c->species_count : 0;
+
+  if (x >= list->size)
+  {
+    int size = x + 1;
+    list->bucket = (dp_cand_t **)xrealloc(list->bucket,
+                                          (size_t)size * sizeof(dp_cand_t *));
+    list->count = (int *)xrealloc(list->count, (size_t)size * sizeof(int));
+    for (p = list->size; p < size; ++p)
+    {
+      list->bucket[p] = NULL;
+      list->count[p] = 0;
+    }
+    list->size = size;
+  }
+
+  dp_cand_t * bucket = list->bucket[x];
+  int count = list->count[x];
+
+  if (count == k && bucket[k-1].score >= c->score) return;
+
+  if (!bucket)
+    bucket = list->bucket[x] = (dp_cand_t *)xmalloc((size_t)k *
+                                                    sizeof(dp_cand_t));
+
+  /* after the candidates with the same score */
+  if (count < k) count++;
+  for (p = count-1; p > 0 && bucket[p-1].score < c->score; --p)
+    bucket[p] = bucket[p-1];
+
+  bucket[p] = *c;
+  list->count[x] = count;
+}
+
+/* Fill the candidates of each entry of the vector of node from the
+   candidates of its children. The scores are computed as in dp_merge().
+   The first candidate of an entry is the one dp_merge() selects, i.e. the
+   first best combination of the first candidates of the children, followed
+   by the kept candidates in decreasing order of score. As the score of a
+   delimitation is not a sum over the subtrees, the selection of dp_merge()
+   is a heuristic, and the remaining candidates may score higher */
+static void dp_topk_merge(rtree_t * node, long method, long k)
+{
+  int i,j,l;
+  int a,b;
+  dp_cand_t c;
+
+  long n = dp_width(node);
+
+  dp_topk_list_t * lists = (dp_topk_list_t *)xcalloc((size_t)n,
+                                                     sizeof(dp_topk_list_t));
+
+  /* candidate selected by dp_merge() for each entry */
+  dp_cand_t * ml = (dp_cand_t *)xmalloc((size_t)n * sizeof(dp_cand_t));
+  char * ml_set = (char *)xcalloc((size_t)n, sizeof(char));
+
+  node->coal_logl = loglikelihood(node->edge_count, node->edgelen_sum);
+
+  double spec_logl = loglikelihood(node->spec_edge_count,
+                                   node->spec_edgelen_sum);
+
+  /* entry 0 starts with the whole subtree being one coalescent */
+  c.score = node->coal_logl + spec_logl;
+  c.spec_edgelen_sum = 0;
+  c.coal_multi_logl = node->coal_logl;
+  c.species_count = 1;
+  c.left = -1;
+  c.left_rank = c.right_rank = 0;
+  if (dp_species_feasible(node, 1))
+  {
+    ml[0] = c;
+    ml_set[0] = 1;
+    dp_topk_insert(lists, method, k, &c);
+  }
+
+  if (node->left)
+  {
+    rtree_t * v = node->left;
+    rtree_t * w = node->right;
+
+    double u_edgelen_sum;
+    int u_edge_count = dp_child_edges(node, &u_edgelen_sum);
+
+    /* for a fixed candidate of the left child, the log-likelihoods of its
+       combinations with all candidates of the right child are computed as
+       one block, as in dp_merge() */
+    dp_block_t block;
+    dp_block_alloc(&block, w->topk_start[dp_width(w)] + 1);
+
+    for (j = 0; j < dp_width(v); ++j)
+    {
+      for (a = 0; a < v->topk_count[j]; ++a)
+      {
+        dp_cand_t * vc = v->topk + v->topk_start[j] + a;
+        long x;
+
+        block.count = 0;
+        for (l = 0; l < dp_width(w); ++l)
+        {
+          i = j + l + u_edge_count;
+          if (i >= n) break;
+
+          for (b = 0; b < w->topk_count[l]; ++b)
+          {
+            dp_cand_t * wc = w->topk + w->topk_start[l] + b;
+
+            if (!dp_species_feasible(node,
+                                     vc->species_count + wc->species_count))
+              continue;
+
+            dp_block_add(&block,
+                         node,
+                         i,
+                         u_edgelen_sum,
+                         vc->spec_edgelen_sum,
+                         wc->spec_edgelen_sum,
+                         l,
+                         b);
+          }
+        }
+
+        dp_block_logl(&block, method == PTP_METHOD_SINGLE);
+
+        for (x = 0; x < block.count; ++x)
+        {
+          l = block.left[x];
+          b = block.right[x];
+          i = j + l + u_edge_count;
+
+          dp_cand_t * wc = w->topk + w->topk_start[l] + b;
+
+          c.coal_multi_logl = vc->coal_multi_logl + wc->coal_multi_logl;
+          c.score = dp_block_score(&block, x, method, c.coal_multi_logl);
+          c.spec_edgelen_sum = block.u_spec_edgelen_sum[x];
+          c.species_count = vc->species_count + wc->species_count;
+          c.left = j;
+          c.left_rank = a;
+          c.right_rank = b;
+
+          if (!a && !b && (!ml_set[i] || c.score > ml[i].score))
+          {
+            ml[i] = c;
+            ml_set[i] = 1;
+          }
+
+          dp_topk_insert(lists + i, method, k, &c);
+        }
+      }
+    }
+
+    dp_block_free(&block);
+  }
+
+  /* store the lists of all entries in one array, the candidates of entry i
+     starting at topk_start[i] with the one selected by dp_merge(). The
+     remaining ones are ordered by decreasing score, then by species count,
+     and those with K predecessors of no more species are dropped, as the
+     predecessors also have lower AIC scores */
+  node->topk_count = (int *)xmalloc((size_t)n * sizeof(int));
+  node->topk_start = (long *)xmalloc((size_t)(n+1) * sizeof(long));
+  node->topk_start[0] = 0;
+  long max_count = 0;
+  int max_size = 0;
+  for (i = 0; i < n; ++i)
+  {
+    long count = ml_set[i];
+    for (j = 0; j < lists[i].size; ++j)
+      count += lists[i].count[j];
+
+    node->topk_start[i+1] = node->topk_start[i] + count;
+    if (count > max_count)
+      max_count = count;
+    if (lists[i].size > max_size)
+      max_size = lists[i].size;
+  }
+
+  node->topk = (dp_cand_t *)xmalloc((size_t)(node->topk_start[n] + 1) *
+                                    sizeof(dp_cand_t));
+  dp_cand_key_t * order = (dp_cand_key_t *)xmalloc((size_t)(max_count + 1) *
+                                                   sizeof(dp_cand_key_t));
+
+  /* Fenwick tree of the number of kept candidates per bucket */
+  long * kept = (long *)xmalloc((size_t)(max_size + 1) * sizeof(long));
+  for (i = 0; i < n; ++i)
+  {
+    dp_cand_t * x = node->topk + node->topk_start[i];
+    long count = 0;
+
+    for (j = 0; j < lists[i].size; ++j)
+    {
+      for (a = 0; a < lists[i].count[j]; ++a)
+      {
+        dp_cand_t * y = lists[i].bucket[j] + a;
+
+        if (ml_set[i] && y->left == ml[i].left &&
+            y->left_rank == ml[i].left_rank &&
+            y->right_rank == ml[i].right_rank)
+          continue;
+
+        order[count].cand = y;
+        order[count].key = -y->score;
+        order[count].index = j;
+        order[count++].rank = a;
+      }
+    }
+    qsort(order, (size_t)count, sizeof(dp_cand_key_t), dp_cand_key_cmp);
+
+    node->topk_count[i] = 0;
+    if (ml_set[i])
+      x[node->topk_count[i]++] = ml[i];
+
+    memset(kept, 0, (size_t)(lists[i].size + 1) * sizeof(long));
+    for (l = 0; l < count; ++l)
+    {
+      long before = 0;
+      for (b = order[l].index + 1; b > 0; b -= b & -b)
+        before += kept[b];
+      if (before >= k) continue;
+
+      for (b = order[l].index + 1; b <= lists[i].size; b += b & -b)
+        kept[b]++;
+
+      x[node->topk_count[i]++] = *order[l].cand;
+    }
+
+    for (j = 0; j < lists[i].size; ++j)
+      free(lists[i].bucket[j]);
+    free(lists[i].bucket);
+    free(lists[i].count);
+  }
+  free(kept);
+  free(order);
+  free(lists);
+  free(ml_set);
+  free(ml);
+}
+
+/* Order candidates by increasing key, as qsort() comparison function */
+int dp_cand_key_cmp(const void * va, const void * vb)
+{
+  const dp_cand_key_t * a = va;
+  const dp_cand_key_t * b = vb;
+
+  if (a->key < b->key) return -1;
+  if (a->key > b->key) return 1;
+
+  /* keep the order of entries and ranks for equal keys */
+  if (a->index != b->index) return a->index - b->index;
+  return a->rank - b->rank;
+}
+
+/* Back-track candidate 'rank' of entry 'index' of node and collect the
+   coalescent roots in preorder */
+static void dp_topk_backtrack(rtree_t * node,
+                              int index,
+                              int rank,
+                              rtree_t ** croots,
+                              long * croots_count)
+{
+  long top = 0;
+
+  rtree_t ** stack = (rtree_t **)xmalloc((size_t)(node->leaves + 1) *
+                                         sizeof(rtree_t *));
+  int * indices = (int *)xmalloc((size_t)(node->leaves + 1) * sizeof(int));
+  int * ranks = (int *)xmalloc((size_t)(node->leaves + 1) * sizeof(int));
+
+  stack[top] = node; indices[top] = index; ranks[top++] = rank;
+  while (top)
+  {
+    --top;
+    rtree_t * x = stack[top];
+    dp_cand_t * c = x->topk + x->topk_start[indices[top]] + ranks[top];
+
+    if (c->left == -1)
+    {
+      x->event = EVENT_COALESCENT;
+      croots[*croots_count] = x;
+      *croots_count = *croots_count + 1;
+      continue;
+    }
+
+    x->event = EVENT_SPECIATION;
+
+    stack[top] = x->right;
+    indices[top] = indices[top] - c->left - dp_child_edges(x, NULL);
+    ranks[top++] = c->right_rank;
+
+    stack[top] = x->left;
+    indices[top] = c->left;
+    ranks[top++] = c->left_rank;
+  }
+
+  free(ranks);
+  free(indices);
+  free(stack);
+}
+
+/* Enumerate the K best delimitations by keeping the K best candidates of
+   each DP entry instead of only the best one. As in dp_ptp(), the
+   single-rate delimitations are ranked by log-likelihood and the multi-rate
+   ones by AIC score. The first delimitation is the one of dp_ptp(), for any
+   K, followed by the best of the others. The delimitations are written to
+   the output file */
+void dp_topk(rtree_t * tree, long method, long k)
+{
+  long i,j;
+  int count;
+  long roots_count = 0;
+  long first = -1;
+  long best = -1;
+
+  rtree_t ** postorder = (rtree_t **)xmalloc((size_t)(2*tree->leaves - 1) *
+                                             sizeof(rtree_t *));
+  count = rtree_postorder(tree, postorder);
+
+  dp_bounds_init(tree);
+
+  loglikelihood_table_init(2*tree->leaves - 2);
+
+  for (i = 0; i < count; ++i)
+    dp_topk_merge(postorder[i], method, k);
+
+  /* collect the candidates of the root entries considered by
+     dp_best_entry(): the first filled entry and the ones below edge_count */
+  long size = tree->topk_start[dp_width(tree)] + 1;
+  dp_cand_key_t * roots = (dp_cand_key_t *)xmalloc((size_t)size *
+                                                   sizeof(dp_cand_key_t));
+  for (i = 0; i < dp_width(tree); ++i)
+  {
+    if (!tree->topk_count[i]) continue;
+
+    if (first == -1)
+      first = i;
+    else if (i >= tree->edge_count)
+      break;
+
+    for (j = 0; j < tree->topk_count[i]; ++j)
+    {
+      dp_cand_t * c = tree->topk + tree->topk_start[i] + j;
+
+      roots[roots_count].cand = c;
+      roots[roots_count].index = (int)i;
+      roots[roots_count].rank = (int)j;
+      roots[roots_count].key = (method == PTP_METHOD_MULTI) ?
+                    aic(c->score, c->species_count, tree->leaves+2) : -c->score;
+
+      /* the first candidates of the entries are the ones of dp_merge(),
+         among which dp_best_entry() selects the first best one */
+      if (!j && (best == -1 || roots[roots_count].key < roots[best].key))
+        best = roots_count;
+
+      roots_count++;
+    }
+  }
+
+  dp_species_check(roots_count);
+
+  /* the delimitation of dp_ptp() first, then the others by key */
+  dp_cand_key_t ml = roots[best];
+  roots[best] = roots[--roots_count];
+  qsort(roots, (size_t)roots_count, sizeof(dp_cand_key_t), dp_cand_key_cmp);
+  memmove(roots + 1, roots, (size_t)roots_count * sizeof(dp_cand_key_t));
+  roots[0] = ml;
+  roots_count++;
+  if (roots_count > k) roots_count = k;
+
+  FILE * out = open_file_ext("txt", opt_seed);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Writing %ld best delimitations to %s.txt ...\n",
+            roots_count,
+            opt_outfile);
+
+  fprintf(out, "Command: %s\n", cmdline);
+  fprintf(out,
+          "Number of edges greater than minimum branch length: %d / %d\n",
+           tree->edge_count,
+           2 * tree->leaves - 2);
+  fprintf(out, "Null-model score: %.6f\n", tree->coal_logl);
+
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)tree->leaves *
+                                          sizeof(rtree_t *));
+
+  for (i = 0; i < roots_count; ++i)
+  {
+    long croots_count = 0;
+    dp_cand_t * c = roots[i].cand;
+    double aic_score = aic(c->score, c->species_count, tree->leaves+2);
+
+    dp_topk_backtrack(tree,
+                      roots[i].index,
+                      roots[i].rank,
+                      croots,
+                      &croots_count);
+
+    if (!opt_quiet)
+      fprintf(stdout,
+              "Delimitation %ld: log-likelihood %.6f, AIC %.6f, %ld species\n",
+              i+1,
+              c->score,
+              aic_score,
+              croots_count);
+
+    fprintf(out,
+            "\nDelimitation %ld\n"
+            "Score for %s coalescent rate: %.6f\n"
+            "AIC score: %.6f\n"
+            "Number of delimited species: %ld\n",
+            i+1,
+            (method == PTP_METHOD_SINGLE) ? "single" : "multi",
+            c->score,
+            aic_score,
+            croots_count);
+
+    for (j = 0; j < croots_count; ++j)
+    {
+      fprintf(out, "\nSpecies %ld:\n", j+1);
+      rtree_print_tips(croots[j],out);
+    }
+  }
+
+  fclose(out);
+
+  for (i = 0; i < count; ++i)
+  {
+    free(postorder[i]->topk);
+    free(postorder[i]->topk_count);
+    free(postorder[i]->topk_start);
+    postorder[i]->topk = NULL;
+    postorder[i]->topk_count = NULL;
+    postorder[i]->topk_start = NULL;
+  }
+
+  free(croots);
+  free(roots);
+  free(postorder);
+}
@@ -0,0 +1,257 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Heidelberg Institute for Theoretical Studies,
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "mptp.h"
+
+/* Check of the incremental DP re-evaluation (--dp_update_check). Random
+   branch length changes and SPR moves are applied to the tree, and after
+   each edit the result of dp_update() is compared with a full DP fill of a
+   copy of the edited tree, whose edge statistics are recomputed from
+   scratch */
+
+/* whether node lies in the subtree rooted at root */
+static int update_in_subtree(rtree_t * node, rtree_t * root)
+{
+  for (; node; node = node->parent)
+    if (node == root)
+      return 1;
+
+  return 0;
+}
+
+/* Scale the length of the edge to node by a random factor, or shorten it
+   below the minimum branch length, such that the edge may also enter or
+   leave the edge statistics */
+static void update_edge_length(rtree_t * node, unsigned short * rstate)
+{
+  if (mptp_erand48(rstate) < 0.25)
+  {
+    node->length = opt_minbr * mptp_erand48(rstate);
+    return;
+  }
+
+  double len = (node->length > opt_minbr) ? node->length : 10 * opt_minbr;
+
+  node->length = len * exp(2 * mptp_erand48(rstate) - 1);
+}
+
+/* Prune the subtree at s together with its parent and regraft it on a random
+   edge outside the subtree. Marks the nodes whose incoming edges changed and
+   returns 0 if no move is possible */
+static int update_spr(rtree_t * root,
+                      rtree_t ** nodes,
+                      long count,
+                      rtree_t * s,
+                      unsigned short * rstate)
+{
+  long i;
+  rtree_t * p = s->parent;
+
+  if (!p || !p->parent) return 0;
+
+  /* regraft edge, above x */
+  long start = mptp_nrand48(rstate) % count;
+  rtree_t * x = NULL;
+  for (i = 0; i < count; ++i)
+  {
+    rtree_t * y = nodes[(start + i) % count];
+
+    if (y != root && y != p && !update_in_subtree(y, s))
+    {
+      x = y;
+      break;
+    }
+  }
+  if (!x) return 0;
+
+  /* prune, the sibling of s takes the place of p */
+  rtree_t * q = (p->left == s) ? p->right : p->left;
+  rtree_t * g = p->parent;
+
+  if (g->left == p)
+    g->left = q;
+  else
+    g->right = q;
+  q->parent = g;
+  q->length += p->length;
+
+  /* regraft, p splits the edge above x */
+  rtree_t * y = x->parent;
+
+  if (y->left == x)
+    y->left = p;
+  else
+    y->right = p;
+  p->parent = y;
+
+  if (p->left == s)
+    p->right = x;
+  else
+    p->left = x;
+  x->parent = p;
+
+  p->length = x->length * mptp_erand48(rstate);
+  x->length -= p->length;
+
+  dp_mark_dirty(q);
+  dp_mark_dirty(p);
+  dp_mark_dirty(x);
+
+  return 1;
+}
+
+/* ML delimitation of tree filled from scratch. Stores its log-likelihood in
+   logl and returns the number of species, whose roots are stored in croots */
+static long update_full_fill(rtree_t * tree,
+                             long method,
+                             dp_arena_t * arena,
+                             double * logl,
+                             rtree_t ** croots)
+{
+  bool warning_minbr = false;
+
+  rtree_reset_info(tree);
+
+  dp_init(tree, arena);
+  dp_set_pernode_spec_edges(tree);
+  dp_fill(tree, method);
+
+  long croots_count = dp_ml_croots(tree, method, logl, &warning_minbr, croots);
+
+  dp_free(tree);
+
+  return croots_count;
+}
+
+void dp_update_check(rtree_t * root, long method, long edits)
+{
+  long i,j;
+  long spr_count = 0;
+  long update_usec = 0;
+  long fill_usec = 0;
+  unsigned short rstate[3];
+  bool warning_minbr = false;
+
+  if (root->leaves < 2)
+    fatal("--dp_update_check requires a tree with at least two tips");
+
+  long count = 2*root->leaves - 1;
+
+  rtree_t ** nodes = (rtree_t **)xmalloc((size_t)count * sizeof(rtree_t *));
+  rtree_preorder(root, nodes);
+
+  rtree_t ** croots = (rtree_t **)xmalloc((size_t)root->leaves *
+                                          sizeof(rtree_t *));
+  rtree_t ** full_croots = (rtree_t **)xmalloc((size_t)root->leaves *
+                                               sizeof(rtree_t *));
+
+  random_init(rstate, opt_seed);
+
+  if (!opt_quiet)
+    fprintf(stdout,
+            "Checking incremental re-evaluation on %ld random edits "
+            "(seed %ld)...\n",
+            edits,
+            opt_seed);
+
+  dp_arena_t * arena = dp_arena_create();
+  dp_arena_t * full_arena = dp_arena_create();
+
+  dp_incremental_init(root, arena, method);
+
+  for (i = 0; i < edits; ++i)
+  {
+    double logl;
+    double full_logl;
+
+    /* the nodes are kept by the moves, hence any of them can be drawn */
+    rtree_t * node = nodes[1 + mptp_nrand48(rstate) % (count-1)];
+
+    if (mptp_erand48(rstate) < 0.5 &&
+        update_spr(root, nodes, count, node, rstate))
+    {
+      spr_count++;
+    }
+    else
+    {
+      update_edge_length(node, rstate);
+      dp_mark_dirty(node);
+    }
+
+    long start = getusec();
+    dp_update(root, arena, method);
+    update_usec += getusec() - start;
+
+    long croots_count = dp_ml_croots(root, method, &logl, &warning_minbr, croots);
+
+    start = getusec();
+    rtree_t * full = rtree_clone(root, NULL);
+    long full_count = update_full_fill(full,
+                                       method,
+                                       full_arena,
+                                       &full_logl,
+                                       full_croots);
+    fill_usec += getusec() - start;
+
+    /* both trees have the same shape and their species roots are listed in
+       preorder, hence the sequence of species sizes identifies the
+       delimitation */
+    int same = (croots_count == full_count && logl == full_logl);
+    for (j = 0; same && j < croots_count; ++j)
+      if (croots[j]->leaves != full_croots[j]->leaves)
+        same = 0;
+
+    rtree_destroy(full);
+
+    if (!same)
+      fatal("Incremental re-evaluation differs from the full DP fill after "
+            "edit %ld: %ld species (%.*f) instead of %ld species (%.*f)",
+            i+1,
+            croots_count,
+            opt_precision,
+            logl,
+            full_count,
+            opt_precision,
+            full_logl);
+  }
+
+  dp_incremental_free(root);
+  dp_arena_destroy(arena);
+  dp_arena_destroy(full_arena);
+
+  if (!opt_quiet)
+  {
+    fprintf(stdout,
+            "Incremental re-evaluation matches the full DP fill on %ld edits "
+            "(%ld branch length changes, %ld SPR moves)\n",
+            edits,
+            edits - spr_count,
+            spr_count);
+    fprintf(stdout,
+            "Incremental time: %.3f s, full fill time: %.3f s\n",
+            update_usec / 1e6,
+            fill_usec / 1e6);
+  }
+
+  free(full_croots);
+  free(croots);
+  free(nodes);
+}
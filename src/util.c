@@ -158,6 +158,18 @@ FILE * xopen(const char * filename, const char * mode)
   return out;
 }
 
+void xfwrite(const void * ptr, size_t size, size_t count, FILE * fp)
+{
+  if (fwrite(ptr, size, count, fp) != count)
+    fatal("Unable to write to file");
+}
+
+void xfread(void * ptr, size_t size, size_t count, FILE * fp)
+{
+  if (fread(ptr, size, count, fp) != count)
+    fatal("Unexpected end of file");
+}
+
 void random_init(unsigned short * rstate, long seedval)
 {
   /* emulate drand48() */
@@ -204,3 +216,30 @@ long mptp_nrand48(unsigned short * rstate)
   mptp_randomize(rstate);
   return ((long)rstate[2] << 15) + ((long)rstate[1] >> 1);
 }
+
+/* parse a comma-separated list of non-negative reals given to option */
+double * parse_real_list(const char * list, const char * option, long * count)
+{
+  long n = 1;
+  const char * p;
+  char * end;
+
+  for (p = list; *p; ++p)
+    if (*p == ',')
+      ++n;
+
+  double * values = (double *)xmalloc((size_t)n * sizeof(double));
+
+  for (*count = 0, p = list; *count < n; p = end + 1)
+  {
+    values[*count] = strtod(p, &end);
+    if (end == p || (*end && *end != ','))
+      fatal("Invalid list of values in %s", option);
+    if (values[*count] < 0)
+      fatal("Values in %s must be non-negative", option);
+
+    *count = *count + 1;
+  }
+
+  return values;
+}
@@ -459,10 +459,10 @@ rtree_t * utree_convert_rtree(utree_t * outgroup)
 
 }
 
-static utree_t ** utree_tipstring_nodes(utree_t * root,
-                                        char * tipstring,
-                                        unsigned int utree_tip_count,
-                                        unsigned int * tiplist_count)
+utree_t ** utree_tipstring_nodes(utree_t * root,
+                                 char * tipstring,
+                                 unsigned int utree_tip_count,
+                                 unsigned int * tiplist_count)
 {
   unsigned int i;
   unsigned int k;
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+# A DP table filled in single precision (--dp_float) must yield the same
+# delimitation as the table filled in double precision, or be refilled in
+# double precision. The rounded entries of dp_float.nwk change which of two
+# candidates with the same log-likelihood is kept within the DP, which
+# selects a delimitation with another number of species
+
+MPTP=${MPTP:-../bin/mptp}
+srcdir=${srcdir:-.}
+
+status=0
+
+for method in --multi --single
+do
+  for mode in "" --lowmem
+  do
+    $MPTP --ml $method $mode --tree_file $srcdir/dp_float.nwk \
+          --output_file dp_float_double.out > /dev/null 2>&1 || exit 1
+    $MPTP --ml $method $mode --dp_float --tree_file $srcdir/dp_float.nwk \
+          --output_file dp_float_single.out > /dev/null 2>&1 || exit 1
+
+    # the first line of the output records the command
+    if ! tail -n +2 dp_float_double.out.txt > dp_float_double.out.cmp ||
+       ! tail -n +2 dp_float_single.out.txt > dp_float_single.out.cmp ||
+       ! cmp -s dp_float_double.out.cmp dp_float_single.out.cmp
+    then
+      echo "--dp_float changes the delimitation ($method $mode)"
+      status=1
+    fi
+  done
+done
+
+rm -f dp_float_double.out.* dp_float_single.out.*
+
+exit $status
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# The first delimitation of --ml_topk must be the one of --ml for every K.
+# As the score of a delimitation is not a sum over the subtrees, keeping
+# more candidates per DP entry finds delimitations of topk.nwk which score
+# higher than the one of --ml
+
+MPTP=${MPTP:-../bin/mptp}
+srcdir=${srcdir:-.}
+
+status=0
+
+for method in --multi --single
+do
+  $MPTP --ml $method --tree_file $srcdir/topk.nwk \
+        --output_file topk_ml.out > /dev/null 2>&1 || exit 1
+
+  # score, number of species and species of the ML delimitation
+  awk '/^Best score/ { print "score", $NF }
+       /^Number of delimited species/ { print "species", $NF }
+       /^Species 1:/ { s = 1 }
+       s && NF' topk_ml.out.txt > topk_ml.out.cmp
+
+  for k in 1 2 5 20
+  do
+    $MPTP --ml_topk $k $method --tree_file $srcdir/topk.nwk \
+          --output_file topk_k.out > /dev/null 2>&1 || exit 1
+
+    awk '/^Delimitation 2$/ { exit }
+         /^Score for/ { print "score", $NF }
+         /^Number of delimited species/ { print "species", $NF }
+         /^Species 1:/ { s = 1 }
+         s && NF' topk_k.out.txt > topk_k.out.cmp
+
+    if ! cmp -s topk_ml.out.cmp topk_k.out.cmp
+    then
+      echo "--ml_topk $k $method does not start with the delimitation of --ml"
+      status=1
+    fi
+  done
+done
+
+rm -f topk_ml.out.* topk_k.out.*
+
+exit $status